@@ -32,11 +32,12 @@ def main():
     manager = Ldm.Manager()
     manager.add_plugin(BluezPlugin())
 
-    # An alternative is just to see if the len(devices) is not empty.
-    devices = manager.get_devices(Ldm.DeviceType.BLUETOOTH)
-    providerset = [manager.get_providers(x) for x in devices if x.has_attribute(Ldm.DeviceAttribute.HOST)]
-    for providers in providerset:
-        device = providers[0].get_device()
+    # Resolve every bluetooth device in one go, only those with providers
+    # are returned.
+    providerset = manager.get_all_providers(Ldm.DeviceType.BLUETOOTH)
+    for device, providers in providerset.items():
+        if not device.has_attribute(Ldm.DeviceAttribute.HOST):
+            continue
         for provider in providers:
             print("Provider for {} ({} {}): {}".format(
                 device.get_path(),
@@ -44,6 +44,9 @@ def main():
     manager = Ldm.Manager()
     manager.add_plugin(PretendyPlugin())
 
+    # Resolve the providers of all USB devices at once
+    all_providers = manager.get_all_providers(Ldm.DeviceType.USB)
+
     for device in manager.get_devices(Ldm.DeviceType.USB):
         # Use gobject properties or methods
         print("USB Device: {} {}".format(
@@ -53,7 +56,7 @@ def main():
         if device.has_type(Ldm.DeviceType.HID):
             print("\tHID Device!")
 
-        for provider in manager.get_providers(device):
+        for provider in all_providers.get(device, []):
             plugin = provider.get_plugin()
             print("\tSuggested package: {}".format(provider.get_package()))
 
@@ -38,7 +38,7 @@ static int ldm_cli_configure_gpu(void)
         g_autoptr(LdmGLXManager) glx_manager = NULL;
 
         /* Need manager without hotplug capabilities */
-        manager = ldm_manager_new(LDM_MANAGER_FLAGS_NO_MONITOR);
+        manager = ldm_manager_new(LDM_MANAGER_FLAGS_NO_MONITOR | LDM_MANAGER_FLAGS_SNAPSHOT);
         if (!manager) {
                 fputs("Failed to initialise LdmManager\n", stderr);
                 return EXIT_FAILURE;
@@ -56,6 +56,8 @@ int main(int argc, char **argv)
 
         opt_context = g_option_context_new(NULL);
         g_option_context_add_main_entries(opt_context, cli_entries, "linux-driver-management");
+        /* Leave options after the subcommand to the subcommand */
+        g_option_context_set_strict_posix(opt_context, TRUE);
         g_option_context_set_summary(opt_context,
                                      "Interface with the linux-driver-management library");
         g_option_context_set_description(opt_context,
@@ -63,6 +65,7 @@ int main(int argc, char **argv)
 \n\
         configure   - Attempt configuration of a subsystem\n\
         status      - Emit the status for known, detected devices\n\
+                      (--stats: also emit plugin matching statistics)\n\
         version     - Print the version and quit\n\
 ");
 
@@ -17,13 +17,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 
-static void print_drivers(LdmManager *manager, LdmDevice *device)
+/* Most expensive rules to show for each plugin with --stats */
+#define STATS_MAX_RULES 5
+
+static void print_drivers(GHashTable *all_providers, LdmDevice *device)
 {
-        g_autoptr(GPtrArray) providers = NULL;
+        GPtrArray *providers = NULL;
 
         /* Look for provider options */
-        providers = ldm_manager_get_providers(manager, device);
-        if (providers->len < 1) {
+        providers = g_hash_table_lookup(all_providers, device);
+        if (!providers) {
                 return;
         }
 
@@ -83,7 +86,7 @@ static void print_device(LdmDevice *device)
 /**
  * Handle pretty printing of the GPU configuration to the display
  */
-static void print_gpu_config(LdmManager *manager, LdmGPUConfig *config)
+static void print_gpu_config(GHashTable *all_providers, LdmGPUConfig *config)
 {
         LdmDevice *primary = NULL, *secondary = NULL;
 
@@ -125,7 +128,7 @@ static void print_gpu_config(LdmManager *manager, LdmGPUConfig *config)
 emit_gpu_drivers:
 
         /* Only emit the drivers for the primary detection device */
-        print_drivers(manager, ldm_gpu_config_get_detection_device(config));
+        print_drivers(all_providers, ldm_gpu_config_get_detection_device(config));
 }
 
 /**
@@ -142,10 +145,10 @@ static void print_platform_device(LdmDevice *device)
 /**
  * Handle pretty printing of the remaining devices.
  */
-static void print_non_gpu(LdmManager *manager, LdmDevice *device)
+static void print_non_gpu(GHashTable *all_providers, LdmDevice *device)
 {
         const gchar *device_title = NULL;
-        g_autoptr(GPtrArray) providers = NULL;
+        GPtrArray *providers = NULL;
 
         /* We've already handled GPU devices in a special fashion */
         if (ldm_device_has_type(device, LDM_DEVICE_TYPE_GPU)) {
@@ -158,8 +161,8 @@ static void print_non_gpu(LdmManager *manager, LdmDevice *device)
         }
 
         /* Only emit actionable items here */
-        providers = ldm_manager_get_providers(manager, device);
-        if (providers->len < 1) {
+        providers = g_hash_table_lookup(all_providers, device);
+        if (!providers) {
                 return;
         }
 
@@ -200,14 +203,69 @@ static void print_non_gpu(LdmManager *manager, LdmDevice *device)
         fputs("\n", stdout);
 }
 
-int ldm_cli_status(__ldm_unused__ int argc, __ldm_unused__ char **argv)
+/**
+ * Emit the totals for each plugin, and its most expensive rules
+ */
+static void print_match_stats(LdmManager *manager)
+{
+        g_autoptr(GPtrArray) stats = NULL;
+        guint n_rules = 0;
+
+        stats = ldm_manager_get_match_stats(manager);
+
+        fputs("Match statistics:\n", stdout);
+        for (guint i = 0; i < stats->len; i++) {
+                LdmMatchStats *entry = stats->pdata[i];
+
+                if (!entry->match) {
+                        fprintf(stdout,
+                                " %s: %" G_GUINT64_FORMAT " tested, %" G_GUINT64_FORMAT
+                                " matched, %.3f ms\n",
+                                entry->plugin,
+                                entry->n_candidates,
+                                entry->n_matches,
+                                (gdouble)entry->nanoseconds / 1000000.0);
+                        n_rules = 0;
+                        continue;
+                }
+
+                if (++n_rules > STATS_MAX_RULES) {
+                        continue;
+                }
+
+                fprintf(stdout,
+                        "    %s: %" G_GUINT64_FORMAT " tested, %" G_GUINT64_FORMAT
+                        " matched, %" G_GUINT64_FORMAT " ns\n",
+                        entry->match,
+                        entry->n_candidates,
+                        entry->n_matches,
+                        entry->nanoseconds);
+        }
+}
+
+int ldm_cli_status(int argc, char **argv)
 {
         g_autoptr(LdmManager) manager = NULL;
         g_autoptr(LdmGPUConfig) gpu_config = NULL;
         g_autoptr(GPtrArray) devices = NULL;
+        g_autoptr(GHashTable) all_providers = NULL;
+        LdmManagerFlags flags = LDM_MANAGER_FLAGS_NO_MONITOR | LDM_MANAGER_FLAGS_SNAPSHOT;
+        gboolean stats = FALSE;
+
+        for (int i = 1; i < argc; i++) {
+                if (!g_str_equal(argv[i], "--stats")) {
+                        fprintf(stderr, "Unknown option '%s'\n", argv[i]);
+                        return EXIT_FAILURE;
+                }
+                stats = TRUE;
+        }
+
+        if (stats) {
+                flags |= LDM_MANAGER_FLAGS_MATCH_STATS;
+        }
 
         /* No need for hot plug events */
-        manager = ldm_manager_new(LDM_MANAGER_FLAGS_NO_MONITOR);
+        manager = ldm_manager_new(flags);
         if (!manager) {
                 fprintf(stderr, "Failed to initialiase LdmManager\n");
                 return EXIT_FAILURE;
@@ -224,14 +282,21 @@ int ldm_cli_status(__ldm_unused__ int argc, __ldm_unused__ char **argv)
                 return EXIT_FAILURE;
         }
 
+        /* Resolve every provider up front */
+        all_providers = ldm_manager_get_all_providers(manager, LDM_DEVICE_TYPE_ANY);
+
         /* Emit non GPU items here, platform first */
         devices = ldm_manager_get_devices(manager, LDM_DEVICE_TYPE_ANY);
         for (guint i = 0; i < devices->len; i++) {
-                print_non_gpu(manager, devices->pdata[i]);
+                print_non_gpu(all_providers, devices->pdata[i]);
         }
 
         /* Emit GPU config last for consistency */
-        print_gpu_config(manager, gpu_config);
+        print_gpu_config(all_providers, gpu_config);
+
+        if (stats) {
+                print_match_stats(manager);
+        }
 
         return EXIT_SUCCESS;
 }
@@ -0,0 +1,617 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Linux Driver Management Developers, Solus Project
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+
+#include "device-snapshot.h"
+
+/* Supported device types */
+#include "bluetooth-device.h"
+#include "dmi-device.h"
+#include "hid-device.h"
+#include "pci-device.h"
+#include "usb-device.h"
+#include "wifi-device.h"
+
+#define LDM_DEVICE_SNAPSHOT_MAGIC "LDMSNAPS"
+#define LDM_DEVICE_SNAPSHOT_VERSION 1
+#define LDM_DEVICE_SNAPSHOT_BYTE_ORDER 0x01020304
+
+/* Offset of a string that isn't set */
+#define LDM_DEVICE_SNAPSHOT_NONE G_MAXUINT32
+
+/* FNV-1a */
+#define LDM_DEVICE_SNAPSHOT_HASH_INIT G_GUINT64_CONSTANT(0xcbf29ce484222325)
+#define LDM_DEVICE_SNAPSHOT_HASH_PRIME G_GUINT64_CONSTANT(0x100000001b3)
+
+/*
+ * The snapshot is laid out in host byte order as:
+ *
+ *      header | records[n_records] | string pool
+ *
+ * Records are in depth first order, so that each parent precedes its
+ * children. Top level devices are in the order the manager found them.
+ * Strings and udev property blobs are offsets into the pool.
+ */
+typedef struct LdmDeviceSnapshotHeader {
+        gchar magic[8];
+        guint32 version;
+        guint32 byte_order;
+        guint64 fingerprint;
+        guint32 flags; /* Manager flags that change what is enumerated */
+        gint32 next_priority;
+        guint32 n_records;
+        guint32 pool_size;
+} LdmDeviceSnapshotHeader;
+
+typedef struct LdmDeviceSnapshotRecord {
+        gint32 parent; /* Index of the parent record, or -1 */
+        gint32 priority;
+        guint32 type; /* LdmDeviceSnapshotType */
+        guint32 devtype;
+        guint32 attributes;
+        gint32 product_id;
+        gint32 vendor_id;
+        guint32 sysfs_path;
+        guint32 modalias;
+        guint32 name;
+        guint32 vendor;
+        guint32 properties;
+        guint32 properties_size;
+        guint32 n_properties;
+} LdmDeviceSnapshotRecord;
+
+typedef enum {
+        LDM_DEVICE_SNAPSHOT_TYPE_DEVICE = 0,
+        LDM_DEVICE_SNAPSHOT_TYPE_BLUETOOTH,
+        LDM_DEVICE_SNAPSHOT_TYPE_DMI,
+        LDM_DEVICE_SNAPSHOT_TYPE_HID,
+        LDM_DEVICE_SNAPSHOT_TYPE_PCI,
+        LDM_DEVICE_SNAPSHOT_TYPE_USB,
+        LDM_DEVICE_SNAPSHOT_TYPE_WIFI,
+        LDM_DEVICE_SNAPSHOT_N_TYPES,
+} LdmDeviceSnapshotType;
+
+static GType ldm_device_snapshot_get_gtype(LdmDeviceSnapshotType type)
+{
+        switch (type) {
+        case LDM_DEVICE_SNAPSHOT_TYPE_BLUETOOTH:
+                return LDM_TYPE_BLUETOOTH_DEVICE;
+        case LDM_DEVICE_SNAPSHOT_TYPE_DMI:
+                return LDM_TYPE_DMI_DEVICE;
+        case LDM_DEVICE_SNAPSHOT_TYPE_HID:
+                return LDM_TYPE_HID_DEVICE;
+        case LDM_DEVICE_SNAPSHOT_TYPE_PCI:
+                return LDM_TYPE_PCI_DEVICE;
+        case LDM_DEVICE_SNAPSHOT_TYPE_USB:
+                return LDM_TYPE_USB_DEVICE;
+        case LDM_DEVICE_SNAPSHOT_TYPE_WIFI:
+                return LDM_TYPE_WIFI_DEVICE;
+        default:
+                return LDM_TYPE_DEVICE;
+        }
+}
+
+static LdmDeviceSnapshotType ldm_device_snapshot_get_type(LdmDevice *device)
+{
+        GType gtype = G_TYPE_FROM_INSTANCE(device);
+
+        for (guint i = 0; i < LDM_DEVICE_SNAPSHOT_N_TYPES; i++) {
+                if (ldm_device_snapshot_get_gtype(i) == gtype) {
+                        return i;
+                }
+        }
+
+        return LDM_DEVICE_SNAPSHOT_TYPE_DEVICE;
+}
+
+static guint64 ldm_device_snapshot_hash(guint64 hash, const gchar *data, gsize length)
+{
+        for (gsize i = 0; i < length; i++) {
+                hash ^= (guchar)data[i];
+                hash *= LDM_DEVICE_SNAPSHOT_HASH_PRIME;
+        }
+
+        return hash;
+}
+
+/**
+ * ldm_device_snapshot_hash_file:
+ *
+ * Add the contents of a file to the hash, if it can be read
+ */
+static guint64 ldm_device_snapshot_hash_file(guint64 hash, const gchar *path)
+{
+        g_autofree gchar *contents = NULL;
+        gsize length = 0;
+
+        if (!g_file_get_contents(path, &contents, &length, NULL)) {
+                return hash;
+        }
+
+        return ldm_device_snapshot_hash(hash, contents, length);
+}
+
+/**
+ * ldm_device_snapshot_hash_link:
+ *
+ * Add the target of a symlink to the hash, if it has one
+ */
+static guint64 ldm_device_snapshot_hash_link(guint64 hash, const gchar *path)
+{
+        g_autofree gchar *target = NULL;
+
+        target = g_file_read_link(path, NULL);
+        if (!target) {
+                return hash;
+        }
+
+        return ldm_device_snapshot_hash(hash, target, strlen(target) + 1);
+}
+
+/**
+ * ldm_device_snapshot_hash_directory:
+ * @gpu_only: Only consider the attributes that identify a GPU
+ *
+ * Add the name of each device within the directory to the hash, along
+ * with its uevent attributes, or just its class and driver with @gpu_only.
+ */
+static guint64 ldm_device_snapshot_hash_directory(guint64 hash, const gchar *directory,
+                                                  gboolean gpu_only)
+{
+        GDir *dir = NULL;
+        const gchar *name = NULL;
+
+        hash = ldm_device_snapshot_hash(hash, directory, strlen(directory) + 1);
+
+        dir = g_dir_open(directory, 0, NULL);
+        if (!dir) {
+                return hash;
+        }
+
+        while ((name = g_dir_read_name(dir)) != NULL) {
+                g_autofree gchar *path = NULL;
+
+                hash = ldm_device_snapshot_hash(hash, name, strlen(name) + 1);
+
+                if (!gpu_only) {
+                        path = g_build_filename(directory, name, "uevent", NULL);
+                        hash = ldm_device_snapshot_hash_file(hash, path);
+                        continue;
+                }
+
+                path = g_build_filename(directory, name, "class", NULL);
+                hash = ldm_device_snapshot_hash_file(hash, path);
+                g_free(path);
+
+                path = g_build_filename(directory, name, "driver", NULL);
+                hash = ldm_device_snapshot_hash_link(hash, path);
+        }
+
+        g_dir_close(dir);
+        return hash;
+}
+
+/**
+ * ldm_device_snapshot_fingerprint:
+ * @gpu_only: Whether the snapshot only holds the GPUs
+ *
+ * Summarise the devices on the system, cheaply, such that any device being
+ * added, removed or changed since gives a new fingerprint. Only the
+ * subsystems the manager enumerates are considered: the name of each device
+ * within them, and its uevent attributes, which include the driver bound
+ * to it. Events for any other device, such as a battery or thermal zone,
+ * leave the fingerprint as it was.
+ *
+ * With @gpu_only, as for %LDM_MANAGER_FLAGS_GPU_QUICK, only the PCI devices
+ * are considered, by their name, class and bound driver, so that taking
+ * the fingerprint costs less than finding the GPUs again.
+ *
+ * Returns: The fingerprint of the current boot and its devices
+ */
+guint64 ldm_device_snapshot_fingerprint(gboolean gpu_only)
+{
+        static const gchar *directories[] = {
+                "/sys/class/dmi",       "/sys/bus/usb/devices", "/sys/bus/pci/devices",
+                "/sys/class/ieee80211", "/sys/class/bluetooth", "/sys/bus/hid/devices",
+        };
+        guint64 ret = LDM_DEVICE_SNAPSHOT_HASH_INIT;
+
+        /* Devices may well be found in the same place after a reboot */
+        ret = ldm_device_snapshot_hash_file(ret, "/proc/sys/kernel/random/boot_id");
+
+        if (gpu_only) {
+                return ldm_device_snapshot_hash_directory(ret, "/sys/bus/pci/devices", TRUE);
+        }
+
+        for (guint i = 0; i < G_N_ELEMENTS(directories); i++) {
+                ret = ldm_device_snapshot_hash_directory(ret, directories[i], FALSE);
+        }
+
+        return ret;
+}
+
+/*
+ * Used to construct a new snapshot from the devices
+ */
+typedef struct LdmDeviceSnapshotBuilder {
+        GArray *records; /* LdmDeviceSnapshotRecord, depth first */
+        GByteArray *pool;
+} LdmDeviceSnapshotBuilder;
+
+static guint32 ldm_device_snapshot_add_data(LdmDeviceSnapshotBuilder *builder, const gchar *data,
+                                            gsize length)
+{
+        guint32 ret = builder->pool->len;
+
+        g_byte_array_append(builder->pool, (const guint8 *)data, (guint)length);
+        return ret;
+}
+
+static guint32 ldm_device_snapshot_add_string(LdmDeviceSnapshotBuilder *builder, const gchar *str)
+{
+        if (!str) {
+                return LDM_DEVICE_SNAPSHOT_NONE;
+        }
+
+        return ldm_device_snapshot_add_data(builder, str, strlen(str) + 1);
+}
+
+/**
+ * ldm_device_snapshot_properties_size:
+ *
+ * Find the length of the udev property blob of a device, which ends with
+ * the value of its last property.
+ */
+static gsize ldm_device_snapshot_properties_size(LdmDevice *device)
+{
+        const guint32 *offsets = (const guint32 *)(gconstpointer)device->os.properties;
+        const gchar *name = NULL;
+        const gchar *value = NULL;
+
+        if (device->os.n_properties < 1) {
+                return 0;
+        }
+
+        name = device->os.properties + offsets[device->os.n_properties - 1];
+        value = name + strlen(name) + 1;
+
+        return (gsize)(value - device->os.properties) + strlen(value) + 1;
+}
+
+/**
+ * ldm_device_snapshot_add_device:
+ *
+ * Add a record for the device and then, recursively, for its children
+ */
+static void ldm_device_snapshot_add_device(LdmDeviceSnapshotBuilder *builder, LdmDevice *device,
+                                           gint32 parent)
+{
+        LdmDeviceSnapshotRecord record = { 0 };
+        g_autoptr(GList) kids = NULL;
+        gsize properties_size = 0;
+        gint32 index = 0;
+
+        record.parent = parent;
+        record.priority = device->priority;
+        record.type = ldm_device_snapshot_get_type(device);
+        record.devtype = device->os.devtype;
+        record.attributes = device->os.attributes;
+        record.product_id = device->id.product_id;
+        record.vendor_id = device->id.vendor_id;
+        record.sysfs_path = ldm_device_snapshot_add_string(builder, device->os.sysfs_path);
+        record.modalias = ldm_device_snapshot_add_string(builder, device->os.modalias);
+        record.name = ldm_device_snapshot_add_string(builder, device->id.name);
+        record.vendor = ldm_device_snapshot_add_string(builder, device->id.vendor);
+
+        properties_size = ldm_device_snapshot_properties_size(device);
+        record.properties =
+            ldm_device_snapshot_add_data(builder, device->os.properties, properties_size);
+        record.properties_size = (guint32)properties_size;
+        record.n_properties = device->os.n_properties;
+
+        index = (gint32)builder->records->len;
+        g_array_append_val(builder->records, record);
+
+        kids = ldm_device_get_children(device);
+        for (GList *elem = kids; elem; elem = elem->next) {
+                ldm_device_snapshot_add_device(builder, elem->data, index);
+        }
+}
+
+/**
+ * ldm_device_snapshot_write:
+ * @devices: Top level devices of the manager, in the order it found them
+ * @next_priority: Priority for the next device the manager finds
+ * @flags: Manager flags that change which devices are enumerated
+ * @fingerprint: Fingerprint taken before the devices were enumerated
+ * @path: Path to write the snapshot to
+ * @error: Return location for an error
+ *
+ * Store the devices and all of their children, atomically replacing any
+ * existing snapshot at @path.
+ *
+ * Returns: TRUE if the snapshot was written
+ */
+gboolean ldm_device_snapshot_write(GPtrArray *devices, gint next_priority, guint32 flags,
+                                   guint64 fingerprint, const gchar *path, GError **error)
+{
+        LdmDeviceSnapshotBuilder builder = { 0 };
+        LdmDeviceSnapshotHeader header = { 0 };
+        g_autoptr(GByteArray) data = NULL;
+        gboolean ret = FALSE;
+
+        g_return_val_if_fail(devices != NULL, FALSE);
+        g_return_val_if_fail(path != NULL, FALSE);
+
+        builder.records = g_array_new(FALSE, FALSE, sizeof(LdmDeviceSnapshotRecord));
+        builder.pool = g_byte_array_new();
+
+        for (guint i = 0; i < devices->len; i++) {
+                ldm_device_snapshot_add_device(&builder, devices->pdata[i], -1);
+        }
+
+        /* Never leave the pool empty so validation is trivial */
+        if (builder.pool->len < 1) {
+                g_byte_array_append(builder.pool, (const guint8 *)"", 1);
+        }
+
+        memcpy(header.magic, LDM_DEVICE_SNAPSHOT_MAGIC, sizeof(header.magic));
+        header.version = LDM_DEVICE_SNAPSHOT_VERSION;
+        header.byte_order = LDM_DEVICE_SNAPSHOT_BYTE_ORDER;
+        header.fingerprint = fingerprint;
+        header.flags = flags;
+        header.next_priority = next_priority;
+        header.n_records = builder.records->len;
+        header.pool_size = builder.pool->len;
+
+        data = g_byte_array_new();
+        g_byte_array_append(data, (const guint8 *)&header, sizeof(header));
+        g_byte_array_append(data,
+                            (const guint8 *)builder.records->data,
+                            builder.records->len * (guint)sizeof(LdmDeviceSnapshotRecord));
+        g_byte_array_append(data, builder.pool->data, builder.pool->len);
+
+        ret = g_file_set_contents(path, (const gchar *)data->data, data->len, error);
+
+        g_array_unref(builder.records);
+        g_byte_array_unref(builder.pool);
+
+        return ret;
+}
+
+/**
+ * ldm_device_snapshot_valid_string:
+ *
+ * Strings are terminated as the pool ends with a nul byte
+ */
+static gboolean ldm_device_snapshot_valid_string(const LdmDeviceSnapshotHeader *header,
+                                                 guint32 offset, gboolean optional)
+{
+        if (offset == LDM_DEVICE_SNAPSHOT_NONE) {
+                return optional;
+        }
+
+        return offset < header->pool_size;
+}
+
+/**
+ * ldm_device_snapshot_read_properties:
+ *
+ * Copy the udev property blob of a record out of the pool, ensuring every
+ * name and value lies within it before the device may bisect them.
+ *
+ * Returns: TRUE if the blob is valid
+ */
+static gboolean ldm_device_snapshot_read_properties(const LdmDeviceSnapshotHeader *header,
+                                                    const LdmDeviceSnapshotRecord *record,
+                                                    const gchar *pool, gchar **properties)
+{
+        g_autofree gchar *blob = NULL;
+        const guint32 *offsets = NULL;
+        guint32 size = record->properties_size;
+
+        if (record->n_properties < 1) {
+                *properties = NULL;
+                return size == 0;
+        }
+
+        if ((guint64)record->properties + size > header->pool_size ||
+            (guint64)record->n_properties * sizeof(guint32) >= size) {
+                return FALSE;
+        }
+
+        blob = g_malloc(size);
+        memcpy(blob, pool + record->properties, size);
+        if (blob[size - 1] != '\0') {
+                return FALSE;
+        }
+
+        offsets = (const guint32 *)(gconstpointer)blob;
+        for (guint32 i = 0; i < record->n_properties; i++) {
+                if (offsets[i] < record->n_properties * sizeof(guint32) || offsets[i] >= size) {
+                        return FALSE;
+                }
+                /* The value follows the name */
+                if (offsets[i] + strlen(blob + offsets[i]) + 1 >= size) {
+                        return FALSE;
+                }
+        }
+
+        *properties = g_steal_pointer(&blob);
+        return TRUE;
+}
+
+/**
+ * ldm_device_snapshot_validate_record:
+ *
+ * Ensure every offset of the record is sane before we trust it
+ */
+static gboolean ldm_device_snapshot_validate_record(const LdmDeviceSnapshotHeader *header,
+                                                    const LdmDeviceSnapshotRecord *record,
+                                                    guint32 index)
+{
+        if (record->parent >= (gint64)index || record->parent < -1) {
+                return FALSE;
+        }
+
+        if (record->type >= LDM_DEVICE_SNAPSHOT_N_TYPES) {
+                return FALSE;
+        }
+
+        return ldm_device_snapshot_valid_string(header, record->sysfs_path, FALSE) &&
+               ldm_device_snapshot_valid_string(header, record->modalias, TRUE) &&
+               ldm_device_snapshot_valid_string(header, record->name, TRUE) &&
+               ldm_device_snapshot_valid_string(header, record->vendor, TRUE);
+}
+
+static gchar *ldm_device_snapshot_dup_string(const gchar *pool, guint32 offset)
+{
+        if (offset == LDM_DEVICE_SNAPSHOT_NONE) {
+                return NULL;
+        }
+
+        return g_strdup(pool + offset);
+}
+
+/**
+ * ldm_device_snapshot_read:
+ * @path: Path to the snapshot
+ * @flags: Manager flags that change which devices are enumerated
+ * @fingerprint: Current fingerprint of the system
+ * @next_priority: (out): Priority for the next device the manager finds
+ *
+ * Rebuild the device tree from the snapshot, provided it is valid and was
+ * taken with the same @flags and @fingerprint.
+ *
+ * Returns: (transfer full) (nullable): The top level devices, in the order
+ *          they were found, or NULL if the snapshot is missing, invalid or
+ *          stale
+ */
+GPtrArray *ldm_device_snapshot_read(const gchar *path, guint32 flags, guint64 fingerprint,
+                                    gint *next_priority)
+{
+        g_autoptr(GMappedFile) file = NULL;
+        g_autoptr(GPtrArray) devices = NULL;
+        g_autoptr(GPtrArray) ret = NULL;
+        const LdmDeviceSnapshotHeader *header = NULL;
+        const LdmDeviceSnapshotRecord *records = NULL;
+        const gchar *pool = NULL;
+        gsize length = 0;
+        guint64 expected = 0;
+
+        g_return_val_if_fail(path != NULL, NULL);
+        g_return_val_if_fail(next_priority != NULL, NULL);
+
+        file = g_mapped_file_new(path, FALSE, NULL);
+        if (!file) {
+                return NULL;
+        }
+
+        length = g_mapped_file_get_length(file);
+        if (length < sizeof(LdmDeviceSnapshotHeader)) {
+                return NULL;
+        }
+        header = (const LdmDeviceSnapshotHeader *)g_mapped_file_get_contents(file);
+
+        if (memcmp(header->magic, LDM_DEVICE_SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 ||
+            header->version != LDM_DEVICE_SNAPSHOT_VERSION ||
+            header->byte_order != LDM_DEVICE_SNAPSHOT_BYTE_ORDER) {
+                return NULL;
+        }
+
+        /* Devices changed since, or enumerated differently */
+        if (header->fingerprint != fingerprint || header->flags != flags) {
+                return NULL;
+        }
+
+        expected = sizeof(LdmDeviceSnapshotHeader) +
+                   (guint64)header->n_records * sizeof(LdmDeviceSnapshotRecord) +
+                   header->pool_size;
+        if (expected != length || header->pool_size < 1) {
+                return NULL;
+        }
+
+        records = (const LdmDeviceSnapshotRecord *)(header + 1);
+        pool = (const gchar *)(records + header->n_records);
+        if (pool[header->pool_size - 1] != '\0') {
+                return NULL;
+        }
+
+        /* Every device by record, borrowed from ret or their parent */
+        devices = g_ptr_array_sized_new(header->n_records);
+        ret = g_ptr_array_new_with_free_func(g_object_unref);
+
+        for (guint32 i = 0; i < header->n_records; i++) {
+                const LdmDeviceSnapshotRecord *record = &records[i];
+                LdmDevice *parent = NULL;
+                LdmDevice *device = NULL;
+                gchar *properties = NULL;
+
+                if (!ldm_device_snapshot_validate_record(header, record, i) ||
+                    !ldm_device_snapshot_read_properties(header, record, pool, &properties)) {
+                        return NULL;
+                }
+
+                parent = record->parent >= 0 ? devices->pdata[record->parent] : NULL;
+                device = g_object_new(ldm_device_snapshot_get_gtype(record->type),
+                                      "parent",
+                                      parent,
+                                      "priority",
+                                      record->priority,
+                                      NULL);
+
+                device->os.sysfs_path = g_strdup(pool + record->sysfs_path);
+                device->os.modalias = ldm_device_snapshot_dup_string(pool, record->modalias);
+                if (device->os.modalias) {
+                        g_ptr_array_add(device->tree.modaliases, device->os.modalias);
+                }
+                device->os.properties = properties;
+                device->os.n_properties = record->n_properties;
+                device->os.devtype = record->devtype;
+                device->os.attributes = record->attributes;
+                device->id.name = ldm_device_snapshot_dup_string(pool, record->name);
+                device->id.vendor = ldm_device_snapshot_dup_string(pool, record->vendor);
+                device->id.product_id = record->product_id;
+                device->id.vendor_id = record->vendor_id;
+
+                if (record->type == LDM_DEVICE_SNAPSHOT_TYPE_PCI) {
+                        g_autofree gchar *sysname = g_path_get_basename(device->os.sysfs_path);
+
+                        ldm_pci_device_init_address(device, sysname);
+                }
+
+                if (parent) {
+                        ldm_device_add_child(parent, device);
+                } else {
+                        g_ptr_array_add(ret, g_object_ref_sink(device));
+                }
+                g_ptr_array_add(devices, device);
+        }
+
+        *next_priority = header->next_priority;
+        return g_steal_pointer(&ret);
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
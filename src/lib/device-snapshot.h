@@ -0,0 +1,48 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Linux Driver Management Developers, Solus Project
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+#include "ldm-private.h"
+
+G_BEGIN_DECLS
+
+/*
+ * Device snapshots
+ *
+ * Private helpers to store the device tree enumerated by an LdmManager in a
+ * compact binary file, and to rebuild the tree from that file without
+ * consulting udev. Each snapshot records a fingerprint of the system's
+ * devices when it was taken, and is rejected once that changes.
+ */
+guint64 ldm_device_snapshot_fingerprint(gboolean gpu_only);
+
+gboolean ldm_device_snapshot_write(GPtrArray *devices, gint next_priority, guint32 flags,
+                                   guint64 fingerprint, const gchar *path, GError **error);
+GPtrArray *ldm_device_snapshot_read(const gchar *path, guint32 flags, guint64 fingerprint,
+                                    gint *next_priority);
+
+G_END_DECLS
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
@@ -11,6 +11,8 @@
 
 #define _GNU_SOURCE
 
+#include <string.h>
+
 #include "device.h"
 #include "ldm-enums.h"
 #include "ldm-private.h"
@@ -79,8 +81,21 @@ static void ldm_device_dispose(GObject *obj)
 {
         LdmDevice *self = LDM_DEVICE(obj);
 
+        g_clear_pointer(&self->tree.modaliases, g_ptr_array_unref);
+        if (self->tree.kids) {
+                GHashTableIter iter = { 0 };
+                __ldm_unused__ void *key = NULL;
+                LdmDevice *kid = NULL;
+
+                /* Any child outliving us mustn't reach back */
+                g_hash_table_iter_init(&iter, self->tree.kids);
+                while (g_hash_table_iter_next(&iter, (void **)&key, (void **)&kid)) {
+                        kid->tree.parent = NULL;
+                }
+        }
         g_clear_pointer(&self->tree.kids, g_hash_table_unref);
-        g_clear_pointer(&self->os.hwdb_info, g_hash_table_unref);
+        g_clear_pointer(&self->os.properties, g_free);
+        self->os.n_properties = 0;
         g_clear_pointer(&self->os.sysfs_path, g_free);
         g_clear_pointer(&self->os.modalias, g_free);
         g_clear_pointer(&self->id.name, g_free);
@@ -293,11 +308,11 @@ static void ldm_device_get_property(GObject *object, guint id, GValue *value, GP
  */
 static void ldm_device_init(LdmDevice *self)
 {
-        /* Just set up the table for our properties */
-        self->os.hwdb_info = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
-
         /* We have sysfs ID to child mapping and own the child */
         self->tree.kids = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_object_unref);
+
+        /* Borrowed from ourselves and our descendants */
+        self->tree.modaliases = g_ptr_array_new();
 }
 
 /**
@@ -397,6 +412,102 @@ gint ldm_device_get_vendor_id(LdmDevice *self)
         return self->id.vendor_id;
 }
 
+static gint ldm_device_sort_property(gconstpointer a, gconstpointer b)
+{
+        udev_list *entryA = *(udev_list **)a;
+        udev_list *entryB = *(udev_list **)b;
+
+        return strcmp(udev_list_entry_get_name(entryA), udev_list_entry_get_name(entryB));
+}
+
+/**
+ * ldm_device_set_properties:
+ *
+ * Copy the udev properties into a single allocation, sorted by name so
+ * that #ldm_device_get_udev_property can bisect them. The blob starts with
+ * the offset of each name, followed by each "NAME\0VALUE\0" pair in the
+ * same order.
+ */
+static void ldm_device_set_properties(LdmDevice *self, udev_list *properties)
+{
+        g_autoptr(GPtrArray) entries = NULL;
+        udev_list *entry = NULL;
+        guint32 *offsets = NULL;
+        gsize length = 0;
+
+        entries = g_ptr_array_new();
+        udev_list_entry_foreach(entry, properties)
+        {
+                const char *value = udev_list_entry_get_value(entry);
+
+                length += strlen(udev_list_entry_get_name(entry)) + 1;
+                length += (value ? strlen(value) : 0) + 1;
+                g_ptr_array_add(entries, entry);
+        }
+        g_ptr_array_sort(entries, ldm_device_sort_property);
+
+        length += entries->len * sizeof(guint32);
+        self->os.properties = g_malloc(length);
+        self->os.n_properties = entries->len;
+
+        offsets = (guint32 *)(gpointer)self->os.properties;
+        length = entries->len * sizeof(guint32);
+        for (guint i = 0; i < entries->len; i++) {
+                const char *name = udev_list_entry_get_name(entries->pdata[i]);
+                const char *value = udev_list_entry_get_value(entries->pdata[i]);
+                gsize name_length = strlen(name) + 1;
+                gsize value_length = 0;
+
+                value = value ? value : "";
+                value_length = strlen(value) + 1;
+
+                offsets[i] = (guint32)length;
+                memcpy(self->os.properties + length, name, name_length);
+                length += name_length;
+                memcpy(self->os.properties + length, value, value_length);
+                length += value_length;
+        }
+}
+
+/**
+ * ldm_device_get_udev_property:
+ * @name: Name of the udev property, i.e. "ID_MODEL_FROM_DATABASE"
+ *
+ * Look up one of the properties that udev held for this device when it was
+ * found, including any hwdb information.
+ *
+ * Returns: (transfer none) (nullable): The value of the property, if set
+ *
+ * Since: 1.0.3
+ */
+const gchar *ldm_device_get_udev_property(LdmDevice *self, const gchar *name)
+{
+        const guint32 *offsets = NULL;
+        guint low = 0, high = 0;
+
+        g_return_val_if_fail(self != NULL, NULL);
+        g_return_val_if_fail(name != NULL, NULL);
+
+        offsets = (const guint32 *)(gconstpointer)self->os.properties;
+        high = self->os.n_properties;
+
+        while (low < high) {
+                guint mid = low + (high - low) / 2;
+                const gchar *key = self->os.properties + offsets[mid];
+                int cmp = strcmp(name, key);
+
+                if (cmp == 0) {
+                        return key + strlen(key) + 1;
+                } else if (cmp < 0) {
+                        high = mid;
+                } else {
+                        low = mid + 1;
+                }
+        }
+
+        return NULL;
+}
+
 /**
  * ldm_device_new_from_udev:
  * @parent: (nullable): Parent device, if any.
@@ -410,9 +521,8 @@ gint ldm_device_get_vendor_id(LdmDevice *self)
 LdmDevice *ldm_device_new_from_udev(LdmDevice *parent, udev_device *device, udev_list *properties,
                                     gint priority)
 {
-        udev_list *entry = NULL;
         LdmDevice *self = NULL;
-        gchar *lookup = NULL;
+        const gchar *lookup = NULL;
         const char *subsystem = NULL;
         GType special_type = 0;
         const char *sysattr = NULL;
@@ -442,6 +552,7 @@ LdmDevice *ldm_device_new_from_udev(LdmDevice *parent, udev_device *device, udev
         sysattr = udev_device_get_sysattr_value(device, "modalias");
         if (sysattr) {
                 self->os.modalias = g_strdup(sysattr);
+                g_ptr_array_add(self->tree.modaliases, self->os.modalias);
         }
 
         /* Shouldn't happen, but is definitely possible.. */
@@ -449,22 +560,13 @@ LdmDevice *ldm_device_new_from_udev(LdmDevice *parent, udev_device *device, udev
                 goto post_hwdb;
         }
 
-        /* Duplicate the hardware data into a private table */
-        udev_list_entry_foreach(entry, properties)
-        {
-                const char *prop_id = NULL;
-                const char *value = NULL;
-
-                prop_id = udev_list_entry_get_name(entry);
-                value = udev_list_entry_get_value(entry);
-
-                g_hash_table_insert(self->os.hwdb_info, g_strdup(prop_id), g_strdup(value));
-        }
+        /* Keep the hardware data for later lookups */
+        ldm_device_set_properties(self, properties);
 
         /* Set vendor from hwdb information */
-        lookup = g_hash_table_lookup(self->os.hwdb_info, "ID_VENDOR_FROM_DATABASE");
+        lookup = ldm_device_get_udev_property(self, "ID_VENDOR_FROM_DATABASE");
         if (!lookup) {
-                lookup = g_hash_table_lookup(self->os.hwdb_info, "ID_VENDOR");
+                lookup = ldm_device_get_udev_property(self, "ID_VENDOR");
         }
         if (lookup) {
                 self->id.vendor = g_strdup(lookup);
@@ -472,9 +574,9 @@ LdmDevice *ldm_device_new_from_udev(LdmDevice *parent, udev_device *device, udev
         }
 
         /* Set name from hwdb information. TODO: Add fallback name! */
-        lookup = g_hash_table_lookup(self->os.hwdb_info, "ID_MODEL_FROM_DATABASE");
+        lookup = ldm_device_get_udev_property(self, "ID_MODEL_FROM_DATABASE");
         if (!lookup) {
-                lookup = g_hash_table_lookup(self->os.hwdb_info, "ID_MODEL");
+                lookup = ldm_device_get_udev_property(self, "ID_MODEL");
         }
         if (lookup) {
                 self->id.name = g_strdup(lookup);
@@ -631,6 +733,50 @@ GList *ldm_device_get_children(LdmDevice *self)
         return g_hash_table_get_values(self->tree.kids);
 }
 
+/**
+ * ldm_device_update_modaliases:
+ *
+ * Rebuild the flattened modaliases of this device and then of each of its
+ * ancestors, as they borrow those of their descendants. Children are visited
+ * in the same order as #ldm_device_get_children returns them.
+ */
+static void ldm_device_update_modaliases(LdmDevice *self)
+{
+        for (LdmDevice *device = self; device; device = device->tree.parent) {
+                g_autoptr(GList) kids = NULL;
+
+                g_ptr_array_set_size(device->tree.modaliases, 0);
+                if (device->os.modalias) {
+                        g_ptr_array_add(device->tree.modaliases, device->os.modalias);
+                }
+
+                kids = ldm_device_get_children(device);
+                for (GList *elem = kids; elem; elem = elem->next) {
+                        GPtrArray *modaliases = LDM_DEVICE(elem->data)->tree.modaliases;
+
+                        for (guint i = 0; i < modaliases->len; i++) {
+                                g_ptr_array_add(device->tree.modaliases, modaliases->pdata[i]);
+                        }
+                }
+        }
+}
+
+/**
+ * ldm_device_get_modaliases:
+ *
+ * Return the modalias of this device followed by those of all of its
+ * descendants, depth first, allowing them to be matched without walking
+ * the tree.
+ *
+ * Returns: (transfer none): The modaliases of the device and its children
+ */
+GPtrArray *ldm_device_get_modaliases(LdmDevice *self)
+{
+        g_return_val_if_fail(self != NULL, NULL);
+
+        return self->tree.modaliases;
+}
+
 /**
  * ldm_device_add_child:
  * @child: (transfer full): Child to add to this device
@@ -646,9 +792,8 @@ void ldm_device_add_child(LdmDevice *self, LdmDevice *child)
         g_return_if_fail(self != NULL);
 
         id = ldm_device_get_path(child);
-        if (!g_hash_table_replace(self->tree.kids, g_strdup(id), g_object_ref_sink(child))) {
-                return;
-        }
+        g_hash_table_replace(self->tree.kids, g_strdup(id), g_object_ref_sink(child));
+        ldm_device_update_modaliases(self);
 }
 
 /**
@@ -680,6 +825,7 @@ void ldm_device_remove_child_by_path(LdmDevice *self, const gchar *path)
         if (!g_hash_table_remove(self->tree.kids, path)) {
                 return;
         }
+        ldm_device_update_modaliases(self);
 }
 
 /**
@@ -110,6 +110,7 @@ const gchar *ldm_device_get_vendor(LdmDevice *device);
 gint ldm_device_get_vendor_id(LdmDevice *device);
 LdmDeviceType ldm_device_get_device_type(LdmDevice *device);
 LdmDeviceAttribute ldm_device_get_attributes(LdmDevice *device);
+const gchar *ldm_device_get_udev_property(LdmDevice *device, const gchar *name);
 
 gboolean ldm_device_has_type(LdmDevice *device, LdmDeviceType mask);
 gboolean ldm_device_has_attribute(LdmDevice *device, LdmDeviceAttribute mask);
@@ -13,8 +13,11 @@
 
 #include <glib-object.h>
 #include <libudev.h>
+#include <time.h>
 
 #include "device.h"
+#include "modalias-vendors.h"
+#include "plugins/modalias-plugin.h"
 #include "util.h"
 
 /*
@@ -45,13 +48,15 @@ struct _LdmDevice {
         struct {
                 LdmDevice *parent;
                 GHashTable *kids;
+                GPtrArray *modaliases; /* Own then descendant modaliases, depth first */
         } tree;
 
         /* OS Data */
         struct {
                 gchar *sysfs_path;
                 gchar *modalias;
-                GHashTable *hwdb_info;
+                gchar *properties; /* Sorted udev properties, see ldm_device_set_properties */
+                guint n_properties;
                 guint devtype;
                 guint attributes;
         } os;
@@ -65,6 +70,17 @@ struct _LdmDevice {
         } id;
 };
 
+/*
+ * Monotonic time in nanoseconds, for profiling
+ */
+static inline guint64 ldm_get_monotonic_nanoseconds(void)
+{
+        struct timespec ts = { 0 };
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (guint64)ts.tv_sec * G_GUINT64_CONSTANT(1000000000) + (guint64)ts.tv_nsec;
+}
+
 /*
  * Common autofree helpers.
  */
@@ -78,14 +94,59 @@ LdmDevice *ldm_device_new_from_udev(LdmDevice *parent, udev_device *device, udev
 
 void ldm_dmi_device_init_private(LdmDevice *self, udev_device *device);
 void ldm_pci_device_init_private(LdmDevice *self, udev_device *device);
+void ldm_pci_device_init_address(LdmDevice *self, const gchar *sysname);
 void ldm_usb_device_init_private(LdmDevice *self, udev_device *device);
 void ldm_bluetooth_device_init_private(LdmDevice *self, udev_device *device);
 
+/*
+ * Bus formats understood by the modalias key parser
+ */
+typedef enum {
+        LDM_MODALIAS_BUS_NONE = 0,
+        LDM_MODALIAS_BUS_PCI,
+        LDM_MODALIAS_BUS_USB,
+        LDM_MODALIAS_BUS_HID,
+} LdmModaliasBus;
+
+/*
+ * The identifying fields of a modalias, used to index rules on the exact
+ * vendor and device/product pair that they match.
+ */
+typedef struct LdmModaliasKey {
+        guint32 vendor;
+        guint32 product;
+        guint8 bus;
+} LdmModaliasKey;
+
+/*
+ * Called for every alias within a modalias file, or every rule of a plugin
+ */
+typedef void (*LdmModaliasFileFunc)(const gchar *match, const gchar *driver, const gchar *package,
+                                    gpointer userdata);
+
+/* Private modalias API */
+gchar *ldm_modalias_read_file(const gchar *filename);
+void ldm_modalias_parse_data(gchar *data, LdmModaliasFileFunc func, gpointer userdata);
+gboolean ldm_modalias_parse_file(const gchar *filename, LdmModaliasFileFunc func,
+                                 gpointer userdata);
+gboolean ldm_modalias_parse_device_key(const gchar *modalias, LdmModaliasKey *key);
+gboolean ldm_modalias_parse_match_key(const gchar *match, LdmModaliasKey *key);
+gboolean ldm_modalias_parse_match_vendor(const gchar *match, LdmModaliasKey *key);
+guint ldm_modalias_key_hash(gconstpointer v);
+gboolean ldm_modalias_key_equal(gconstpointer a, gconstpointer b);
+
+/* Private modalias plugin API */
+void ldm_modalias_plugin_foreach_rule(LdmModaliasPlugin *plugin, LdmModaliasFileFunc func,
+                                      gpointer userdata);
+guint ldm_modalias_plugin_get_serial(LdmModaliasPlugin *plugin);
+const LdmModaliasVendors *ldm_modalias_plugin_get_vendors(LdmModaliasPlugin *plugin);
+
 /* private child APIs */
 void ldm_device_add_child(LdmDevice *device, LdmDevice *child);
 void ldm_device_remove_child(LdmDevice *device, LdmDevice *child);
 void ldm_device_remove_child_by_path(LdmDevice *device, const gchar *path);
 LdmDevice *ldm_device_get_child_by_path(LdmDevice *device, const gchar *path);
+GPtrArray *ldm_device_get_modaliases(LdmDevice *device);
 
 /*
  * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
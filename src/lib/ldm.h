@@ -16,6 +16,7 @@
 #include <gpu-config.h>
 #include <ldm-enums.h>
 #include <manager.h>
+#include <match-stats.h>
 #include <modalias.h>
 #include <provider.h>
 
@@ -11,14 +11,212 @@
 
 #define _GNU_SOURCE
 
+#include <errno.h>
 #include <glob.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
 
 #include "config.h"
 #include "manager-private.h"
+#include "match-stats.h"
+#include "modalias-loader.h"
 #include "plugin.h"
 
 #include "plugins/modalias-plugin.h"
 
+/*
+ * LdmIndexedPlugin
+ *
+ * Tracks a LdmModaliasPlugin whose rules have been merged into the manager
+ * wide index, and acts as the owner of those rules within the index. The
+ * plugin itself is owned by the plugins table.
+ */
+typedef struct LdmIndexedPlugin {
+        LdmManager *manager;
+        LdmModaliasPlugin *plugin;
+        guint serial;   /* Modification serial at the time of indexing */
+        gint priority;  /* Priority at the time of indexing */
+} LdmIndexedPlugin;
+
+/*
+ * LdmPluginStats
+ *
+ * Matching statistics for a single plugin, in total and for each of its
+ * rules that has been tested.
+ */
+typedef struct LdmPluginStats {
+        LdmMatchStats totals;
+        GHashTable *rules; /* Match -> LdmMatchStats */
+} LdmPluginStats;
+
+/**
+ * ldm_manager_get_plugin_id:
+ *
+ * Return the name the plugin is known by in the plugins table
+ */
+static const gchar *ldm_manager_get_plugin_id(LdmPlugin *plugin)
+{
+        const gchar *ret = NULL;
+
+        /* If a plugin id is unspecified, make it the class name */
+        ret = ldm_plugin_get_name(plugin);
+        if (!ret) {
+                ret = G_OBJECT_CLASS_NAME(LDM_PLUGIN_GET_CLASS(plugin));
+        }
+
+        return ret;
+}
+
+/**
+ * ldm_manager_index_rule:
+ *
+ * Add a single rule of the plugin to the index, returning its package
+ */
+static void ldm_manager_index_rule(const gchar *match, __ldm_unused__ const gchar *driver,
+                                   const gchar *package, gpointer userdata)
+{
+        LdmIndexedPlugin *indexed = userdata;
+
+        ldm_modalias_index_add_full(indexed->manager->modalias_index,
+                                    match,
+                                    (gpointer)package,
+                                    indexed,
+                                    indexed->priority);
+}
+
+/**
+ * ldm_manager_index_plugin:
+ *
+ * Merge all of the rules of the plugin into the manager wide index, tagged
+ * with the plugin's current priority.
+ */
+static void ldm_manager_index_plugin(LdmIndexedPlugin *indexed)
+{
+        indexed->serial = ldm_modalias_plugin_get_serial(indexed->plugin);
+        indexed->priority = ldm_plugin_get_priority(LDM_PLUGIN(indexed->plugin));
+
+        ldm_modalias_plugin_foreach_rule(indexed->plugin, ldm_manager_index_rule, indexed);
+}
+
+/**
+ * ldm_manager_refresh_index:
+ *
+ * Reindex any plugin whose rules or priority changed since it was added
+ *
+ * Returns: TRUE if any plugin was reindexed
+ */
+static gboolean ldm_manager_refresh_index(LdmManager *self)
+{
+        GHashTableIter iter = { 0 };
+        LdmIndexedPlugin *indexed = NULL;
+        gboolean ret = FALSE;
+
+        g_hash_table_iter_init(&iter, self->indexed_plugins);
+        while (g_hash_table_iter_next(&iter, NULL, (void **)&indexed)) {
+                if (indexed->serial == ldm_modalias_plugin_get_serial(indexed->plugin) &&
+                    indexed->priority == ldm_plugin_get_priority(LDM_PLUGIN(indexed->plugin))) {
+                        continue;
+                }
+                ldm_modalias_index_remove_owner(self->modalias_index, indexed);
+                ldm_manager_index_plugin(indexed);
+                ret = TRUE;
+        }
+
+        return ret;
+}
+
+/**
+ * ldm_manager_refresh_priorities:
+ *
+ * Note the current priority of every plugin, as any plugin may have its
+ * priority changed after it was added, reordering its providers.
+ *
+ * Returns: TRUE if the priority of any plugin changed
+ */
+static gboolean ldm_manager_refresh_priorities(LdmManager *self)
+{
+        GHashTableIter iter = { 0 };
+        const gchar *plugin_id = NULL;
+        LdmPlugin *plugin = NULL;
+        gboolean ret = FALSE;
+
+        g_hash_table_iter_init(&iter, self->plugins);
+        while (g_hash_table_iter_next(&iter, (void **)&plugin_id, (void **)&plugin)) {
+                gint priority = ldm_plugin_get_priority(plugin);
+                gpointer known = NULL;
+
+                if (g_hash_table_lookup_extended(self->plugin_priorities,
+                                                 plugin_id,
+                                                 NULL,
+                                                 &known) &&
+                    GPOINTER_TO_INT(known) == priority) {
+                        continue;
+                }
+                g_hash_table_insert(self->plugin_priorities,
+                                    g_strdup(plugin_id),
+                                    GINT_TO_POINTER(priority));
+                ret = TRUE;
+        }
+
+        return ret;
+}
+
+/**
+ * ldm_manager_validate_cache:
+ *
+ * Throw away all cached providers if the plugins or devices have changed
+ * since they were resolved.
+ */
+static void ldm_manager_validate_cache(LdmManager *self)
+{
+        if (ldm_manager_refresh_index(self)) {
+                ++self->generation;
+        }
+        if (ldm_manager_refresh_priorities(self)) {
+                ++self->generation;
+        }
+
+        if (self->provider_cache_generation == self->generation) {
+                return;
+        }
+
+        g_hash_table_remove_all(self->provider_cache);
+        self->provider_cache_generation = self->generation;
+}
+
+/**
+ * ldm_manager_unindex_plugin:
+ *
+ * Remove the rules of the plugin from the merged index, if indexed
+ */
+static void ldm_manager_unindex_plugin(LdmManager *self, const gchar *plugin_id)
+{
+        LdmIndexedPlugin *indexed = NULL;
+
+        indexed = g_hash_table_lookup(self->indexed_plugins, plugin_id);
+        if (!indexed) {
+                return;
+        }
+
+        ldm_modalias_index_remove_owner(self->modalias_index, indexed);
+        g_hash_table_remove(self->indexed_plugins, plugin_id);
+}
+
+/**
+ * ldm_manager_remove_plugin:
+ *
+ * Remove the plugin with the given id, if known
+ */
+static void ldm_manager_remove_plugin(LdmManager *self, const gchar *plugin_id)
+{
+        ldm_manager_unindex_plugin(self, plugin_id);
+        g_hash_table_remove(self->plugin_priorities, plugin_id);
+        if (g_hash_table_remove(self->plugins, plugin_id)) {
+                ++self->generation;
+        }
+}
+
 /**
  * ldm_manager_add_plugin:
  * @plugin: (transfer full): New plugin to add.
@@ -27,19 +225,18 @@
  * provide automatic hardware detection capabilities to the #LdmManager
  * and provide the internal API required for #ldm_manager_get_providers to
  * work.
+ *
+ * Any providers previously resolved by the manager are invalidated.
  */
 void ldm_manager_add_plugin(LdmManager *self, LdmPlugin *plugin)
 {
         const gchar *plugin_id = NULL;
+        LdmIndexedPlugin *indexed = NULL;
 
         g_return_if_fail(self != NULL);
         g_return_if_fail(plugin != NULL);
 
-        /* If a plugin id is unspecified, make it the class name */
-        plugin_id = ldm_plugin_get_name(plugin);
-        if (!plugin_id) {
-                plugin_id = G_OBJECT_CLASS_NAME(LDM_PLUGIN_GET_CLASS(plugin));
-        }
+        plugin_id = ldm_manager_get_plugin_id(plugin);
 
         if (g_hash_table_contains(self->plugins, plugin_id)) {
                 g_debug("replacing plugin '%s'", plugin_id);
@@ -47,8 +244,40 @@ void ldm_manager_add_plugin(LdmManager *self, LdmPlugin *plugin)
                 g_debug("new plugin: %s", plugin_id);
         }
 
+        /* Drop the rules of any plugin we replace before it goes away */
+        ldm_manager_unindex_plugin(self, plugin_id);
+
         /* Handle pythonic apis with non floating references */
         g_hash_table_replace(self->plugins, g_strdup(plugin_id), g_object_ref_sink(plugin));
+        g_hash_table_replace(self->plugin_priorities,
+                             g_strdup(plugin_id),
+                             GINT_TO_POINTER(ldm_plugin_get_priority(plugin)));
+        ++self->generation;
+
+        if (!LDM_IS_MODALIAS_PLUGIN(plugin)) {
+                return;
+        }
+
+        indexed = g_new0(LdmIndexedPlugin, 1);
+        indexed->manager = self;
+        indexed->plugin = LDM_MODALIAS_PLUGIN(plugin);
+        g_hash_table_replace(self->indexed_plugins, g_strdup(plugin_id), indexed);
+        ldm_manager_index_plugin(indexed);
+}
+
+/**
+ * ldm_manager_add_modalias_plugin:
+ *
+ * Add the modalias plugin with the next priority, such that plugins added
+ * later take precedence.
+ */
+static void ldm_manager_add_modalias_plugin(LdmManager *self, LdmPlugin *plugin)
+{
+        /* Enforce priority based on insert order */
+        ldm_plugin_set_priority(plugin, self->modalias_plugin_priority);
+        ++self->modalias_plugin_priority;
+
+        ldm_manager_add_plugin(self, plugin);
 }
 
 /**
@@ -76,16 +305,243 @@ gboolean ldm_manager_add_modalias_plugin_for_path(LdmManager *self, const gchar
         }
 
         plugin = ldm_modalias_plugin_new_from_filename(path);
+        ldm_manager_add_modalias_plugin(self, plugin);
 
-        /* Enforce priority based on insert order */
-        ldm_plugin_set_priority(plugin, self->modalias_plugin_priority);
-        ++self->modalias_plugin_priority;
+        return TRUE;
+}
 
-        ldm_manager_add_plugin(self, plugin);
+/**
+ * ldm_manager_track_modalias_file:
+ * @path: Path of the file within a watched directory
+ *
+ * Remember which plugin was loaded from the file, so that it can later be
+ * replaced or removed
+ */
+static void ldm_manager_track_modalias_file(LdmManager *self, const gchar *path,
+                                            LdmPlugin *plugin)
+{
+        g_hash_table_replace(self->plugin_watch.files,
+                             g_strdup(path),
+                             g_strdup(ldm_manager_get_plugin_id(plugin)));
+}
+
+/**
+ * ldm_manager_reload_modalias_file:
+ * @path: Path of a `.modaliases` file within a watched directory
+ *
+ * Parse the file again and swap the rules of its plugin for the new ones
+ * in a single step, keeping the plugin's priority. If the file is gone,
+ * or can no longer be read, its plugin is removed instead.
+ *
+ * Returns: TRUE if the plugins changed
+ */
+static gboolean ldm_manager_reload_modalias_file(LdmManager *self, const gchar *path)
+{
+        const gchar *plugin_id = NULL;
+        LdmPlugin *old_plugin = NULL;
+        LdmPlugin *plugin = NULL;
+
+        plugin_id = g_hash_table_lookup(self->plugin_watch.files, path);
+        if (plugin_id) {
+                old_plugin = g_hash_table_lookup(self->plugins, plugin_id);
+        }
+
+        plugin = ldm_modalias_plugin_new_from_filename(path);
+        if (!plugin) {
+                if (!plugin_id) {
+                        return FALSE;
+                }
+                g_debug("removing plugin '%s' for %s", plugin_id, path);
+                ldm_manager_remove_plugin(self, plugin_id);
+                g_hash_table_remove(self->plugin_watch.files, path);
+                return TRUE;
+        }
+
+        g_debug("reloading %s", path);
+
+        if (old_plugin) {
+                ldm_plugin_set_priority(plugin, ldm_plugin_get_priority(old_plugin));
+                ldm_manager_add_plugin(self, plugin);
+        } else {
+                ldm_manager_add_modalias_plugin(self, plugin);
+        }
+        ldm_manager_track_modalias_file(self, path, plugin);
 
         return TRUE;
 }
 
+/**
+ * ldm_manager_queue_watch_event:
+ * @changed: Set of modalias file paths that need reloading
+ *
+ * Note the modalias file affected by a single inotify event
+ */
+static void ldm_manager_queue_watch_event(LdmManager *self, const struct inotify_event *event,
+                                          GHashTable *changed)
+{
+        const gchar *directory = NULL;
+        gchar *path = NULL;
+
+        if ((event->mask & IN_IGNORED) == IN_IGNORED) {
+                g_hash_table_remove(self->plugin_watch.directories, GINT_TO_POINTER(event->wd));
+                return;
+        }
+
+        if (event->len < 1) {
+                return;
+        }
+
+        directory = g_hash_table_lookup(self->plugin_watch.directories, GINT_TO_POINTER(event->wd));
+        if (!directory) {
+                return;
+        }
+
+        /* A compiled database stands in for its text form */
+        if (g_str_has_suffix(event->name, ".modaliases")) {
+                path = g_build_filename(directory, event->name, NULL);
+        } else if (g_str_has_suffix(event->name, ".modaliases.bin")) {
+                path = g_build_filename(directory, event->name, NULL);
+                path[strlen(path) - strlen(".bin")] = '\0';
+        } else {
+                return;
+        }
+
+        g_hash_table_add(changed, path);
+}
+
+/**
+ * ldm_manager_plugin_watch_ready:
+ *
+ * We have I/O on the inotify channel, reload each modalias file that changed
+ * once, however many events it had.
+ */
+static gboolean ldm_manager_plugin_watch_ready(GIOChannel *source, GIOCondition condition,
+                                               gpointer v)
+{
+        LdmManager *self = v;
+        g_autoptr(GHashTable) changed = NULL;
+        g_autoptr(GList) paths = NULL;
+        gboolean reloaded = FALSE;
+        gchar buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+        int fd = 0;
+
+        /* Only want G_IO_IN here. */
+        if ((condition & G_IO_IN) != G_IO_IN) {
+                return TRUE;
+        }
+
+        changed = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+        fd = g_io_channel_unix_get_fd(source);
+
+        for (;;) {
+                ssize_t len = read(fd, buffer, sizeof(buffer));
+
+                if (len < 0 && errno == EINTR) {
+                        continue;
+                }
+                if (len < 0 && errno != EAGAIN) {
+                        /* Remove polling now, something is badly wrong. */
+                        g_warning("Failed to read modalias watch: %s", strerror(errno));
+                        self->plugin_watch.source = 0;
+                        return FALSE;
+                }
+                if (len <= 0) {
+                        break;
+                }
+
+                for (ssize_t i = 0; i < len;) {
+                        const struct inotify_event *event = (struct inotify_event *)&buffer[i];
+
+                        ldm_manager_queue_watch_event(self, event, changed);
+                        i += (ssize_t)(sizeof(struct inotify_event) + event->len);
+                }
+        }
+
+        /* New files are added in sorted order, just as they would be by glob */
+        paths = g_list_sort(g_hash_table_get_keys(changed), (GCompareFunc)strcmp);
+        for (GList *elem = paths; elem; elem = elem->next) {
+                if (ldm_manager_reload_modalias_file(self, elem->data)) {
+                        reloaded = TRUE;
+                }
+        }
+
+        if (reloaded) {
+                ldm_manager_emit_plugins_changed(self);
+        }
+
+        /* Keep the source around */
+        return TRUE;
+}
+
+/**
+ * ldm_manager_watch_directory:
+ * @directory: Directory containing `*.modaliases` files
+ *
+ * Start watching the directory for changes to its modalias files, creating
+ * the inotify instance on first use.
+ *
+ * Returns: TRUE if the directory is being watched
+ */
+static gboolean ldm_manager_watch_directory(LdmManager *self, const gchar *directory)
+{
+        int fd = 0;
+        int wd = 0;
+
+        if (!self->plugin_watch.channel) {
+                fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+                if (fd < 0) {
+                        g_warning("modalias watching is unavailable: %s", strerror(errno));
+                        return FALSE;
+                }
+
+                self->plugin_watch.channel = g_io_channel_unix_new(fd);
+                g_io_channel_set_close_on_unref(self->plugin_watch.channel, TRUE);
+                /* Don't do anything fancy with the channel */
+                g_io_channel_set_encoding(self->plugin_watch.channel, NULL, NULL);
+                self->plugin_watch.source = g_io_add_watch(self->plugin_watch.channel,
+                                                           G_IO_IN,
+                                                           ldm_manager_plugin_watch_ready,
+                                                           self);
+
+                self->plugin_watch.directories =
+                    g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+                self->plugin_watch.files =
+                    g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+        }
+
+        fd = g_io_channel_unix_get_fd(self->plugin_watch.channel);
+        wd = inotify_add_watch(fd,
+                               directory,
+                               IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE);
+        if (wd < 0) {
+                g_warning("Failed to watch %s: %s", directory, strerror(errno));
+                return FALSE;
+        }
+
+        g_hash_table_replace(self->plugin_watch.directories,
+                             GINT_TO_POINTER(wd),
+                             g_strdup(directory));
+        return TRUE;
+}
+
+/**
+ * ldm_manager_clear_plugin_watch:
+ *
+ * Stop watching all modalias directories
+ */
+void ldm_manager_clear_plugin_watch(LdmManager *self)
+{
+        if (self->plugin_watch.source > 0) {
+                g_source_remove(self->plugin_watch.source);
+                self->plugin_watch.source = 0;
+        }
+
+        /* Closes the inotify instance */
+        g_clear_pointer(&self->plugin_watch.channel, g_io_channel_unref);
+        g_clear_pointer(&self->plugin_watch.directories, g_hash_table_unref);
+        g_clear_pointer(&self->plugin_watch.files, g_hash_table_unref);
+}
+
 /**
  * ldm_manager_add_modalias_plugins_for_directory:
  * @directory: Path containing `*.modaliases` files
@@ -96,13 +552,30 @@ gboolean ldm_manager_add_modalias_plugin_for_path(LdmManager *self, const gchar
  * This function is used to add well known modalias paths to the plugin and
  * construct plugins used for hardware detection.
  *
+ * The files are parsed concurrently, but are always added in sorted order
+ * so that the resulting priorities are deterministic.
+ *
+ * When the manager was constructed with %LDM_MANAGER_FLAGS_WATCH_MODALIASES,
+ * the directory is then watched for changes from the main loop. Only the
+ * files that change are parsed again, with the rules of their plugin being
+ * swapped for the new ones in one step, and #LdmManager::plugins-changed
+ * is emitted.
+ *
  * Returns: TRUE if a new plugin was added
  */
 gboolean ldm_manager_add_modalias_plugins_for_directory(LdmManager *self, const gchar *directory)
 {
         g_autofree gchar *glob_path = NULL;
+        g_autoptr(GPtrArray) plugins = NULL;
         glob_t glo = { 0 };
         gboolean ret = FALSE;
+        gboolean watch = FALSE;
+
+        /* Watch before globbing so that no change can be missed */
+        if ((self->flags & LDM_MANAGER_FLAGS_WATCH_MODALIASES) ==
+            LDM_MANAGER_FLAGS_WATCH_MODALIASES) {
+                watch = ldm_manager_watch_directory(self, directory);
+        }
 
         glob_path = g_strdup_printf("%s%s*.modaliases", directory, G_DIR_SEPARATOR_S);
 
@@ -114,9 +587,22 @@ gboolean ldm_manager_add_modalias_plugins_for_directory(LdmManager *self, const
                 goto cleanup;
         }
 
-        for (size_t i = 0; i < glo.gl_pathc; i++) {
-                if (ldm_manager_add_modalias_plugin_for_path(self, glo.gl_pathv[i])) {
-                        ret = TRUE;
+        plugins = ldm_modalias_loader_load(glo.gl_pathv, (guint)glo.gl_pathc, 0);
+
+        for (guint i = 0; i < plugins->len; i++) {
+                LdmPlugin *plugin = plugins->pdata[i];
+
+                if (!plugin) {
+                        continue;
+                }
+                ldm_manager_add_modalias_plugin(self, plugin);
+                ret = TRUE;
+
+                if (watch) {
+                        g_autofree gchar *name = g_path_get_basename(glo.gl_pathv[i]);
+                        g_autofree gchar *path = g_build_filename(directory, name, NULL);
+
+                        ldm_manager_track_modalias_file(self, path, plugin);
                 }
         }
 
@@ -140,6 +626,103 @@ gboolean ldm_manager_add_system_modalias_plugins(LdmManager *self)
         return ldm_manager_add_modalias_plugins_for_directory(self, MODALIAS_DIR);
 }
 
+static void ldm_manager_free_plugin_stats(gpointer v)
+{
+        LdmPluginStats *stats = v;
+
+        g_hash_table_unref(stats->rules);
+        g_free(stats->totals.plugin);
+        g_free(stats);
+}
+
+static void ldm_manager_add_match_stats(LdmMatchStats *stats, gboolean matched,
+                                        guint64 nanoseconds)
+{
+        ++stats->n_candidates;
+        if (matched) {
+                ++stats->n_matches;
+        }
+        stats->nanoseconds += nanoseconds;
+}
+
+/**
+ * ldm_manager_record_match:
+ * @match: (nullable): The rule tested, if known
+ * @matched: Whether the device matched
+ * @nanoseconds: Time taken by the test
+ *
+ * Account for a single test of the plugin against a device
+ */
+static void ldm_manager_record_match(LdmManager *self, LdmPlugin *plugin, const gchar *match,
+                                     gboolean matched, guint64 nanoseconds)
+{
+        const gchar *plugin_id = NULL;
+        LdmPluginStats *stats = NULL;
+        LdmMatchStats *rule = NULL;
+
+        plugin_id = ldm_manager_get_plugin_id(plugin);
+        stats = g_hash_table_lookup(self->match_stats, plugin_id);
+        if (!stats) {
+                stats = g_new0(LdmPluginStats, 1);
+                stats->totals.plugin = g_strdup(plugin_id);
+                stats->rules = g_hash_table_new_full(g_str_hash,
+                                                     g_str_equal,
+                                                     NULL,
+                                                     (GDestroyNotify)ldm_match_stats_free);
+                g_hash_table_insert(self->match_stats, stats->totals.plugin, stats);
+        }
+
+        ldm_manager_add_match_stats(&stats->totals, matched, nanoseconds);
+        if (!match) {
+                return;
+        }
+
+        rule = g_hash_table_lookup(stats->rules, match);
+        if (!rule) {
+                rule = g_new0(LdmMatchStats, 1);
+                rule->plugin = g_strdup(plugin_id);
+                rule->match = g_strdup(match);
+                g_hash_table_insert(stats->rules, rule->match, rule);
+        }
+
+        ldm_manager_add_match_stats(rule, matched, nanoseconds);
+}
+
+/**
+ * ldm_manager_record_rule:
+ *
+ * Account for a rule of an indexed plugin tested by the merged index
+ */
+static void ldm_manager_record_rule(const gchar *match, gpointer owner, gboolean matched,
+                                    guint64 nanoseconds, __ldm_unused__ gpointer userdata)
+{
+        LdmIndexedPlugin *indexed = owner;
+
+        ldm_manager_record_match(indexed->manager,
+                                 LDM_PLUGIN(indexed->plugin),
+                                 match,
+                                 matched,
+                                 nanoseconds);
+}
+
+/**
+ * ldm_manager_init_match_stats:
+ *
+ * Begin gathering statistics for every plugin test made by the manager
+ */
+void ldm_manager_init_match_stats(LdmManager *self)
+{
+        g_return_if_fail(self != NULL);
+
+        if (self->match_stats) {
+                return;
+        }
+
+        self->match_stats =
+            g_hash_table_new_full(g_str_hash, g_str_equal, NULL, ldm_manager_free_plugin_stats);
+        ldm_modalias_index_set_eval_func(self->modalias_index, ldm_manager_record_rule, NULL);
+}
+
 static gint ldm_manager_sort_plugin_by_priority(gconstpointer a, gconstpointer b)
 {
         gint prioA = ldm_plugin_get_priority(ldm_provider_get_plugin(*(LdmProvider **)a));
@@ -149,31 +732,169 @@ static gint ldm_manager_sort_plugin_by_priority(gconstpointer a, gconstpointer b
 }
 
 /**
- * ldm_manager_get_providers:
+ * ldm_manager_get_index_providers:
+ * @device: Device to construct providers for
+ * @vendors: Vendors of every indexed rule
+ * @ret: Array to store new providers in
+ * @owners: Plugins that already provided for @device
+ * @results: Scratch array for lookup results, the matching packages
+ * @matched: Scratch array for lookup owners
  *
- * Walk the plugins and find all known providers for the given device,
- * if they can support it. The returned #GPtrArray will free all elements
- * when it itself is freed.
+ * Look the device and all of its children up in the manager wide index,
+ * creating one provider per matching plugin just as the plugin itself
+ * would, i.e. from the first match in a depth first walk. Each lookup
+ * returns matches in order of plugin priority. Modaliases of a vendor that
+ * no plugin has rules for aren't looked up at all.
  *
- * Returns: (element-type Ldm.Provider) (transfer container): a list of all possible providers
+ * Returns: The number of device modaliases that produced new providers
  */
-GPtrArray *ldm_manager_get_providers(LdmManager *self, LdmDevice *device)
+static guint ldm_manager_get_index_providers(LdmManager *self, LdmDevice *device,
+                                             const LdmModaliasVendors *vendors, GPtrArray *ret,
+                                             GPtrArray *owners, GPtrArray *results,
+                                             GPtrArray *matched)
+{
+        GPtrArray *modaliases = NULL;
+        guint n_sources = 0;
+
+        modaliases = ldm_device_get_modaliases(device);
+        for (guint i = 0; i < modaliases->len; i++) {
+                guint n_providers = ret->len;
+
+                if (!ldm_modalias_vendors_accepts(vendors, modaliases->pdata[i])) {
+                        continue;
+                }
+
+                g_ptr_array_set_size(results, 0);
+                g_ptr_array_set_size(matched, 0);
+                if (!ldm_modalias_index_lookup_full(self->modalias_index,
+                                                    modaliases->pdata[i],
+                                                    results,
+                                                    matched)) {
+                        continue;
+                }
+
+                for (guint j = 0; j < matched->len; j++) {
+                        LdmIndexedPlugin *indexed = matched->pdata[j];
+                        LdmProvider *provider = NULL;
+
+                        if (g_ptr_array_find(owners, indexed, NULL)) {
+                                continue;
+                        }
+                        g_ptr_array_add(owners, indexed);
+
+                        provider = ldm_provider_new(LDM_PLUGIN(indexed->plugin),
+                                                    device,
+                                                    results->pdata[j]);
+                        g_ptr_array_add(ret, g_object_ref_sink(provider));
+                }
+
+                if (ret->len > n_providers) {
+                        ++n_sources;
+                }
+        }
+
+        return n_sources;
+}
+
+/*
+ * Shared state for resolving the providers of one or more devices, so that
+ * a batch of devices only refreshes the index and walks the plugin table
+ * once.
+ */
+typedef struct LdmProviderQuery {
+        GPtrArray *plugins;         /* Plugins that aren't part of the merged index */
+        LdmModaliasVendors vendors; /* Vendors of every plugin that is */
+        GPtrArray *owners;          /* Scratch space for ldm_manager_get_index_providers */
+        GPtrArray *results;
+        GPtrArray *matched;
+} LdmProviderQuery;
+
+/**
+ * ldm_manager_query_init:
+ *
+ * Find every plugin that must be asked about each device individually,
+ * and the vendors of every one that's part of the merged index. The merged
+ * index must already be up to date.
+ */
+static void ldm_manager_query_init(LdmManager *self, LdmProviderQuery *query)
 {
-        GPtrArray *ret = NULL;
-        __ldm_unused__ gpointer k = NULL;
-        LdmPlugin *plugin = NULL;
         GHashTableIter iter = { 0 };
+        LdmPlugin *plugin = NULL;
 
-        g_return_val_if_fail(self != NULL, NULL);
+        query->plugins = g_ptr_array_new();
+        query->owners = g_ptr_array_new();
+        query->results = g_ptr_array_new();
+        query->matched = g_ptr_array_new();
+        ldm_modalias_vendors_init(&query->vendors);
+
+        g_hash_table_iter_init(&iter, self->plugins);
+        while (g_hash_table_iter_next(&iter, NULL, (void **)&plugin)) {
+                /* Already handled by the index */
+                if (LDM_IS_MODALIAS_PLUGIN(plugin)) {
+                        const LdmModaliasVendors *vendors =
+                            ldm_modalias_plugin_get_vendors(LDM_MODALIAS_PLUGIN(plugin));
+
+                        ldm_modalias_vendors_merge(&query->vendors, vendors);
+                } else {
+                        g_ptr_array_add(query->plugins, plugin);
+                }
+        }
+}
+
+static void ldm_manager_query_clear(LdmProviderQuery *query)
+{
+        g_clear_pointer(&query->plugins, g_ptr_array_unref);
+        g_clear_pointer(&query->owners, g_ptr_array_unref);
+        g_clear_pointer(&query->results, g_ptr_array_unref);
+        g_clear_pointer(&query->matched, g_ptr_array_unref);
+}
+
+/**
+ * ldm_manager_query_providers:
+ * @device: Device to find providers for
+ *
+ * Find all providers for the device: #LdmModaliasPlugin rules are found
+ * in a single lookup of the merged index, while any other plugins are asked
+ * individually.
+ *
+ * Returns: (transfer container): The providers, in order of priority
+ */
+static GPtrArray *ldm_manager_query_providers(LdmManager *self, LdmProviderQuery *query,
+                                              LdmDevice *device)
+{
+        GPtrArray *ret = NULL;
+        gboolean needs_sort = FALSE;
+        guint n_sources = 0;
 
         ret = g_ptr_array_new_with_free_func(g_object_unref);
 
-        g_hash_table_iter_init(&iter, self->plugins);
-        while (g_hash_table_iter_next(&iter, &k, (void **)&plugin)) {
+        /* Matches from more than one modalias need merging by priority */
+        g_ptr_array_set_size(query->owners, 0);
+        n_sources = ldm_manager_get_index_providers(self,
+                                                    device,
+                                                    &query->vendors,
+                                                    ret,
+                                                    query->owners,
+                                                    query->results,
+                                                    query->matched);
+        needs_sort = n_sources > 1;
+
+        for (guint i = 0; i < query->plugins->len; i++) {
                 LdmProvider *provider = NULL;
 
                 /* See if this plugin supports the device */
-                provider = ldm_plugin_get_provider(plugin, device);
+                if (self->match_stats) {
+                        guint64 start = ldm_get_monotonic_nanoseconds();
+
+                        provider = ldm_plugin_get_provider(query->plugins->pdata[i], device);
+                        ldm_manager_record_match(self,
+                                                 query->plugins->pdata[i],
+                                                 NULL,
+                                                 provider != NULL,
+                                                 ldm_get_monotonic_nanoseconds() - start);
+                } else {
+                        provider = ldm_plugin_get_provider(query->plugins->pdata[i], device);
+                }
                 if (!provider) {
                         continue;
                 }
@@ -183,9 +904,247 @@ GPtrArray *ldm_manager_get_providers(LdmManager *self, LdmDevice *device)
                 } else {
                         g_ptr_array_add(ret, provider);
                 }
+                needs_sort = TRUE;
         }
 
-        g_ptr_array_sort(ret, ldm_manager_sort_plugin_by_priority);
+        if (needs_sort) {
+                g_ptr_array_sort(ret, ldm_manager_sort_plugin_by_priority);
+        }
+
+        return ret;
+}
+
+/**
+ * ldm_manager_cached_providers:
+ * @query: Query state, prepared on first use
+ *
+ * Return the providers of the device from the cache, resolving them first
+ * if they're not yet known. The cache must have been validated.
+ *
+ * Returns: (transfer none): The cached providers
+ */
+static GPtrArray *ldm_manager_cached_providers(LdmManager *self, LdmProviderQuery *query,
+                                               LdmDevice *device)
+{
+        GPtrArray *ret = NULL;
+
+        ret = g_hash_table_lookup(self->provider_cache, device);
+        if (ret) {
+                return ret;
+        }
+
+        if (!query->plugins) {
+                ldm_manager_query_init(self, query);
+        }
+
+        ret = ldm_manager_query_providers(self, query, device);
+        g_hash_table_insert(self->provider_cache, g_object_ref(device), ret);
+
+        return ret;
+}
+
+/**
+ * ldm_manager_copy_providers:
+ *
+ * Copy cached providers out for the caller, who is free to modify the copy
+ */
+static GPtrArray *ldm_manager_copy_providers(GPtrArray *providers)
+{
+        GPtrArray *ret = NULL;
+
+        ret = g_ptr_array_new_full(providers->len, g_object_unref);
+        for (guint i = 0; i < providers->len; i++) {
+                g_ptr_array_add(ret, g_object_ref(providers->pdata[i]));
+        }
+
+        return ret;
+}
+
+/**
+ * ldm_manager_get_providers:
+ *
+ * Find all known providers for the given device, if they can support it.
+ * All #LdmModaliasPlugin rules are found in a single lookup of the merged
+ * index, while any other plugins are asked individually. The returned
+ * #GPtrArray will free all elements when it itself is freed.
+ *
+ * Providers are remembered for each device until a plugin is added or has
+ * its priority changed, the rules of a modalias plugin change, or a device
+ * is added or removed, so repeated queries only cost a copy of the array.
+ * Plugins other than #LdmModaliasPlugin are therefore only asked about a
+ * device once in that time: a plugin whose answers depend on anything else
+ * must be added to the manager again for them to be asked afresh.
+ *
+ * When looking up many devices at once, #ldm_manager_get_all_providers is
+ * more efficient.
+ *
+ * Returns: (element-type Ldm.Provider) (transfer container): a list of all possible providers
+ */
+GPtrArray *ldm_manager_get_providers(LdmManager *self, LdmDevice *device)
+{
+        LdmProviderQuery query = { 0 };
+        GPtrArray *providers = NULL;
+
+        g_return_val_if_fail(self != NULL, NULL);
+        g_return_val_if_fail(device != NULL, NULL);
+
+        ldm_manager_validate_cache(self);
+        providers = ldm_manager_cached_providers(self, &query, device);
+        ldm_manager_query_clear(&query);
+
+        return ldm_manager_copy_providers(providers);
+}
+
+/**
+ * ldm_manager_get_all_providers:
+ * @class_mask: Bitwise mask of LdmDeviceType
+ *
+ * Find the providers of every device known to this manager that matches
+ * the given class mask, as #ldm_manager_get_providers would for each of
+ * them. The plugins are only prepared once for the whole set of devices,
+ * making this far cheaper than querying each device in turn.
+ *
+ * Only devices with at least one provider appear in the returned table,
+ * with their providers in order of priority.
+ *
+ * Returns: (element-type Ldm.Device GLib.PtrArray(Ldm.Provider)) (transfer container):
+ * a table mapping each #LdmDevice to a #GPtrArray of its #LdmProvider instances
+ *
+ * Since: 1.0.3
+ */
+GHashTable *ldm_manager_get_all_providers(LdmManager *self, LdmDeviceType class_mask)
+{
+        LdmProviderQuery query = { 0 };
+        GHashTable *ret = NULL;
+
+        g_return_val_if_fail(self != NULL, NULL);
+
+        ret = g_hash_table_new_full(g_direct_hash,
+                                    g_direct_equal,
+                                    g_object_unref,
+                                    (GDestroyNotify)g_ptr_array_unref);
+
+        ldm_manager_validate_cache(self);
+
+        for (guint i = 0; i < self->devices->len; i++) {
+                LdmDevice *device = self->devices->pdata[i];
+                GPtrArray *providers = NULL;
+
+                if (!ldm_device_has_type(device, class_mask)) {
+                        continue;
+                }
+
+                providers = ldm_manager_cached_providers(self, &query, device);
+                if (providers->len < 1) {
+                        continue;
+                }
+
+                g_hash_table_insert(ret,
+                                    g_object_ref(device),
+                                    ldm_manager_copy_providers(providers));
+        }
+
+        ldm_manager_query_clear(&query);
+
+        return ret;
+}
+
+/**
+ * ldm_manager_sort_match_stats:
+ *
+ * Order statistics by descending time, then by the number of tests
+ */
+static gint ldm_manager_sort_match_stats(gconstpointer a, gconstpointer b)
+{
+        const LdmMatchStats *statsA = *(LdmMatchStats **)a;
+        const LdmMatchStats *statsB = *(LdmMatchStats **)b;
+
+        if (statsA->nanoseconds != statsB->nanoseconds) {
+                return statsA->nanoseconds > statsB->nanoseconds ? -1 : 1;
+        }
+        if (statsA->n_candidates != statsB->n_candidates) {
+                return statsA->n_candidates > statsB->n_candidates ? -1 : 1;
+        }
+
+        return g_strcmp0(statsA->match ? statsA->match : statsA->plugin,
+                         statsB->match ? statsB->match : statsB->plugin);
+}
+
+static gint ldm_manager_sort_plugin_stats(gconstpointer a, gconstpointer b)
+{
+        const LdmPluginStats *statsA = *(LdmPluginStats **)a;
+        const LdmPluginStats *statsB = *(LdmPluginStats **)b;
+        const LdmMatchStats *totalsA = &statsA->totals;
+        const LdmMatchStats *totalsB = &statsB->totals;
+
+        return ldm_manager_sort_match_stats(&totalsA, &totalsB);
+}
+
+/**
+ * ldm_manager_sorted_values:
+ *
+ * Returns: (transfer container): The values of the table, sorted
+ */
+static GPtrArray *ldm_manager_sorted_values(GHashTable *table, GCompareFunc compare)
+{
+        GHashTableIter iter = { 0 };
+        GPtrArray *ret = NULL;
+        gpointer v = NULL;
+
+        ret = g_ptr_array_sized_new(g_hash_table_size(table));
+        g_hash_table_iter_init(&iter, table);
+        while (g_hash_table_iter_next(&iter, NULL, &v)) {
+                g_ptr_array_add(ret, v);
+        }
+        g_ptr_array_sort(ret, compare);
+
+        return ret;
+}
+
+/**
+ * ldm_manager_get_match_stats:
+ *
+ * Report how often the rules of each plugin have been tested against
+ * devices, how often they matched, and the time spent doing so. This is
+ * only gathered by managers constructed with %LDM_MANAGER_FLAGS_MATCH_STATS,
+ * and only covers lookups actually made, not those answered by previously
+ * resolved providers.
+ *
+ * The totals of each plugin are followed by the statistics of each of its
+ * tested rules, with plugins and rules in order of descending time. Rules
+ * are only known for #LdmModaliasPlugin instances, as other plugins are
+ * asked about a device as a whole.
+ *
+ * Returns: (element-type Ldm.MatchStats) (transfer container): The statistics
+ * gathered so far, which are empty if not enabled
+ *
+ * Since: 1.0.3
+ */
+GPtrArray *ldm_manager_get_match_stats(LdmManager *self)
+{
+        g_autoptr(GPtrArray) plugins = NULL;
+        GPtrArray *ret = NULL;
+
+        g_return_val_if_fail(self != NULL, NULL);
+
+        ret = g_ptr_array_new_with_free_func((GDestroyNotify)ldm_match_stats_free);
+        if (!self->match_stats) {
+                return ret;
+        }
+
+        plugins = ldm_manager_sorted_values(self->match_stats, ldm_manager_sort_plugin_stats);
+
+        for (guint i = 0; i < plugins->len; i++) {
+                LdmPluginStats *stats = plugins->pdata[i];
+                g_autoptr(GPtrArray) rules = NULL;
+
+                g_ptr_array_add(ret, ldm_match_stats_copy(&stats->totals));
+
+                rules = ldm_manager_sorted_values(stats->rules, ldm_manager_sort_match_stats);
+                for (guint j = 0; j < rules->len; j++) {
+                        g_ptr_array_add(ret, ldm_match_stats_copy(rules->pdata[j]));
+                }
+        }
 
         return ret;
 }
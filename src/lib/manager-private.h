@@ -16,6 +16,7 @@
 #include "device.h"
 #include "ldm-private.h"
 #include "manager.h"
+#include "modalias-index.h"
 
 struct _LdmManagerClass {
         GObjectClass parent_class;
@@ -23,13 +24,31 @@ struct _LdmManagerClass {
         /* Signals */
         void (*device_added)(LdmManager *self, LdmDevice *device);
         void (*device_removed)(LdmManager *self, LdmDevice *device);
+        void (*plugins_changed)(LdmManager *self);
+        void (*devices_changed)(LdmManager *self, GPtrArray *added, GPtrArray *removed);
 };
 
 struct _LdmManager {
         GObject parent;
         GPtrArray *devices;
+        GHashTable *device_paths; /* sysfs path -> position within devices */
         GHashTable *plugins;
 
+        /* Merged rules of every LdmModaliasPlugin, owned by their indexed plugin */
+        LdmModaliasIndex *modalias_index;
+        GHashTable *indexed_plugins; /* Plugin id -> LdmIndexedPlugin */
+
+        /* Plugin id -> priority of every plugin when providers were last resolved */
+        GHashTable *plugin_priorities;
+
+        /* Resolved providers, valid while generation is unchanged */
+        GHashTable *provider_cache; /* LdmDevice -> GPtrArray of LdmProvider */
+        guint provider_cache_generation;
+        guint generation; /* Bumped by any change to the plugins or devices */
+
+        /* Plugin id -> LdmPluginStats, NULL unless LDM_MANAGER_FLAGS_MATCH_STATS */
+        GHashTable *match_stats;
+
         gint modalias_plugin_priority;
         gint device_priority;
 
@@ -37,14 +56,34 @@ struct _LdmManager {
         udev_connection *udev;
 
         LdmManagerFlags flags;
+        gchar *snapshot_path; /* With LDM_MANAGER_FLAGS_SNAPSHOT */
 
         struct {
                 udev_monitor *udev;  /* Connection to udev.. */
                 GIOChannel *channel; /* Main channel for poll main loop */
                 guint source;        /* GIO source */
+
+                /* Changes not yet announced through devices-changed */
+                GPtrArray *added;   /* LdmDevice */
+                GPtrArray *removed; /* LdmDevice */
+                guint debounce;     /* Milliseconds to wait for further events */
+                guint flush_source; /* Timeout announcing the changes */
         } monitor;
+
+        /* Watched modalias directories, with LDM_MANAGER_FLAGS_WATCH_MODALIASES */
+        struct {
+                GIOChannel *channel;     /* inotify instance, NULL until needed */
+                guint source;            /* GIO source */
+                GHashTable *directories; /* Watch descriptor -> directory */
+                GHashTable *files;       /* Path -> id of the plugin loaded from it */
+        } plugin_watch;
 };
 
+/* Private manager API */
+void ldm_manager_init_match_stats(LdmManager *manager);
+void ldm_manager_clear_plugin_watch(LdmManager *manager);
+void ldm_manager_emit_plugins_changed(LdmManager *manager);
+
 /*
  * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
  *
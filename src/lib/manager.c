@@ -11,8 +11,15 @@
 
 #define _GNU_SOURCE
 
+#include <dirent.h>
+#include <fcntl.h>
 #include <libudev.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
+#include "config.h"
+#include "device-snapshot.h"
 #include "device.h"
 #include "ldm-enums.h"
 #include "ldm-private.h"
@@ -27,23 +34,37 @@ static void ldm_manager_constructed(GObject *obj);
 
 static void ldm_manager_init_udev_monitor(LdmManager *self);
 static void ldm_manager_init_udev_static(LdmManager *self);
+static void ldm_manager_init_udev_snapshot(LdmManager *self);
 static void ldm_manager_push_sysfs(LdmManager *self, const char *sysfs_path);
-static void ldm_manager_push_device(LdmManager *self, udev_device *device, gboolean emit_signal);
+static void ldm_manager_push_device(LdmManager *self, udev_device *device, LdmDevice *prepared,
+                                    gboolean emit_signal);
 static void ldm_manager_remove_device(LdmManager *self, udev_device *device);
 static gboolean ldm_manager_io_ready(GIOChannel *source, GIOCondition condition, gpointer v);
 static LdmDevice *ldm_manager_get_device_parent(LdmManager *self, const char *subsystem,
                                                 udev_device *device);
 static void ldm_manager_emit_usb(LdmManager *self, udev_device *device);
+static void ldm_manager_emit_device_added(LdmManager *self, LdmDevice *device);
+static void ldm_manager_emit_device_removed(LdmManager *self, LdmDevice *device);
+static gboolean ldm_manager_flush_changes(gpointer v);
+
+/* Default for LdmManager:debounce, enough to gather a dock's devices */
+#define LDM_MANAGER_DEBOUNCE_DEFAULT 50
 
 /* Property IDs */
-enum { PROP_FLAGS = 1, N_PROPS };
+enum { PROP_FLAGS = 1, PROP_SNAPSHOT_PATH, PROP_DEBOUNCE, N_PROPS };
 
 static GParamSpec *obj_properties[N_PROPS] = {
         NULL,
 };
 
 /* Signal IDs */
-enum { SIGNAL_DEVICE_ADDED = 0, SIGNAL_DEVICE_REMOVED, N_SIGNALS };
+enum {
+        SIGNAL_DEVICE_ADDED = 0,
+        SIGNAL_DEVICE_REMOVED,
+        SIGNAL_PLUGINS_CHANGED,
+        SIGNAL_DEVICES_CHANGED,
+        N_SIGNALS
+};
 
 static guint obj_signals[N_SIGNALS] = { 0 };
 
@@ -95,6 +116,12 @@ static void ldm_manager_dispose(GObject *obj)
                 g_source_remove(self->monitor.source);
                 self->monitor.source = 0;
         }
+        if (self->monitor.flush_source > 0) {
+                g_source_remove(self->monitor.flush_source);
+                self->monitor.flush_source = 0;
+        }
+        g_clear_pointer(&self->monitor.added, g_ptr_array_unref);
+        g_clear_pointer(&self->monitor.removed, g_ptr_array_unref);
 
         /* Clear out the monitor */
         if (self->monitor.udev) {
@@ -105,11 +132,25 @@ static void ldm_manager_dispose(GObject *obj)
 
         g_clear_pointer(&self->udev, udev_unref);
 
-        /* clean ourselves up */
+        /* clean ourselves up, paths are borrowed from the devices */
+        g_clear_pointer(&self->device_paths, g_hash_table_unref);
         g_clear_pointer(&self->devices, g_ptr_array_unref);
 
+        /* No further plugin reloads */
+        ldm_manager_clear_plugin_watch(self);
+
+        /* Cached providers hold references to devices and plugins */
+        g_clear_pointer(&self->provider_cache, g_hash_table_unref);
+        g_clear_pointer(&self->match_stats, g_hash_table_unref);
+
+        /* Index borrows from the plugins, so must go first */
+        g_clear_pointer(&self->modalias_index, ldm_modalias_index_free);
+        g_clear_pointer(&self->indexed_plugins, g_hash_table_unref);
+        g_clear_pointer(&self->plugin_priorities, g_hash_table_unref);
         g_clear_pointer(&self->plugins, g_hash_table_unref);
 
+        g_clear_pointer(&self->snapshot_path, g_free);
+
         G_OBJECT_CLASS(ldm_manager_parent_class)->dispose(obj);
 }
 
@@ -170,6 +211,58 @@ static void ldm_manager_class_init(LdmManagerClass *klazz)
                          1,
                          LDM_TYPE_DEVICE);
 
+        /**
+         * LdmManager::plugins-changed
+         * @manager: The manager owning the plugins
+         *
+         * Connect to this signal to be notified when modalias plugins have
+         * been added, reloaded or removed because their files changed, which
+         * requires %LDM_MANAGER_FLAGS_WATCH_MODALIASES. Providers found
+         * before this signal may no longer be accurate.
+         *
+         * Since: 1.0.3
+         */
+        obj_signals[SIGNAL_PLUGINS_CHANGED] =
+            g_signal_new("plugins-changed",
+                         LDM_TYPE_MANAGER,
+                         G_SIGNAL_RUN_FIRST | G_SIGNAL_ACTION,
+                         G_STRUCT_OFFSET(LdmManagerClass, plugins_changed),
+                         NULL,
+                         NULL,
+                         NULL,
+                         G_TYPE_NONE,
+                         0);
+
+        /**
+         * LdmManager::devices-changed
+         * @manager: The manager owning the devices
+         * @added: (element-type Ldm.Device): Devices that became available
+         * @removed: (element-type Ldm.Device): Devices that were removed
+         *
+         * Connect to this signal to be notified once about a burst of hotplug
+         * events, such as a dock being connected, rather than about each
+         * device. It is emitted #LdmManager:debounce milliseconds after the
+         * first change that hasn't been announced yet, with every change made
+         * in that time, and a device that came and went within it is in
+         * neither set. The #LdmManager::device-added
+         * and #LdmManager::device-removed signals are still emitted for each
+         * device as it happens.
+         *
+         * Since: 1.0.3
+         */
+        obj_signals[SIGNAL_DEVICES_CHANGED] =
+            g_signal_new("devices-changed",
+                         LDM_TYPE_MANAGER,
+                         G_SIGNAL_RUN_FIRST | G_SIGNAL_ACTION,
+                         G_STRUCT_OFFSET(LdmManagerClass, devices_changed),
+                         NULL,
+                         NULL,
+                         NULL,
+                         G_TYPE_NONE,
+                         2,
+                         G_TYPE_PTR_ARRAY,
+                         G_TYPE_PTR_ARRAY);
+
         /**
          * LdmManager:flags
          *
@@ -182,6 +275,42 @@ static void ldm_manager_class_init(LdmManagerClass *klazz)
                                                         LDM_TYPE_MANAGER_FLAGS,
                                                         LDM_MANAGER_FLAGS_NONE,
                                                         G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE);
+
+        /**
+         * LdmManager:snapshot-path
+         *
+         * Where the snapshot of devices is kept with
+         * %LDM_MANAGER_FLAGS_SNAPSHOT, if not the default location within
+         * the runtime directory
+         *
+         * Since: 1.0.3
+         */
+        obj_properties[PROP_SNAPSHOT_PATH] =
+            g_param_spec_string("snapshot-path",
+                                "Snapshot path",
+                                "Path to the snapshot of devices",
+                                NULL,
+                                G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE);
+
+        /**
+         * LdmManager:debounce
+         *
+         * How many milliseconds to gather further hotplug events for after
+         * a change, before emitting #LdmManager::devices-changed, or 0 to emit
+         * it as soon as the pending events have been handled. Later events
+         * don't extend the wait, so this is also the longest a change may go
+         * unannounced.
+         *
+         * Since: 1.0.3
+         */
+        obj_properties[PROP_DEBOUNCE] =
+            g_param_spec_uint("debounce",
+                              "Debounce",
+                              "Milliseconds to gather hotplug events for",
+                              0,
+                              G_MAXUINT,
+                              LDM_MANAGER_DEBOUNCE_DEFAULT,
+                              G_PARAM_CONSTRUCT | G_PARAM_READWRITE);
         g_object_class_install_properties(obj_class, N_PROPS, obj_properties);
 }
 
@@ -194,6 +323,13 @@ static void ldm_manager_set_property(GObject *object, guint id, const GValue *va
         case PROP_FLAGS:
                 self->flags = g_value_get_flags(value);
                 break;
+        case PROP_SNAPSHOT_PATH:
+                g_free(self->snapshot_path);
+                self->snapshot_path = g_value_dup_string(value);
+                break;
+        case PROP_DEBOUNCE:
+                self->monitor.debounce = g_value_get_uint(value);
+                break;
         default:
                 G_OBJECT_WARN_INVALID_PROPERTY_ID(object, id, spec);
                 break;
@@ -208,6 +344,12 @@ static void ldm_manager_get_property(GObject *object, guint id, GValue *value, G
         case PROP_FLAGS:
                 g_value_set_flags(value, self->flags);
                 break;
+        case PROP_SNAPSHOT_PATH:
+                g_value_set_string(value, self->snapshot_path);
+                break;
+        case PROP_DEBOUNCE:
+                g_value_set_uint(value, self->monitor.debounce);
+                break;
         default:
                 G_OBJECT_WARN_INVALID_PROPERTY_ID(object, id, spec);
                 break;
@@ -227,6 +369,10 @@ static void ldm_manager_constructed(GObject *obj)
         self->udev = udev_new();
         g_assert(self->udev != NULL);
 
+        if ((self->flags & LDM_MANAGER_FLAGS_MATCH_STATS) == LDM_MANAGER_FLAGS_MATCH_STATS) {
+                ldm_manager_init_match_stats(self);
+        }
+
         /* End user may have disabled monitoring */
         if ((self->flags & LDM_MANAGER_FLAGS_NO_MONITOR) == LDM_MANAGER_FLAGS_NO_MONITOR) {
                 goto static_init;
@@ -236,7 +382,11 @@ static void ldm_manager_constructed(GObject *obj)
         ldm_manager_init_udev_monitor(self);
 
 static_init:
-        ldm_manager_init_udev_static(self);
+        if ((self->flags & LDM_MANAGER_FLAGS_SNAPSHOT) == LDM_MANAGER_FLAGS_SNAPSHOT) {
+                ldm_manager_init_udev_snapshot(self);
+        } else {
+                ldm_manager_init_udev_static(self);
+        }
 
         G_OBJECT_CLASS(ldm_manager_parent_class)->constructed(obj);
 }
@@ -251,8 +401,306 @@ static void ldm_manager_init(LdmManager *self)
         /* Devices is an array of devices in the order that we encounter them */
         self->devices = g_ptr_array_new_full(30, g_object_unref);
 
+        /* Position of each device within devices, by sysfs path */
+        self->device_paths = g_hash_table_new(g_str_hash, g_str_equal);
+
         /* Plugin table is a mapping from plugin name to plugin */
         self->plugins = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_object_unref);
+
+        /* Modalias plugins are additionally merged into one index */
+        self->modalias_index = ldm_modalias_index_new();
+        self->indexed_plugins = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+        self->plugin_priorities = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+        /* Resolved providers for each device, until plugins or devices change */
+        self->provider_cache = g_hash_table_new_full(g_direct_hash,
+                                                     g_direct_equal,
+                                                     g_object_unref,
+                                                     (GDestroyNotify)g_ptr_array_unref);
+
+        /* Hotplug changes gathered for the next devices-changed */
+        self->monitor.added = g_ptr_array_new_with_free_func(g_object_unref);
+        self->monitor.removed = g_ptr_array_new_with_free_func(g_object_unref);
+}
+
+/*
+ * LdmEnumeratedDevice
+ *
+ * A device found by a worker with LDM_MANAGER_FLAGS_PARALLEL_ENUMERATE,
+ * constructed without a parent or priority until the merge.
+ */
+typedef struct LdmEnumeratedDevice {
+        udev_device *device;
+        LdmDevice *prepared;
+} LdmEnumeratedDevice;
+
+/*
+ * LdmEnumerateWorker
+ *
+ * Enumerates a single subsystem on a thread of its own, with its own udev
+ * context as libudev is not thread safe. The context must outlive the
+ * devices, which are only used by the manager once the worker is done.
+ */
+typedef struct LdmEnumerateWorker {
+        const char *subsystem;
+        udev_connection *udev;
+        GArray *devices; /* LdmEnumeratedDevice, in enumeration order */
+        GThread *thread;
+} LdmEnumerateWorker;
+
+/**
+ * ldm_manager_enumerate_worker:
+ *
+ * Find every device of the worker's subsystem and construct its LdmDevice,
+ * reading all of the sysfs attributes needed.
+ */
+static gpointer ldm_manager_enumerate_worker(gpointer v)
+{
+        LdmEnumerateWorker *worker = v;
+        autofree(udev_enum) *ue = NULL;
+        udev_list *list = NULL, *entry = NULL;
+
+        worker->udev = udev_new();
+        if (!worker->udev) {
+                g_warning("Failed to create udev context for %s", worker->subsystem);
+                return NULL;
+        }
+
+        ue = udev_enumerate_new(worker->udev);
+        if (!ue || udev_enumerate_add_match_subsystem(ue, worker->subsystem) != 0) {
+                g_warning("Failed to add subsystem match: %s", worker->subsystem);
+                return NULL;
+        }
+
+        /* Due to umockdev we won't check this return. */
+        udev_enumerate_scan_devices(ue);
+        list = udev_enumerate_get_list_entry(ue);
+
+        udev_list_entry_foreach(entry, list)
+        {
+                LdmEnumeratedDevice enumerated = { 0 };
+                udev_list *properties = NULL;
+                LdmDevice *device = NULL;
+
+                enumerated.device =
+                    udev_device_new_from_syspath(worker->udev, udev_list_entry_get_name(entry));
+                if (!enumerated.device) {
+                        continue;
+                }
+
+                properties = udev_device_get_properties_list_entry(enumerated.device);
+                device = ldm_device_new_from_udev(NULL, enumerated.device, properties, 0);
+                enumerated.prepared = g_object_ref_sink(device);
+                g_array_append_val(worker->devices, enumerated);
+        }
+
+        return NULL;
+}
+
+static void ldm_manager_clear_enumerated_device(gpointer v)
+{
+        LdmEnumeratedDevice *enumerated = v;
+
+        g_clear_pointer(&enumerated->device, udev_device_unref);
+        g_clear_object(&enumerated->prepared);
+}
+
+static gint ldm_manager_sort_enumerated_device(gconstpointer a, gconstpointer b)
+{
+        const LdmEnumeratedDevice *enumeratedA = *(const LdmEnumeratedDevice **)a;
+        const LdmEnumeratedDevice *enumeratedB = *(const LdmEnumeratedDevice **)b;
+
+        return strcmp(enumeratedA->prepared->os.sysfs_path, enumeratedB->prepared->os.sysfs_path);
+}
+
+/**
+ * ldm_manager_init_udev_parallel:
+ * @subsystems: Subsystems to enumerate, one worker each
+ *
+ * Enumerate and construct the devices of each subsystem concurrently, then
+ * merge them in order of their sysfs path. This is the same order udev
+ * gives when enumerating all of the subsystems at once, and parents always
+ * sort before their children, so the result is identical to that of a
+ * serial enumeration. Only the merge links devices to their parents.
+ */
+static void ldm_manager_init_udev_parallel(LdmManager *self, const char **subsystems,
+                                           guint n_subsystems)
+{
+        g_autofree LdmEnumerateWorker *workers = NULL;
+        g_autoptr(GPtrArray) merged = NULL;
+
+        workers = g_new0(LdmEnumerateWorker, n_subsystems);
+        for (guint i = 0; i < n_subsystems; i++) {
+                workers[i].subsystem = subsystems[i];
+                workers[i].devices = g_array_new(FALSE, FALSE, sizeof(LdmEnumeratedDevice));
+                g_array_set_clear_func(workers[i].devices, ldm_manager_clear_enumerated_device);
+        }
+
+        /* Nothing to gain from a thread with only one subsystem */
+        if (n_subsystems == 1) {
+                ldm_manager_enumerate_worker(&workers[0]);
+        } else {
+                for (guint i = 0; i < n_subsystems; i++) {
+                        workers[i].thread = g_thread_new("ldm-enumerate",
+                                                         ldm_manager_enumerate_worker,
+                                                         &workers[i]);
+                }
+                for (guint i = 0; i < n_subsystems; i++) {
+                        g_thread_join(workers[i].thread);
+                }
+        }
+
+        merged = g_ptr_array_new();
+        for (guint i = 0; i < n_subsystems; i++) {
+                GArray *devices = workers[i].devices;
+
+                for (guint j = 0; j < devices->len; j++) {
+                        g_ptr_array_add(merged, &g_array_index(devices, LdmEnumeratedDevice, j));
+                }
+        }
+        g_ptr_array_sort(merged, ldm_manager_sort_enumerated_device);
+
+        for (guint i = 0; i < merged->len; i++) {
+                LdmEnumeratedDevice *enumerated = merged->pdata[i];
+
+                ldm_manager_push_device(self, enumerated->device, enumerated->prepared, FALSE);
+        }
+
+        /* Devices first, then the contexts they were created from */
+        for (guint i = 0; i < n_subsystems; i++) {
+                g_array_unref(workers[i].devices);
+                g_clear_pointer(&workers[i].udev, udev_unref);
+        }
+}
+
+/* Display controllers, i.e. VGA, XGA and 3D, in the top byte of the PCI class */
+#define LDM_PCI_CLASS_BASE_DISPLAY 0x03
+#define LDM_PCI_CLASS_DISPLAY_MATCH "0x03*"
+
+/**
+ * ldm_manager_read_pci_class:
+ *
+ * Read the class of a PCI function, given the directory of all PCI devices
+ *
+ * Returns: TRUE if the class was read
+ */
+static gboolean ldm_manager_read_pci_class(int dir_fd, const char *sysname, guint32 *pci_class)
+{
+        g_autofree gchar *path = NULL;
+        char buf[32] = { 0 };
+        ssize_t n_read = 0;
+        int fd = -1;
+
+        path = g_strdup_printf("%s/class", sysname);
+        fd = openat(dir_fd, path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+                return FALSE;
+        }
+        n_read = read(fd, buf, sizeof(buf) - 1);
+        close(fd);
+        if (n_read <= 0) {
+                return FALSE;
+        }
+
+        *pci_class = (guint32)strtoul(buf, NULL, 0);
+        return TRUE;
+}
+
+static gint ldm_manager_sort_udev_device(gconstpointer a, gconstpointer b)
+{
+        udev_device *deviceA = *(udev_device **)a;
+        udev_device *deviceB = *(udev_device **)b;
+
+        return strcmp(udev_device_get_syspath(deviceA), udev_device_get_syspath(deviceB));
+}
+
+/**
+ * ldm_manager_init_gpu_sysfs:
+ *
+ * With LDM_MANAGER_FLAGS_GPU_QUICK, find the display controllers by reading
+ * the class of every PCI function straight from sysfs. Only those are
+ * looked up through udev, in the same order it would enumerate them, so no
+ * other device is ever constructed.
+ *
+ * Returns: FALSE if the PCI devices can't be read, and udev must be used
+ */
+static gboolean ldm_manager_init_gpu_sysfs(LdmManager *self)
+{
+        g_autoptr(GPtrArray) devices = NULL;
+        struct dirent *entry = NULL;
+        DIR *dir = NULL;
+        int dir_fd = -1;
+
+        dir_fd = open("/sys/bus/pci/devices", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dir_fd < 0) {
+                return FALSE;
+        }
+        dir = fdopendir(dir_fd);
+        if (!dir) {
+                close(dir_fd);
+                return FALSE;
+        }
+
+        devices = g_ptr_array_new_with_free_func((GDestroyNotify)udev_device_unref);
+
+        while ((entry = readdir(dir)) != NULL) {
+                udev_device *device = NULL;
+                guint32 pci_class = 0;
+
+                if (entry->d_name[0] == '.') {
+                        continue;
+                }
+
+                if (!ldm_manager_read_pci_class(dir_fd, entry->d_name, &pci_class) ||
+                    (pci_class >> 16) != LDM_PCI_CLASS_BASE_DISPLAY) {
+                        continue;
+                }
+
+                device = udev_device_new_from_subsystem_sysname(self->udev, "pci", entry->d_name);
+                if (device) {
+                        g_ptr_array_add(devices, device);
+                }
+        }
+        closedir(dir);
+
+        /* Directory order isn't that of udev, which sorts by path */
+        g_ptr_array_sort(devices, ldm_manager_sort_udev_device);
+
+        for (guint i = 0; i < devices->len; i++) {
+                ldm_manager_push_device(self, devices->pdata[i], NULL, FALSE);
+        }
+
+        return TRUE;
+}
+
+/**
+ * ldm_manager_init_gpu_udev:
+ *
+ * Enumerate the display controllers through udev, for when sysfs can't be
+ * read directly. The enumerator matches the class as it scans, so no other
+ * PCI device is ever constructed.
+ */
+static void ldm_manager_init_gpu_udev(LdmManager *self)
+{
+        autofree(udev_enum) *ue = NULL;
+        udev_list *list = NULL, *entry = NULL;
+
+        ue = udev_enumerate_new(self->udev);
+        g_assert(ue != NULL);
+
+        if (udev_enumerate_add_match_subsystem(ue, "pci") != 0 ||
+            udev_enumerate_add_match_sysattr(ue, "class", LDM_PCI_CLASS_DISPLAY_MATCH) != 0) {
+                g_warning("Failed to add display controller match");
+        }
+
+        /* Due to umockdev we won't check this return. */
+        udev_enumerate_scan_devices(ue);
+        list = udev_enumerate_get_list_entry(ue);
+
+        udev_list_entry_foreach(entry, list)
+        {
+                ldm_manager_push_sysfs(self, udev_list_entry_get_name(entry));
+        }
 }
 
 /**
@@ -269,28 +717,28 @@ static void ldm_manager_init_udev_static(LdmManager *self)
                 "dmi",       "usb",       "pci",
                 "ieee80211", "bluetooth", "hid", /*< As child of USB typically */
         };
-        /* For LDM_MANAGER_FLAGS_GPU_QUICK */
-        static const char *subsystems_minimal[] = {
-                "pci",
-        };
+
+        /* Only display controllers are wanted, never any other device */
+        if ((self->flags & LDM_MANAGER_FLAGS_GPU_QUICK) == LDM_MANAGER_FLAGS_GPU_QUICK) {
+                if (!ldm_manager_init_gpu_sysfs(self)) {
+                        ldm_manager_init_gpu_udev(self);
+                }
+                return;
+        }
+
+        if ((self->flags & LDM_MANAGER_FLAGS_PARALLEL_ENUMERATE) ==
+            LDM_MANAGER_FLAGS_PARALLEL_ENUMERATE) {
+                ldm_manager_init_udev_parallel(self, subsystems, G_N_ELEMENTS(subsystems));
+                return;
+        }
 
         /* Set up the enumerator */
         ue = udev_enumerate_new(self->udev);
         g_assert(ue != NULL);
 
-        if ((self->flags & LDM_MANAGER_FLAGS_GPU_QUICK) == LDM_MANAGER_FLAGS_GPU_QUICK) {
-                for (size_t i = 0; i < G_N_ELEMENTS(subsystems_minimal); i++) {
-                        const char *sub = subsystems_minimal[i];
-                        if (udev_enumerate_add_match_subsystem(ue, sub) != 0) {
-                                g_warning("Failed to add subsystem match: %s", sub);
-                        }
-                }
-        } else {
-                for (size_t i = 0; i < G_N_ELEMENTS(subsystems); i++) {
-                        const char *sub = subsystems[i];
-                        if (udev_enumerate_add_match_subsystem(ue, sub) != 0) {
-                                g_warning("Failed to add subsystem match: %s", sub);
-                        }
+        for (guint i = 0; i < G_N_ELEMENTS(subsystems); i++) {
+                if (udev_enumerate_add_match_subsystem(ue, subsystems[i]) != 0) {
+                        g_warning("Failed to add subsystem match: %s", subsystems[i]);
                 }
         }
 
@@ -357,58 +805,139 @@ static void ldm_manager_init_udev_monitor(LdmManager *self)
             g_io_add_watch(self->monitor.channel, G_IO_IN, ldm_manager_io_ready, self);
 }
 
+/**
+ * ldm_manager_handle_event:
+ *
+ * Update the devices for a single event received by the monitor
+ */
+static void ldm_manager_handle_event(LdmManager *self, udev_device *device)
+{
+        const char *action = NULL;
+
+        action = udev_device_get_action(device);
+        if (!action) {
+                return;
+        }
+
+        /* Interesting actions */
+        if (g_str_equal(action, "add")) {
+                ldm_manager_push_device(self, device, NULL, TRUE);
+        } else if (g_str_equal(action, "remove")) {
+                ldm_manager_remove_device(self, device);
+        } else if (g_str_equal(action, "bind")) {
+                ldm_manager_emit_usb(self, device);
+        }
+}
+
+/**
+ * ldm_manager_schedule_changes:
+ *
+ * Start the wait for further events before announcing the pending changes,
+ * so that a burst of events results in a single devices-changed. The wait
+ * starts with the first change and isn't extended by later ones, so that a
+ * steady stream of events can't hold the signal back indefinitely.
+ */
+static void ldm_manager_schedule_changes(LdmManager *self)
+{
+        if (self->monitor.added->len == 0 && self->monitor.removed->len == 0) {
+                return;
+        }
+
+        /* Already waiting, the changes go out with the rest */
+        if (self->monitor.flush_source > 0) {
+                return;
+        }
+
+        if (self->monitor.debounce == 0) {
+                ldm_manager_flush_changes(self);
+                return;
+        }
+
+        self->monitor.flush_source =
+            g_timeout_add(self->monitor.debounce, ldm_manager_flush_changes, self);
+}
+
+/**
+ * ldm_manager_flush_changes:
+ *
+ * Announce every change gathered since the last devices-changed
+ */
+static gboolean ldm_manager_flush_changes(gpointer v)
+{
+        LdmManager *self = v;
+        g_autoptr(GPtrArray) added = NULL;
+        g_autoptr(GPtrArray) removed = NULL;
+
+        self->monitor.flush_source = 0;
+
+        /* Handlers may cause further changes, so start over first */
+        added = g_steal_pointer(&self->monitor.added);
+        removed = g_steal_pointer(&self->monitor.removed);
+        self->monitor.added = g_ptr_array_new_with_free_func(g_object_unref);
+        self->monitor.removed = g_ptr_array_new_with_free_func(g_object_unref);
+
+        g_signal_emit(self, obj_signals[SIGNAL_DEVICES_CHANGED], 0, added, removed);
+
+        return G_SOURCE_REMOVE;
+}
+
 /**
  * ldm_manager_io_ready:
  *
- * We have I/O on the udev channel, do something with it.
+ * We have I/O on the udev channel, do something with it. Every event queued
+ * by now is handled in one go, as hotplugging a dock or hub results in many.
  */
 static gboolean ldm_manager_io_ready(__ldm_unused__ GIOChannel *source, GIOCondition condition,
                                      gpointer v)
 {
         LdmManager *self = v;
-        autofree(udev_device) *device = NULL;
-        const char *action = NULL;
+        guint n_events = 0;
 
         /* Only want G_IO_IN here. */
         if ((condition & G_IO_IN) != G_IO_IN) {
                 return TRUE;
         }
 
-        device = udev_monitor_receive_device(self->monitor.udev);
-        if (!device) {
+        for (;;) {
+                autofree(udev_device) *device = NULL;
+
+                /* The socket is non-blocking, so NULL once drained */
+                device = udev_monitor_receive_device(self->monitor.udev);
+                if (!device) {
+                        break;
+                }
+
+                ldm_manager_handle_event(self, device);
+                ++n_events;
+        }
+
+        if (n_events == 0) {
                 /* Remove polling now, something is badly wrong. */
                 g_warning("Failed to receive device!");
                 return FALSE;
         }
 
-        action = udev_device_get_action(device);
-        if (!action) {
-                return TRUE;
-        }
-
-        /* Interesting actions */
-        if (g_str_equal(action, "add")) {
-                ldm_manager_push_device(self, device, TRUE);
-        } else if (g_str_equal(action, "remove")) {
-                ldm_manager_remove_device(self, device);
-        } else if (g_str_equal(action, "bind")) {
-                ldm_manager_emit_usb(self, device);
-        }
+        ldm_manager_schedule_changes(self);
 
         /* Keep the source around */
         return TRUE;
 }
 
 /*
- * Walk devices and find the matching device.
- * We originally used a hashtable internally but that has the undesirable
+ * Find the matching device through the path table.
+ * We originally used a hashtable alone but that has the undesirable
  * effect that we lose our original sorting as it came from udev, and not
  * only did it make test suites unreliable, it also meant we could encounter
- * PCI devices in the wrong order too.
+ * PCI devices in the wrong order too. Devices are still kept in an array,
+ * and the table only maps each path to the device's position within it,
+ * while the order handed out is that of the device priority.
  */
 static gboolean ldm_manager_device_by_sysfs_path(LdmManager *self, const char *sysfs_path,
                                                  LdmDevice **out_device, guint *out_index)
 {
+        gpointer v = NULL;
+        guint index = 0;
+
         if (out_device) {
                 *out_device = NULL;
         }
@@ -416,25 +945,105 @@ static gboolean ldm_manager_device_by_sysfs_path(LdmManager *self, const char *s
                 *out_index = 0;
         }
 
-        /* Find the device */
-        for (guint i = 0; i < self->devices->len; i++) {
-                LdmDevice *node = NULL;
+        if (!g_hash_table_lookup_extended(self->device_paths, sysfs_path, NULL, &v)) {
+                return FALSE;
+        }
+        index = GPOINTER_TO_UINT(v);
 
-                node = self->devices->pdata[i];
-                if (!g_str_equal(node->os.sysfs_path, sysfs_path)) {
-                        continue;
-                }
+        if (out_device) {
+                *out_device = self->devices->pdata[index];
+        }
+        if (out_index) {
+                *out_index = index;
+        }
+        return TRUE;
+}
 
-                if (out_device) {
-                        *out_device = node;
-                }
-                if (out_index) {
-                        *out_index = i;
+/**
+ * ldm_manager_insert_device:
+ * @device: (transfer full): Device to add
+ *
+ * Add a root level device to the end of our known devices
+ */
+static void ldm_manager_insert_device(LdmManager *self, LdmDevice *device)
+{
+        g_hash_table_insert(self->device_paths,
+                            device->os.sysfs_path,
+                            GUINT_TO_POINTER(self->devices->len));
+        g_ptr_array_add(self->devices, g_object_ref_sink(device));
+}
+
+/**
+ * ldm_manager_init_udev_snapshot:
+ *
+ * Rebuild the devices from the snapshot when the system hasn't changed
+ * since it was taken. Otherwise enumerate them as usual, then take a new
+ * snapshot for the next manager if we're permitted to.
+ */
+static void ldm_manager_init_udev_snapshot(LdmManager *self)
+{
+        g_autoptr(GPtrArray) devices = NULL;
+        g_autofree gchar *directory = NULL;
+        guint32 flags = self->flags & LDM_MANAGER_FLAGS_GPU_QUICK;
+        guint64 fingerprint = 0;
+        gint next_priority = 0;
+
+        if (!self->snapshot_path) {
+                self->snapshot_path = g_build_filename(LDM_RUN_DIR,
+                                                       flags ? "gpu.snapshot" : "devices.snapshot",
+                                                       NULL);
+        }
+
+        /* Taken first, so a change while enumerating leaves the snapshot stale */
+        fingerprint = ldm_device_snapshot_fingerprint(flags != 0);
+
+        devices = ldm_device_snapshot_read(self->snapshot_path, flags, fingerprint, &next_priority);
+        if (devices) {
+                for (guint i = 0; i < devices->len; i++) {
+                        ldm_manager_insert_device(self, devices->pdata[i]);
                 }
-                return TRUE;
+                self->device_priority = next_priority;
+                ++self->generation;
+                return;
+        }
+
+        ldm_manager_init_udev_static(self);
+
+        directory = g_path_get_dirname(self->snapshot_path);
+        if (g_mkdir_with_parents(directory, 00755) != 0 || access(directory, W_OK) != 0) {
+                return;
+        }
+
+        if (!ldm_device_snapshot_write(self->devices,
+                                       self->device_priority,
+                                       flags,
+                                       fingerprint,
+                                       self->snapshot_path,
+                                       NULL)) {
+                g_debug("failed to write device snapshot %s", self->snapshot_path);
         }
+}
+
+/**
+ * ldm_manager_remove_device_index:
+ * @index: Position of the device within our known devices
+ *
+ * Forget about the device in constant time, moving the last device into
+ * its place.
+ */
+static void ldm_manager_remove_device_index(LdmManager *self, guint index)
+{
+        LdmDevice *device = self->devices->pdata[index];
 
-        return FALSE;
+        g_hash_table_remove(self->device_paths, device->os.sysfs_path);
+        g_ptr_array_remove_index_fast(self->devices, index);
+
+        if (index < self->devices->len) {
+                device = self->devices->pdata[index];
+                g_hash_table_insert(self->device_paths,
+                                    device->os.sysfs_path,
+                                    GUINT_TO_POINTER(index));
+        }
 }
 
 /**
@@ -457,6 +1066,7 @@ static void ldm_manager_remove_device(LdmManager *self, udev_device *device)
         parent = ldm_manager_get_device_parent(self, subsystem, device);
         if (parent) {
                 ldm_device_remove_child_by_path(parent, sysfs_path);
+                ++self->generation;
                 return;
         }
 
@@ -465,10 +1075,11 @@ static void ldm_manager_remove_device(LdmManager *self, udev_device *device)
         };
 
         /*  Emit signal for the device removal */
-        g_signal_emit(self, obj_signals[SIGNAL_DEVICE_REMOVED], 0, node);
+        ldm_manager_emit_device_removed(self, node);
 
         /* Remove from our known devices */
-        g_ptr_array_remove_index(self->devices, index);
+        ldm_manager_remove_device_index(self, index);
+        ++self->generation;
 }
 
 /**
@@ -483,7 +1094,7 @@ static void ldm_manager_push_sysfs(LdmManager *self, const char *sysfs_path)
 
         device = udev_device_new_from_syspath(self->udev, sysfs_path);
 
-        ldm_manager_push_device(self, device, FALSE);
+        ldm_manager_push_device(self, device, NULL, FALSE);
 }
 
 /**
@@ -620,16 +1231,19 @@ static void ldm_manager_emit_usb(LdmManager *self, udev_device *device)
                 return;
         };
 
-        g_signal_emit(self, obj_signals[SIGNAL_DEVICE_ADDED], 0, node);
+        ldm_manager_emit_device_added(self, node);
 }
 
 /**
  * ldm_manager_push_device:
  * @device: The udev device to add
+ * @prepared: (nullable): The device, if already constructed from @device
+ *            without a parent
  *
  * This will handle the real work of adding a new device to the manager
  */
-static void ldm_manager_push_device(LdmManager *self, udev_device *device, gboolean emit_signal)
+static void ldm_manager_push_device(LdmManager *self, udev_device *device, LdmDevice *prepared,
+                                    gboolean emit_signal)
 {
         LdmDevice *ldm_device = NULL;
         LdmDevice *parent = NULL;
@@ -655,18 +1269,28 @@ static void ldm_manager_push_device(LdmManager *self, udev_device *device, gbool
                 return;
         }
 
-        /* Build the actual device now */
-        ldm_device = ldm_device_new_from_udev(parent, device, properties, self->device_priority);
+        /* Build the actual device now, unless that was done ahead of time */
+        if (prepared) {
+                ldm_device = prepared;
+                ldm_device->tree.parent = parent;
+                ldm_device->priority = self->device_priority;
+        } else {
+                ldm_device =
+                    ldm_device_new_from_udev(parent, device, properties, self->device_priority);
+        }
 
         /* Note that due to subchilds this index may appear messed up, but that's fine. */
         ++self->device_priority;
 
+        /* New interfaces may change the providers of their parent */
+        ++self->generation;
+
         if (parent) {
                 ldm_device_add_child(parent, ldm_device);
                 return;
         }
 
-        g_ptr_array_add(self->devices, g_object_ref_sink(ldm_device));
+        ldm_manager_insert_device(self, ldm_device);
 
         /*  Emit signal for the new device. */
         if (!emit_signal) {
@@ -676,7 +1300,51 @@ static void ldm_manager_push_device(LdmManager *self, udev_device *device, gbool
         if (g_str_equal(subsystem, "usb")) {
                 return;
         }
-        g_signal_emit(self, obj_signals[SIGNAL_DEVICE_ADDED], 0, ldm_device);
+        ldm_manager_emit_device_added(self, ldm_device);
+}
+
+/**
+ * ldm_manager_emit_device_added:
+ *
+ * Announce the new device, and remember it for the next devices-changed
+ */
+static void ldm_manager_emit_device_added(LdmManager *self, LdmDevice *device)
+{
+        g_signal_emit(self, obj_signals[SIGNAL_DEVICE_ADDED], 0, device);
+
+        /* A repeated bind of the same USB device is only one addition */
+        if (!g_ptr_array_find(self->monitor.added, device, NULL)) {
+                g_ptr_array_add(self->monitor.added, g_object_ref(device));
+        }
+}
+
+/**
+ * ldm_manager_emit_device_removed:
+ *
+ * Announce the device is going away, and remember it for the next
+ * devices-changed unless it was only just added.
+ */
+static void ldm_manager_emit_device_removed(LdmManager *self, LdmDevice *device)
+{
+        guint index = 0;
+
+        g_signal_emit(self, obj_signals[SIGNAL_DEVICE_REMOVED], 0, device);
+
+        if (g_ptr_array_find(self->monitor.added, device, &index)) {
+                g_ptr_array_remove_index(self->monitor.added, index);
+                return;
+        }
+        g_ptr_array_add(self->monitor.removed, g_object_ref(device));
+}
+
+/**
+ * ldm_manager_emit_plugins_changed:
+ *
+ * Let consumers know that the plugins were changed behind their back
+ */
+void ldm_manager_emit_plugins_changed(LdmManager *self)
+{
+        g_signal_emit(self, obj_signals[SIGNAL_PLUGINS_CHANGED], 0);
 }
 
 /**
@@ -694,6 +1362,42 @@ LdmManager *ldm_manager_new(LdmManagerFlags flags)
         return g_object_new(LDM_TYPE_MANAGER, "flags", flags, NULL);
 }
 
+/**
+ * ldm_manager_get_debounce:
+ *
+ * Returns: How many milliseconds #LdmManager::devices-changed gathers
+ * hotplug events for
+ *
+ * Since: 1.0.3
+ */
+guint ldm_manager_get_debounce(LdmManager *self)
+{
+        g_return_val_if_fail(self != NULL, 0);
+
+        return self->monitor.debounce;
+}
+
+/**
+ * ldm_manager_set_debounce:
+ * @debounce: Milliseconds to wait, or 0 to not wait at all
+ *
+ * Set how long to gather hotplug events for after a change before emitting
+ * #LdmManager::devices-changed, which takes effect from the next change
+ * that isn't already waiting to be announced.
+ *
+ * Since: 1.0.3
+ */
+void ldm_manager_set_debounce(LdmManager *self, guint debounce)
+{
+        g_return_if_fail(self != NULL);
+
+        if (self->monitor.debounce == debounce) {
+                return;
+        }
+        self->monitor.debounce = debounce;
+        g_object_notify_by_pspec(G_OBJECT(self), obj_properties[PROP_DEBOUNCE]);
+}
+
 static gint ldm_manager_sort_device_by_priority(gconstpointer a, gconstpointer b)
 {
         gint prioA = ldm_device_get_priority(*(LdmDevice **)a);
@@ -26,6 +26,20 @@ typedef struct _LdmManagerClass LdmManagerClass;
  * @LDM_MANAGER_FLAGS_NONE: No special behaviour required
  * @LDM_MANAGER_FLAGS_NO_MONITOR: Disable hotplug events
  * @LDM_MANAGER_FLAGS_GPU_QUICK: Only allow GPU devices for fast initialisation
+ * @LDM_MANAGER_FLAGS_MATCH_STATS: Gather statistics on plugin matching, at
+ *                                 some cost, see #ldm_manager_get_match_stats.
+ *                                 Since: 1.0.3
+ * @LDM_MANAGER_FLAGS_WATCH_MODALIASES: Reload modalias plugins when the files in
+ *                                      directories passed to
+ *                                      #ldm_manager_add_modalias_plugins_for_directory
+ *                                      change. Since: 1.0.3
+ * @LDM_MANAGER_FLAGS_PARALLEL_ENUMERATE: Enumerate each subsystem on a thread of
+ *                                        its own during initialisation, which
+ *                                        is faster on systems with many devices.
+ *                                        Since: 1.0.3
+ * @LDM_MANAGER_FLAGS_SNAPSHOT: Reuse the devices found by an earlier manager
+ *                              while the system's devices are unchanged,
+ *                              see #LdmManager:snapshot-path. Since: 1.0.3
  *
  * Override the behaviour of the new LdmManager to allow disabling
  * of hotplug events, etc.
@@ -34,6 +48,10 @@ typedef enum {
         LDM_MANAGER_FLAGS_NONE = 0,
         LDM_MANAGER_FLAGS_NO_MONITOR = 1 << 0,
         LDM_MANAGER_FLAGS_GPU_QUICK = 1 << 1,
+        LDM_MANAGER_FLAGS_MATCH_STATS = 1 << 2,
+        LDM_MANAGER_FLAGS_WATCH_MODALIASES = 1 << 3,
+        LDM_MANAGER_FLAGS_PARALLEL_ENUMERATE = 1 << 4,
+        LDM_MANAGER_FLAGS_SNAPSHOT = 1 << 5,
 } LdmManagerFlags;
 
 #define LDM_TYPE_MANAGER ldm_manager_get_type()
@@ -49,6 +67,10 @@ GType ldm_manager_get_type(void);
 LdmManager *ldm_manager_new(LdmManagerFlags flags);
 GPtrArray *ldm_manager_get_devices(LdmManager *manager, LdmDeviceType class_mask);
 GPtrArray *ldm_manager_get_providers(LdmManager *manager, LdmDevice *device);
+GHashTable *ldm_manager_get_all_providers(LdmManager *manager, LdmDeviceType class_mask);
+GPtrArray *ldm_manager_get_match_stats(LdmManager *manager);
+guint ldm_manager_get_debounce(LdmManager *manager);
+void ldm_manager_set_debounce(LdmManager *manager, guint debounce);
 
 /* Plugin API */
 gboolean ldm_manager_add_modalias_plugin_for_path(LdmManager *manager, const gchar *path);
@@ -0,0 +1,81 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Linux Driver Management Developers, Solus Project
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+
+#include "match-stats.h"
+#include "util.h"
+
+/**
+ * SECTION:match-stats
+ * @Short_description: Matching statistics
+ * @see_also: #LdmManager, #LdmPlugin
+ * @Title: LdmMatchStats
+ *
+ * LdmMatchStats records how often, and for how long, the rules of a plugin
+ * were tested against devices, helping to find the rules and `.modaliases`
+ * files that make #ldm_manager_get_providers expensive.
+ */
+
+G_DEFINE_BOXED_TYPE(LdmMatchStats, ldm_match_stats, ldm_match_stats_copy, ldm_match_stats_free)
+
+/**
+ * ldm_match_stats_copy:
+ *
+ * Create a copy of the statistics
+ *
+ * Returns: (transfer full): A newly allocated copy of @stats
+ *
+ * Since: 1.0.3
+ */
+LdmMatchStats *ldm_match_stats_copy(const LdmMatchStats *self)
+{
+        LdmMatchStats *ret = NULL;
+
+        g_return_val_if_fail(self != NULL, NULL);
+
+        ret = g_new(LdmMatchStats, 1);
+        *ret = *self;
+        ret->plugin = g_strdup(self->plugin);
+        ret->match = g_strdup(self->match);
+
+        return ret;
+}
+
+/**
+ * ldm_match_stats_free:
+ *
+ * Free previously allocated statistics
+ *
+ * Since: 1.0.3
+ */
+void ldm_match_stats_free(LdmMatchStats *self)
+{
+        if (!self) {
+                return;
+        }
+        g_free(self->plugin);
+        g_free(self->match);
+        g_free(self);
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
@@ -0,0 +1,62 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Linux Driver Management Developers, Solus Project
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#pragma once
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+/**
+ * LdmMatchStats:
+ * @plugin: Name of the plugin that was asked about devices
+ * @match: (nullable): The modalias rule, or NULL for the totals of @plugin
+ * @n_candidates: Number of times the rule, or rules of the plugin, were tested
+ *                against a device modalias
+ * @n_matches: Number of those tests that matched
+ * @nanoseconds: Cumulative time spent testing
+ *
+ * Matching statistics gathered by a #LdmManager constructed with
+ * %LDM_MANAGER_FLAGS_MATCH_STATS, see #ldm_manager_get_match_stats.
+ *
+ * Since: 1.0.3
+ */
+typedef struct _LdmMatchStats {
+        gchar *plugin;
+        gchar *match;
+        guint64 n_candidates;
+        guint64 n_matches;
+        guint64 nanoseconds;
+} LdmMatchStats;
+
+#define LDM_TYPE_MATCH_STATS ldm_match_stats_get_type()
+
+GType ldm_match_stats_get_type(void);
+
+LdmMatchStats *ldm_match_stats_copy(const LdmMatchStats *stats);
+void ldm_match_stats_free(LdmMatchStats *stats);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(LdmMatchStats, ldm_match_stats_free)
+
+G_END_DECLS
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
@@ -0,0 +1,626 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Linux Driver Management Developers, Solus Project
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+
+#include <fnmatch.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "modalias-db.h"
+
+#define LDM_MODALIAS_DB_MAGIC "LDMALIAS"
+#define LDM_MODALIAS_DB_VERSION 2
+#define LDM_MODALIAS_DB_BYTE_ORDER 0x01020304
+
+/* FNV-1a */
+#define LDM_MODALIAS_DB_HASH_INIT G_GUINT64_CONSTANT(0xcbf29ce484222325)
+#define LDM_MODALIAS_DB_HASH_PRIME G_GUINT64_CONSTANT(0x100000001b3)
+
+/*
+ * The database is laid out in host byte order as:
+ *
+ *      header | rules[n_rules] | keys[n_keys] | string pool
+ *
+ * The first n_keyed rules have an exact key, and are sorted by that key and
+ * then by their order within the source file. Each key references its run
+ * of rules. The remaining rules cannot be keyed and are kept in source
+ * order. Strings are offsets into the pool, each stored only once.
+ */
+typedef struct LdmModaliasDbHeader {
+        gchar magic[8];
+        guint32 version;
+        guint32 byte_order;
+        guint64 source_size;
+        guint64 source_checksum; /* FNV-1a of the contents */
+        guint32 n_rules;
+        guint32 n_keyed;
+        guint32 n_keys;
+        guint32 pool_size;
+} LdmModaliasDbHeader;
+
+typedef struct LdmModaliasDbRule {
+        guint32 match;
+        guint32 driver;
+        guint32 package;
+        guint32 order; /* Position of the rule within the source file */
+} LdmModaliasDbRule;
+
+typedef struct LdmModaliasDbKey {
+        guint32 bus;
+        guint32 vendor;
+        guint32 product;
+        guint32 first;
+        guint32 n_rules;
+} LdmModaliasDbKey;
+
+struct _LdmModaliasDb {
+        GMappedFile *file;
+        const LdmModaliasDbHeader *header;
+        const LdmModaliasDbRule *rules;
+        const LdmModaliasDbKey *keys;
+        const gchar *pool;
+};
+
+#define POOL(db, offset) ((db)->pool + (offset))
+
+/**
+ * ldm_modalias_db_checksum_source:
+ *
+ * Grab the size and checksum of the source file. Unlike its modification
+ * time, neither changes when the file is copied or installed elsewhere.
+ */
+static gboolean ldm_modalias_db_checksum_source(const gchar *source, guint64 *size,
+                                                guint64 *checksum)
+{
+        g_autoptr(GMappedFile) file = NULL;
+        const gchar *contents = NULL;
+        gsize length = 0;
+        guint64 hash = LDM_MODALIAS_DB_HASH_INIT;
+
+        file = g_mapped_file_new(source, FALSE, NULL);
+        if (!file) {
+                return FALSE;
+        }
+
+        length = g_mapped_file_get_length(file);
+        contents = g_mapped_file_get_contents(file);
+        for (gsize i = 0; i < length; i++) {
+                hash ^= (guchar)contents[i];
+                hash *= LDM_MODALIAS_DB_HASH_PRIME;
+        }
+
+        *size = (guint64)length;
+        *checksum = hash;
+        return TRUE;
+}
+
+/**
+ * ldm_modalias_db_validate:
+ *
+ * Ensure every offset within the database is sane before we trust it
+ */
+static gboolean ldm_modalias_db_validate(LdmModaliasDb *self)
+{
+        const LdmModaliasDbHeader *header = self->header;
+
+        if (header->n_keyed > header->n_rules || header->pool_size < 1) {
+                return FALSE;
+        }
+
+        if (self->pool[header->pool_size - 1] != '\0') {
+                return FALSE;
+        }
+
+        for (guint32 i = 0; i < header->n_rules; i++) {
+                const LdmModaliasDbRule *rule = &self->rules[i];
+
+                if (rule->match >= header->pool_size || rule->driver >= header->pool_size ||
+                    rule->package >= header->pool_size || rule->order >= header->n_rules) {
+                        return FALSE;
+                }
+        }
+
+        for (guint32 i = 0; i < header->n_keys; i++) {
+                const LdmModaliasDbKey *key = &self->keys[i];
+
+                if ((guint64)key->first + key->n_rules > header->n_keyed) {
+                        return FALSE;
+                }
+        }
+
+        return TRUE;
+}
+
+/**
+ * ldm_modalias_db_open:
+ * @path: Path to the compiled database
+ * @source: Path to the `.modaliases` file it was compiled from
+ *
+ * Map the database into memory, provided it is valid and still matches the
+ * size and checksum of @source.
+ *
+ * Returns: A new database, or NULL if it is missing, invalid or stale
+ */
+LdmModaliasDb *ldm_modalias_db_open(const gchar *path, const gchar *source)
+{
+        g_autoptr(GMappedFile) file = NULL;
+        const LdmModaliasDbHeader *header = NULL;
+        LdmModaliasDb *ret = NULL;
+        guint64 source_size = 0;
+        guint64 source_checksum = 0;
+        gsize length = 0;
+        guint64 expected = 0;
+
+        g_return_val_if_fail(path != NULL, NULL);
+        g_return_val_if_fail(source != NULL, NULL);
+
+        file = g_mapped_file_new(path, FALSE, NULL);
+        if (!file) {
+                return NULL;
+        }
+
+        length = g_mapped_file_get_length(file);
+        if (length < sizeof(LdmModaliasDbHeader)) {
+                return NULL;
+        }
+        header = (const LdmModaliasDbHeader *)g_mapped_file_get_contents(file);
+
+        if (memcmp(header->magic, LDM_MODALIAS_DB_MAGIC, sizeof(header->magic)) != 0 ||
+            header->version != LDM_MODALIAS_DB_VERSION ||
+            header->byte_order != LDM_MODALIAS_DB_BYTE_ORDER) {
+                return NULL;
+        }
+
+        /* Source changed since we were compiled */
+        if (!ldm_modalias_db_checksum_source(source, &source_size, &source_checksum) ||
+            header->source_size != source_size || header->source_checksum != source_checksum) {
+                return NULL;
+        }
+
+        expected = sizeof(LdmModaliasDbHeader) +
+                   (guint64)header->n_rules * sizeof(LdmModaliasDbRule) +
+                   (guint64)header->n_keys * sizeof(LdmModaliasDbKey) + header->pool_size;
+        if (expected != length) {
+                return NULL;
+        }
+
+        ret = g_new0(LdmModaliasDb, 1);
+        ret->header = header;
+        ret->rules = (const LdmModaliasDbRule *)(header + 1);
+        ret->keys = (const LdmModaliasDbKey *)(ret->rules + header->n_rules);
+        ret->pool = (const gchar *)(ret->keys + header->n_keys);
+
+        if (!ldm_modalias_db_validate(ret)) {
+                g_free(ret);
+                return NULL;
+        }
+
+        ret->file = g_steal_pointer(&file);
+        return ret;
+}
+
+/**
+ * ldm_modalias_db_free:
+ *
+ * Unmap and free the database
+ */
+void ldm_modalias_db_free(LdmModaliasDb *self)
+{
+        if (!self) {
+                return;
+        }
+        g_mapped_file_unref(self->file);
+        g_free(self);
+}
+
+/**
+ * ldm_modalias_db_size:
+ *
+ * Returns: The number of rules within the database
+ */
+guint ldm_modalias_db_size(LdmModaliasDb *self)
+{
+        g_return_val_if_fail(self != NULL, 0);
+
+        return self->header->n_rules;
+}
+
+static gint ldm_modalias_db_compare_key(gconstpointer a, gconstpointer b)
+{
+        const LdmModaliasDbKey *keyA = a;
+        const LdmModaliasDbKey *keyB = b;
+
+        if (keyA->bus != keyB->bus) {
+                return keyA->bus < keyB->bus ? -1 : 1;
+        }
+        if (keyA->vendor != keyB->vendor) {
+                return keyA->vendor < keyB->vendor ? -1 : 1;
+        }
+        if (keyA->product != keyB->product) {
+                return keyA->product < keyB->product ? -1 : 1;
+        }
+        return 0;
+}
+
+/**
+ * ldm_modalias_db_test_range:
+ *
+ * Test a run of rules sorted by their source order, updating @best with the
+ * earliest matching rule.
+ */
+static void ldm_modalias_db_test_range(LdmModaliasDb *self, guint32 first, guint32 n_rules,
+                                       const gchar *modalias, const LdmModaliasDbRule **best)
+{
+        for (guint32 i = first; i < first + n_rules; i++) {
+                const LdmModaliasDbRule *rule = &self->rules[i];
+
+                /* Nothing later in the run can win */
+                if (*best && (*best)->order < rule->order) {
+                        return;
+                }
+
+                if (fnmatch(POOL(self, rule->match), modalias, 0) == 0) {
+                        *best = rule;
+                        return;
+                }
+        }
+}
+
+/**
+ * ldm_modalias_db_lookup:
+ * @modalias: Device modalias to look up
+ *
+ * Find the first rule, in source order, matching the device modalias.
+ *
+ * Returns: (transfer none) (nullable): The package of the matching rule
+ */
+const gchar *ldm_modalias_db_lookup(LdmModaliasDb *self, const gchar *modalias)
+{
+        const LdmModaliasDbHeader *header = NULL;
+        const LdmModaliasDbRule *best = NULL;
+        LdmModaliasKey key = { 0 };
+
+        g_return_val_if_fail(self != NULL, NULL);
+        g_return_val_if_fail(modalias != NULL, NULL);
+
+        header = self->header;
+
+        if (ldm_modalias_parse_device_key(modalias, &key)) {
+                const LdmModaliasDbKey *found = NULL;
+                LdmModaliasDbKey needle = {
+                        .bus = key.bus,
+                        .vendor = key.vendor,
+                        .product = key.product,
+                };
+
+                found = bsearch(&needle,
+                                self->keys,
+                                header->n_keys,
+                                sizeof(LdmModaliasDbKey),
+                                ldm_modalias_db_compare_key);
+                if (found) {
+                        ldm_modalias_db_test_range(self,
+                                                   found->first,
+                                                   found->n_rules,
+                                                   modalias,
+                                                   &best);
+                }
+        } else if (key.bus != LDM_MODALIAS_BUS_NONE) {
+                /* Malformed modalias on a known bus: the key can't be trusted */
+                for (guint32 i = 0; i < header->n_keys; i++) {
+                        ldm_modalias_db_test_range(self,
+                                                   self->keys[i].first,
+                                                   self->keys[i].n_rules,
+                                                   modalias,
+                                                   &best);
+                }
+        }
+
+        ldm_modalias_db_test_range(self,
+                                   header->n_keyed,
+                                   header->n_rules - header->n_keyed,
+                                   modalias,
+                                   &best);
+
+        return best ? POOL(self, best->package) : NULL;
+}
+
+/**
+ * ldm_modalias_db_foreach:
+ * @func: Function to call for each rule
+ * @userdata: Data to pass to @func
+ *
+ * Call @func for every rule in the database, in source order.
+ */
+void ldm_modalias_db_foreach(LdmModaliasDb *self, LdmModaliasFileFunc func, gpointer userdata)
+{
+        g_autofree guint32 *ordered = NULL;
+        guint32 n_rules = 0;
+
+        g_return_if_fail(self != NULL);
+        g_return_if_fail(func != NULL);
+
+        n_rules = self->header->n_rules;
+        ordered = g_new0(guint32, n_rules);
+        for (guint32 i = 0; i < n_rules; i++) {
+                ordered[self->rules[i].order] = i;
+        }
+
+        for (guint32 i = 0; i < n_rules; i++) {
+                const LdmModaliasDbRule *rule = &self->rules[ordered[i]];
+
+                func(POOL(self, rule->match),
+                     POOL(self, rule->driver),
+                     POOL(self, rule->package),
+                     userdata);
+        }
+}
+
+/*
+ * Used to construct a new database from a source file
+ */
+typedef struct LdmModaliasDbBuilder {
+        GArray *rules;       /* LdmModaliasDbRule, in source order */
+        GHashTable *matches; /* match -> rule index + 1 */
+        GHashTable *strings; /* string -> pool offset */
+        GByteArray *pool;
+} LdmModaliasDbBuilder;
+
+typedef struct LdmModaliasDbSortable {
+        LdmModaliasDbRule rule;
+        LdmModaliasKey key;
+        gboolean keyed;
+} LdmModaliasDbSortable;
+
+/**
+ * ldm_modalias_db_intern:
+ *
+ * Return the pool offset for the string, adding it to the pool if needed
+ */
+static guint32 ldm_modalias_db_intern(LdmModaliasDbBuilder *builder, const gchar *str)
+{
+        gpointer offset = NULL;
+        guint32 ret = 0;
+
+        if (g_hash_table_lookup_extended(builder->strings, str, NULL, &offset)) {
+                return GPOINTER_TO_UINT(offset);
+        }
+
+        ret = builder->pool->len;
+        g_byte_array_append(builder->pool, (const guint8 *)str, (guint)strlen(str) + 1);
+        g_hash_table_insert(builder->strings, g_strdup(str), GUINT_TO_POINTER(ret));
+
+        return ret;
+}
+
+/**
+ * ldm_modalias_db_add_rule:
+ *
+ * Add a rule from the source file. As with #LdmModaliasPlugin, a repeated
+ * match replaces the earlier rule.
+ */
+static void ldm_modalias_db_add_rule(const gchar *match, const gchar *driver, const gchar *package,
+                                     gpointer userdata)
+{
+        LdmModaliasDbBuilder *builder = userdata;
+        LdmModaliasDbRule rule = { 0 };
+        guint index = 0;
+
+        rule.match = ldm_modalias_db_intern(builder, match);
+        rule.driver = ldm_modalias_db_intern(builder, driver);
+        rule.package = ldm_modalias_db_intern(builder, package);
+
+        index = GPOINTER_TO_UINT(g_hash_table_lookup(builder->matches, match));
+        if (index > 0) {
+                rule.order = index - 1;
+                g_array_index(builder->rules, LdmModaliasDbRule, rule.order) = rule;
+                return;
+        }
+
+        rule.order = builder->rules->len;
+        g_array_append_val(builder->rules, rule);
+        g_hash_table_insert(builder->matches, g_strdup(match), GUINT_TO_POINTER(rule.order + 1));
+}
+
+static gint ldm_modalias_db_sort_rules(gconstpointer a, gconstpointer b)
+{
+        const LdmModaliasDbSortable *sortA = a;
+        const LdmModaliasDbSortable *sortB = b;
+
+        if (sortA->keyed != sortB->keyed) {
+                return sortA->keyed ? -1 : 1;
+        }
+
+        if (sortA->keyed) {
+                LdmModaliasDbKey keyA = {
+                        .bus = sortA->key.bus,
+                        .vendor = sortA->key.vendor,
+                        .product = sortA->key.product,
+                };
+                LdmModaliasDbKey keyB = {
+                        .bus = sortB->key.bus,
+                        .vendor = sortB->key.vendor,
+                        .product = sortB->key.product,
+                };
+                gint ret = ldm_modalias_db_compare_key(&keyA, &keyB);
+
+                if (ret != 0) {
+                        return ret;
+                }
+        }
+
+        return sortA->rule.order < sortB->rule.order ? -1 : 1;
+}
+
+/**
+ * ldm_modalias_db_write:
+ * @source: Path to the `.modaliases` file to compile
+ * @output: Path to write the database to
+ * @error: Return location for an error
+ *
+ * Compile the source file into a new database, atomically replacing any
+ * existing file at @output.
+ *
+ * Returns: TRUE if the database was written
+ */
+gboolean ldm_modalias_db_write(const gchar *source, const gchar *output, GError **error)
+{
+        LdmModaliasDbBuilder builder = { 0 };
+        LdmModaliasDbHeader header = { 0 };
+        g_autoptr(GArray) sortable = NULL;
+        g_autoptr(GArray) keys = NULL;
+        g_autoptr(GByteArray) data = NULL;
+        gboolean ret = FALSE;
+
+        g_return_val_if_fail(source != NULL, FALSE);
+        g_return_val_if_fail(output != NULL, FALSE);
+
+        memcpy(header.magic, LDM_MODALIAS_DB_MAGIC, sizeof(header.magic));
+        header.version = LDM_MODALIAS_DB_VERSION;
+        header.byte_order = LDM_MODALIAS_DB_BYTE_ORDER;
+
+        /* Checksum before parsing, so any later change invalidates the result */
+        if (!ldm_modalias_db_checksum_source(source,
+                                             &header.source_size,
+                                             &header.source_checksum)) {
+                g_set_error(error,
+                            G_FILE_ERROR,
+                            G_FILE_ERROR_NOENT,
+                            "Cannot read %s",
+                            source);
+                return FALSE;
+        }
+
+        builder.rules = g_array_new(FALSE, FALSE, sizeof(LdmModaliasDbRule));
+        builder.matches = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+        builder.strings = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+        builder.pool = g_byte_array_new();
+
+        if (!ldm_modalias_parse_file(source, ldm_modalias_db_add_rule, &builder)) {
+                g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_FAILED, "Cannot read %s", source);
+                goto cleanup;
+        }
+
+        /* Sort keyed rules into runs, leaving the rest in source order */
+        sortable = g_array_sized_new(FALSE,
+                                     FALSE,
+                                     sizeof(LdmModaliasDbSortable),
+                                     builder.rules->len);
+        for (guint i = 0; i < builder.rules->len; i++) {
+                LdmModaliasDbSortable sort = { 0 };
+
+                sort.rule = g_array_index(builder.rules, LdmModaliasDbRule, i);
+                sort.keyed = ldm_modalias_parse_match_key((const gchar *)builder.pool->data +
+                                                              sort.rule.match,
+                                                          &sort.key);
+                g_array_append_val(sortable, sort);
+        }
+        g_array_sort(sortable, ldm_modalias_db_sort_rules);
+
+        keys = g_array_new(FALSE, FALSE, sizeof(LdmModaliasDbKey));
+        for (guint i = 0; i < sortable->len; i++) {
+                LdmModaliasDbSortable *sort = &g_array_index(sortable, LdmModaliasDbSortable, i);
+                LdmModaliasDbKey key = {
+                        .bus = sort->key.bus,
+                        .vendor = sort->key.vendor,
+                        .product = sort->key.product,
+                        .first = i,
+                        .n_rules = 1,
+                };
+                LdmModaliasDbKey *last = NULL;
+
+                if (!sort->keyed) {
+                        break;
+                }
+                ++header.n_keyed;
+
+                if (keys->len > 0) {
+                        last = &g_array_index(keys, LdmModaliasDbKey, keys->len - 1);
+                        if (ldm_modalias_db_compare_key(last, &key) == 0) {
+                                ++last->n_rules;
+                                continue;
+                        }
+                }
+                g_array_append_val(keys, key);
+        }
+
+        /* Never leave the pool empty so validation is trivial */
+        if (builder.pool->len < 1) {
+                g_byte_array_append(builder.pool, (const guint8 *)"", 1);
+        }
+
+        header.n_rules = sortable->len;
+        header.n_keys = keys->len;
+        header.pool_size = builder.pool->len;
+
+        data = g_byte_array_new();
+        g_byte_array_append(data, (const guint8 *)&header, sizeof(header));
+        for (guint i = 0; i < sortable->len; i++) {
+                LdmModaliasDbSortable *sort = &g_array_index(sortable, LdmModaliasDbSortable, i);
+                g_byte_array_append(data, (const guint8 *)&sort->rule, sizeof(sort->rule));
+        }
+        g_byte_array_append(data,
+                            (const guint8 *)keys->data,
+                            keys->len * (guint)sizeof(LdmModaliasDbKey));
+        g_byte_array_append(data, builder.pool->data, builder.pool->len);
+
+        ret = g_file_set_contents(output, (const gchar *)data->data, data->len, error);
+
+cleanup:
+        g_array_unref(builder.rules);
+        g_hash_table_unref(builder.matches);
+        g_hash_table_unref(builder.strings);
+        g_byte_array_unref(builder.pool);
+
+        return ret;
+}
+
+/**
+ * ldm_modalias_db_get_cache_path:
+ * @source: Path to a `.modaliases` file
+ *
+ * Determine where the lazily compiled database for @source lives. The
+ * directory of the source is hashed into the name so that identically
+ * named files in different directories don't collide.
+ *
+ * Returns: (transfer full): Newly allocated path within the cache directory
+ */
+gchar *ldm_modalias_db_get_cache_path(const gchar *source)
+{
+        g_autofree gchar *dirname = NULL;
+        g_autofree gchar *basename = NULL;
+
+        g_return_val_if_fail(source != NULL, NULL);
+
+        dirname = g_path_get_dirname(source);
+        basename = g_path_get_basename(source);
+
+        return g_strdup_printf("%s%s%s-%08x.bin",
+                               LDM_CACHE_DIR,
+                               G_DIR_SEPARATOR_S,
+                               basename,
+                               g_str_hash(dirname));
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
@@ -0,0 +1,56 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Linux Driver Management Developers, Solus Project
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+#include "ldm-private.h"
+
+G_BEGIN_DECLS
+
+/*
+ * LdmModaliasDb
+ *
+ * Private helper providing a compiled, read-only form of a `.modaliases`
+ * file. The file is memory mapped and used in place: rules are sorted by
+ * their bus, vendor and product key with a table of keys to search, and
+ * every string lives in a single pool. Each database records the size and
+ * checksum of its source and is rejected once they change.
+ */
+typedef struct _LdmModaliasDb LdmModaliasDb;
+
+LdmModaliasDb *ldm_modalias_db_open(const gchar *path, const gchar *source);
+void ldm_modalias_db_free(LdmModaliasDb *db);
+
+gboolean ldm_modalias_db_write(const gchar *source, const gchar *output, GError **error);
+gchar *ldm_modalias_db_get_cache_path(const gchar *source);
+
+guint ldm_modalias_db_size(LdmModaliasDb *db);
+const gchar *ldm_modalias_db_lookup(LdmModaliasDb *db, const gchar *modalias);
+void ldm_modalias_db_foreach(LdmModaliasDb *db, LdmModaliasFileFunc func, gpointer userdata);
+
+DEF_AUTOFREE(LdmModaliasDb, ldm_modalias_db_free)
+
+G_END_DECLS
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
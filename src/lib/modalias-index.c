@@ -0,0 +1,544 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Linux Driver Management Developers, Solus Project
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+
+#include <fnmatch.h>
+#include <string.h>
+
+#include "ldm-private.h"
+#include "modalias-index.h"
+#include "modalias-matcher.h"
+
+/*
+ * Every match added to the index is stored once as an entry, and its
+ * position is used to return results in insertion order regardless of
+ * whether it was found through a key bucket or the fallback matcher.
+ *
+ * Removed entries are only marked as such, and the index is compacted once
+ * they account for half of all entries.
+ *
+ * Any match tested individually is first compared on its literal prefix,
+ * i.e. everything before the first wildcard, rejecting most candidates with
+ * a memcmp() rather than fnmatch().
+ */
+typedef struct LdmIndexEntry {
+        const gchar *match; /* Borrowed from the caller */
+        gpointer data;
+        gpointer owner;
+        gint priority;
+        guint prefix_len;
+        gboolean removed;
+} LdmIndexEntry;
+
+struct _LdmModaliasIndex {
+        GArray *entries;          /* LdmIndexEntry */
+        GHashTable *buckets;      /* LdmModaliasKey -> GArray of guint entry positions */
+        LdmModaliasMatcher *wild; /* Entries without an exact key, data is position + 1 */
+        GPtrArray *wild_hits;     /* Scratch space for matcher results */
+        GArray *hits;             /* Scratch space for entry positions */
+        GHashTable *wild_buses;   /* Bus prefix, i.e. "usb:" -> GArray of wild positions */
+        GArray *wild_unbound;     /* Positions of wild entries without a literal bus */
+        guint n_removed;
+
+        /* Profiling, when set */
+        LdmModaliasIndexEvalFunc eval_func;
+        gpointer eval_data;
+};
+
+#define ENTRY(i, n) (&g_array_index((i)->entries, LdmIndexEntry, (n)))
+
+static void ldm_modalias_index_free_bucket(gpointer v)
+{
+        g_array_unref(v);
+}
+
+/**
+ * ldm_modalias_index_sort_hits:
+ *
+ * Order hits by descending priority, then by insertion order
+ */
+static gint ldm_modalias_index_sort_hits(gconstpointer a, gconstpointer b, gpointer userdata)
+{
+        LdmModaliasIndex *self = userdata;
+        guint hitA = *(const guint *)a;
+        guint hitB = *(const guint *)b;
+        gint prioA = ENTRY(self, hitA)->priority;
+        gint prioB = ENTRY(self, hitB)->priority;
+
+        if (prioA != prioB) {
+                return prioA > prioB ? -1 : 1;
+        }
+
+        return hitA < hitB ? -1 : hitA > hitB ? 1 : 0;
+}
+
+/**
+ * ldm_modalias_index_new:
+ *
+ * Construct a new, empty, modalias index
+ */
+LdmModaliasIndex *ldm_modalias_index_new(void)
+{
+        LdmModaliasIndex *self = g_new0(LdmModaliasIndex, 1);
+
+        self->entries = g_array_new(FALSE, FALSE, sizeof(LdmIndexEntry));
+        self->buckets = g_hash_table_new_full(ldm_modalias_key_hash,
+                                              ldm_modalias_key_equal,
+                                              g_free,
+                                              ldm_modalias_index_free_bucket);
+        self->wild = ldm_modalias_matcher_new();
+        self->wild_hits = g_ptr_array_new();
+        self->hits = g_array_new(FALSE, FALSE, sizeof(guint));
+        self->wild_buses = g_hash_table_new_full(g_str_hash,
+                                                 g_str_equal,
+                                                 g_free,
+                                                 ldm_modalias_index_free_bucket);
+        self->wild_unbound = g_array_new(FALSE, FALSE, sizeof(guint));
+
+        return self;
+}
+
+/**
+ * ldm_modalias_index_free:
+ *
+ * Free a previously allocated index
+ */
+void ldm_modalias_index_free(LdmModaliasIndex *self)
+{
+        if (!self) {
+                return;
+        }
+        g_array_unref(self->entries);
+        g_hash_table_unref(self->buckets);
+        ldm_modalias_matcher_free(self->wild);
+        g_ptr_array_unref(self->wild_hits);
+        g_array_unref(self->hits);
+        g_hash_table_unref(self->wild_buses);
+        g_array_unref(self->wild_unbound);
+        g_free(self);
+}
+
+/* Longest bus prefix tracked for wild matches, far beyond any real bus */
+#define LDM_MODALIAS_BUS_MAX 32
+
+/**
+ * ldm_modalias_index_get_bus:
+ *
+ * Copy the bus prefix, including the colon, from the first @length
+ * characters of the modalias into @bus.
+ *
+ * Returns: FALSE if there is no bus prefix, or it's too long to track
+ */
+static gboolean ldm_modalias_index_get_bus(const gchar *modalias, gsize length,
+                                           gchar bus[LDM_MODALIAS_BUS_MAX])
+{
+        const gchar *colon = memchr(modalias, ':', length);
+        gsize bus_len = 0;
+
+        if (!colon) {
+                return FALSE;
+        }
+        bus_len = (gsize)(colon - modalias) + 1;
+        if (bus_len >= LDM_MODALIAS_BUS_MAX) {
+                return FALSE;
+        }
+
+        memcpy(bus, modalias, bus_len);
+        bus[bus_len] = '\0';
+        return TRUE;
+}
+
+/**
+ * ldm_modalias_index_insert_wild:
+ *
+ * Track a match without an exact key by its bus, allowing it to be tested
+ * individually against only those modaliases on the same bus.
+ */
+static void ldm_modalias_index_insert_wild(LdmModaliasIndex *self, const LdmIndexEntry *entry,
+                                           guint position)
+{
+        gchar bus[LDM_MODALIAS_BUS_MAX];
+        GArray *bucket = NULL;
+
+        ldm_modalias_matcher_add(self->wild, entry->match, GUINT_TO_POINTER(position + 1));
+
+        if (!ldm_modalias_index_get_bus(entry->match, entry->prefix_len, bus)) {
+                g_array_append_val(self->wild_unbound, position);
+                return;
+        }
+
+        bucket = g_hash_table_lookup(self->wild_buses, bus);
+        if (!bucket) {
+                bucket = g_array_new(FALSE, FALSE, sizeof(guint));
+                g_hash_table_insert(self->wild_buses, g_strdup(bus), bucket);
+        }
+        g_array_append_val(bucket, position);
+}
+
+/**
+ * ldm_modalias_index_insert:
+ *
+ * Place the entry into a key bucket, or the fallback matcher when the match
+ * has no exact key.
+ */
+static void ldm_modalias_index_insert(LdmModaliasIndex *self, const LdmIndexEntry *entry)
+{
+        LdmModaliasKey key = { 0 };
+        GArray *bucket = NULL;
+        guint position = 0;
+
+        position = self->entries->len;
+        g_array_append_val(self->entries, *entry);
+
+        if (!ldm_modalias_parse_match_key(entry->match, &key)) {
+                ldm_modalias_index_insert_wild(self, entry, position);
+                return;
+        }
+
+        bucket = g_hash_table_lookup(self->buckets, &key);
+        if (!bucket) {
+                LdmModaliasKey *stored = g_new(LdmModaliasKey, 1);
+
+                *stored = key;
+                bucket = g_array_new(FALSE, FALSE, sizeof(guint));
+                g_hash_table_insert(self->buckets, stored, bucket);
+        }
+        g_array_append_val(bucket, position);
+}
+
+/**
+ * ldm_modalias_index_add:
+ * @match: fnmatch style modalias match, which must outlive the index
+ * @data: Data to return from lookups matching @match
+ *
+ * Add a new match to the index.
+ */
+void ldm_modalias_index_add(LdmModaliasIndex *self, const gchar *match, gpointer data)
+{
+        ldm_modalias_index_add_full(self, match, data, NULL, 0);
+}
+
+/**
+ * ldm_modalias_index_add_full:
+ * @match: fnmatch style modalias match, which must remain valid until it is
+ *         removed from the index
+ * @data: Data to return from lookups matching @match
+ * @owner: (nullable): Owner of the match, for use with #ldm_modalias_index_remove_owner
+ * @priority: Priority of the match, higher priorities are returned first
+ *
+ * Add a new match to the index on behalf of @owner.
+ */
+void ldm_modalias_index_add_full(LdmModaliasIndex *self, const gchar *match, gpointer data,
+                                 gpointer owner, gint priority)
+{
+        LdmIndexEntry entry = {
+                .match = match,
+                .data = data,
+                .owner = owner,
+                .priority = priority,
+                .prefix_len = (guint)strcspn(match, "*?[\\"),
+                .removed = FALSE,
+        };
+
+        g_return_if_fail(self != NULL);
+        g_return_if_fail(match != NULL);
+
+        ldm_modalias_index_insert(self, &entry);
+}
+
+/**
+ * ldm_modalias_index_compact:
+ *
+ * Rebuild the index from the remaining entries, retaining their order.
+ */
+static void ldm_modalias_index_compact(LdmModaliasIndex *self)
+{
+        GArray *entries = self->entries;
+
+        self->entries = g_array_sized_new(FALSE,
+                                          FALSE,
+                                          sizeof(LdmIndexEntry),
+                                          entries->len - self->n_removed);
+        g_hash_table_remove_all(self->buckets);
+        ldm_modalias_matcher_free(self->wild);
+        self->wild = ldm_modalias_matcher_new();
+        g_hash_table_remove_all(self->wild_buses);
+        g_array_set_size(self->wild_unbound, 0);
+        self->n_removed = 0;
+
+        for (guint i = 0; i < entries->len; i++) {
+                const LdmIndexEntry *entry = &g_array_index(entries, LdmIndexEntry, i);
+                if (!entry->removed) {
+                        ldm_modalias_index_insert(self, entry);
+                }
+        }
+
+        g_array_unref(entries);
+}
+
+/**
+ * ldm_modalias_index_remove_owner:
+ * @owner: Owner passed to #ldm_modalias_index_add_full
+ *
+ * Remove every match added on behalf of @owner. The match strings of the
+ * owner are no longer used once this returns.
+ *
+ * Returns: The number of matches removed
+ */
+guint ldm_modalias_index_remove_owner(LdmModaliasIndex *self, gpointer owner)
+{
+        guint ret = 0;
+
+        g_return_val_if_fail(self != NULL, 0);
+
+        for (guint i = 0; i < self->entries->len; i++) {
+                LdmIndexEntry *entry = ENTRY(self, i);
+
+                if (entry->removed || entry->owner != owner) {
+                        continue;
+                }
+                entry->removed = TRUE;
+                entry->match = NULL;
+                ++ret;
+        }
+
+        self->n_removed += ret;
+        if (self->n_removed > 0 && self->n_removed >= self->entries->len / 2) {
+                ldm_modalias_index_compact(self);
+        }
+
+        return ret;
+}
+
+/**
+ * ldm_modalias_index_size:
+ *
+ * Returns: The number of matches within the index
+ */
+guint ldm_modalias_index_size(LdmModaliasIndex *self)
+{
+        g_return_val_if_fail(self != NULL, 0);
+
+        return self->entries->len - self->n_removed;
+}
+
+/**
+ * ldm_modalias_index_n_keys:
+ *
+ * Returns: The number of distinct keys used by the indexed matches
+ */
+guint ldm_modalias_index_n_keys(LdmModaliasIndex *self)
+{
+        g_return_val_if_fail(self != NULL, 0);
+
+        return g_hash_table_size(self->buckets);
+}
+
+/**
+ * ldm_modalias_index_set_eval_func:
+ * @func: (nullable): Function to call for every match tested by a lookup
+ *
+ * Profile all future lookups, timing the test of each match and reporting
+ * it to @func. This is considerably slower than a normal lookup, as matches
+ * without an exact key are then tested individually rather than through
+ * the matcher. Matches rejected by their bus or literal prefix alone are
+ * never tested, and so aren't reported.
+ */
+void ldm_modalias_index_set_eval_func(LdmModaliasIndex *self, LdmModaliasIndexEvalFunc func,
+                                      gpointer userdata)
+{
+        g_return_if_fail(self != NULL);
+
+        self->eval_func = func;
+        self->eval_data = userdata;
+}
+
+/**
+ * ldm_modalias_index_test_entry:
+ * @length: Length of @modalias
+ *
+ * Test a single match against the modalias, timing it when profiling
+ */
+static gboolean ldm_modalias_index_test_entry(LdmModaliasIndex *self, const LdmIndexEntry *entry,
+                                              const gchar *modalias, gsize length)
+{
+        gboolean ret = FALSE;
+        guint64 start = 0;
+
+        if (entry->prefix_len > length || memcmp(entry->match, modalias, entry->prefix_len) != 0) {
+                return FALSE;
+        }
+
+        if (!self->eval_func) {
+                return fnmatch(entry->match, modalias, 0) == 0;
+        }
+
+        start = ldm_get_monotonic_nanoseconds();
+        ret = fnmatch(entry->match, modalias, 0) == 0;
+        self->eval_func(entry->match,
+                        entry->owner,
+                        ret,
+                        ldm_get_monotonic_nanoseconds() - start,
+                        self->eval_data);
+
+        return ret;
+}
+
+/**
+ * ldm_modalias_index_test_bucket:
+ *
+ * Verify every match within the bucket against the modalias, as the key
+ * alone says nothing of the remaining fields.
+ */
+static void ldm_modalias_index_test_bucket(LdmModaliasIndex *self, GArray *bucket,
+                                           const gchar *modalias, gsize length)
+{
+        for (guint i = 0; i < bucket->len; i++) {
+                guint position = g_array_index(bucket, guint, i);
+                LdmIndexEntry *entry = ENTRY(self, position);
+
+                if (entry->removed) {
+                        continue;
+                }
+                if (ldm_modalias_index_test_entry(self, entry, modalias, length)) {
+                        g_array_append_val(self->hits, position);
+                }
+        }
+}
+
+/**
+ * ldm_modalias_index_test_wild:
+ *
+ * Test every match without an exact key individually, for profiling. Only
+ * those on the same bus as the modalias, or without a literal bus, can
+ * possibly match.
+ */
+static void ldm_modalias_index_test_wild(LdmModaliasIndex *self, const gchar *modalias,
+                                         gsize length)
+{
+        gchar bus[LDM_MODALIAS_BUS_MAX];
+        GArray *bucket = NULL;
+
+        if (ldm_modalias_index_get_bus(modalias, length, bus)) {
+                bucket = g_hash_table_lookup(self->wild_buses, bus);
+        }
+        if (bucket) {
+                ldm_modalias_index_test_bucket(self, bucket, modalias, length);
+        }
+        ldm_modalias_index_test_bucket(self, self->wild_unbound, modalias, length);
+}
+
+/**
+ * ldm_modalias_index_lookup:
+ * @modalias: Device modalias to look up
+ * @results: (nullable): Array to append the data of each matching entry to
+ *
+ * Find all matches within the index for the given device modalias, in order
+ * of descending priority and then the order in which they were added.
+ *
+ * Returns: TRUE if at least one match was found
+ */
+gboolean ldm_modalias_index_lookup(LdmModaliasIndex *self, const gchar *modalias,
+                                   GPtrArray *results)
+{
+        return ldm_modalias_index_lookup_full(self, modalias, results, NULL);
+}
+
+/**
+ * ldm_modalias_index_lookup_full:
+ * @modalias: Device modalias to look up
+ * @results: (nullable): Array to append the data of each matching entry to
+ * @owners: (nullable): Array to append the owner of each matching entry to
+ *
+ * As #ldm_modalias_index_lookup, additionally returning the owner of each
+ * match at the same position in @owners.
+ *
+ * Returns: TRUE if at least one match was found
+ */
+gboolean ldm_modalias_index_lookup_full(LdmModaliasIndex *self, const gchar *modalias,
+                                        GPtrArray *results, GPtrArray *owners)
+{
+        LdmModaliasKey key = { 0 };
+        gboolean ret = FALSE;
+        gsize length = 0;
+
+        g_return_val_if_fail(self != NULL, FALSE);
+        g_return_val_if_fail(modalias != NULL, FALSE);
+
+        g_array_set_size(self->hits, 0);
+        length = strlen(modalias);
+
+        if (ldm_modalias_parse_device_key(modalias, &key)) {
+                GArray *bucket = g_hash_table_lookup(self->buckets, &key);
+                if (bucket) {
+                        ldm_modalias_index_test_bucket(self, bucket, modalias, length);
+                }
+        } else if (key.bus != LDM_MODALIAS_BUS_NONE) {
+                /* Malformed modalias on a known bus: the key can't be trusted,
+                 * but the bus still can */
+                GHashTableIter iter = { 0 };
+                gpointer k = NULL, v = NULL;
+
+                g_hash_table_iter_init(&iter, self->buckets);
+                while (g_hash_table_iter_next(&iter, &k, &v)) {
+                        if (((LdmModaliasKey *)k)->bus == key.bus) {
+                                ldm_modalias_index_test_bucket(self, v, modalias, length);
+                        }
+                }
+        }
+
+        g_ptr_array_set_size(self->wild_hits, 0);
+        if (self->eval_func) {
+                /* Profiling needs the cost of each match, not the matcher */
+                ldm_modalias_index_test_wild(self, modalias, length);
+        } else if (ldm_modalias_matcher_size(self->wild) > 0 &&
+                   ldm_modalias_matcher_match(self->wild, modalias, self->wild_hits)) {
+                for (guint i = 0; i < self->wild_hits->len; i++) {
+                        guint position = GPOINTER_TO_UINT(self->wild_hits->pdata[i]) - 1;
+                        if (!ENTRY(self, position)->removed) {
+                                g_array_append_val(self->hits, position);
+                        }
+                }
+        }
+
+        ret = self->hits->len > 0;
+        if (!ret || (!results && !owners)) {
+                return ret;
+        }
+
+        g_array_sort_with_data(self->hits, ldm_modalias_index_sort_hits, self);
+        for (guint i = 0; i < self->hits->len; i++) {
+                LdmIndexEntry *entry = ENTRY(self, g_array_index(self->hits, guint, i));
+
+                if (results) {
+                        g_ptr_array_add(results, entry->data);
+                }
+                if (owners) {
+                        g_ptr_array_add(owners, entry->owner);
+                }
+        }
+
+        return ret;
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
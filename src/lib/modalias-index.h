@@ -0,0 +1,71 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Linux Driver Management Developers, Solus Project
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+#include "util.h"
+
+G_BEGIN_DECLS
+
+/*
+ * LdmModaliasIndex
+ *
+ * Private helper indexing modalias matches on the exact bus, vendor and
+ * device/product of the `pci:`, `usb:` and `hid:` grammars. A lookup then
+ * only has to verify the handful of rules sharing the device's key, with
+ * any rule wildcarding those fields kept in a #LdmModaliasMatcher instead.
+ *
+ * Matches may be tagged with an owner and priority, allowing the rules of
+ * many plugins to be merged into one index and replaced independently.
+ */
+typedef struct _LdmModaliasIndex LdmModaliasIndex;
+
+/*
+ * Called for every match tested against a modalias while profiling, with
+ * the outcome and the time taken by the test
+ */
+typedef void (*LdmModaliasIndexEvalFunc)(const gchar *match, gpointer owner, gboolean matched,
+                                         guint64 nanoseconds, gpointer userdata);
+
+LdmModaliasIndex *ldm_modalias_index_new(void);
+void ldm_modalias_index_free(LdmModaliasIndex *index);
+
+void ldm_modalias_index_add(LdmModaliasIndex *index, const gchar *match, gpointer data);
+void ldm_modalias_index_add_full(LdmModaliasIndex *index, const gchar *match, gpointer data,
+                                 gpointer owner, gint priority);
+guint ldm_modalias_index_remove_owner(LdmModaliasIndex *index, gpointer owner);
+guint ldm_modalias_index_size(LdmModaliasIndex *index);
+guint ldm_modalias_index_n_keys(LdmModaliasIndex *index);
+void ldm_modalias_index_set_eval_func(LdmModaliasIndex *index, LdmModaliasIndexEvalFunc func,
+                                      gpointer userdata);
+gboolean ldm_modalias_index_lookup(LdmModaliasIndex *index, const gchar *modalias,
+                                   GPtrArray *results);
+gboolean ldm_modalias_index_lookup_full(LdmModaliasIndex *index, const gchar *modalias,
+                                        GPtrArray *results, GPtrArray *owners);
+
+DEF_AUTOFREE(LdmModaliasIndex, ldm_modalias_index_free)
+
+G_END_DECLS
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
@@ -0,0 +1,116 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Linux Driver Management Developers, Solus Project
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#include "modalias-loader.h"
+#include "plugins/modalias-plugin.h"
+
+/*
+ * Shared between the workers, each of which only writes to its own slot
+ */
+typedef struct LdmModaliasLoader {
+        gchar **paths;
+        GPtrArray *plugins;
+} LdmModaliasLoader;
+
+/**
+ * ldm_modalias_loader_load_one:
+ *
+ * Load the plugin for a single path into its slot
+ */
+static void ldm_modalias_loader_load_one(LdmModaliasLoader *loader, guint index)
+{
+        LdmPlugin *plugin = NULL;
+
+        plugin = ldm_modalias_plugin_new_from_filename(loader->paths[index]);
+        if (plugin) {
+                loader->plugins->pdata[index] = g_object_ref_sink(plugin);
+        }
+}
+
+static void ldm_modalias_loader_free_plugin(gpointer v)
+{
+        if (v) {
+                g_object_unref(v);
+        }
+}
+
+static void ldm_modalias_loader_worker(gpointer data, gpointer userdata)
+{
+        ldm_modalias_loader_load_one(userdata, GPOINTER_TO_UINT(data) - 1);
+}
+
+/**
+ * ldm_modalias_loader_load:
+ * @paths: Paths to `.modaliases` files
+ * @n_paths: Number of paths
+ * @n_threads: Maximum number of threads to use, or 0 for one per processor
+ *
+ * Construct a new #LdmModaliasPlugin for each of the paths, spreading the
+ * work across multiple threads. Regardless of the order in which the files
+ * are loaded, the returned plugins are in the same order as @paths.
+ *
+ * Returns: (transfer full): Array of new plugins, with NULL in place of any
+ * that couldn't be loaded
+ */
+GPtrArray *ldm_modalias_loader_load(gchar **paths, guint n_paths, guint n_threads)
+{
+        LdmModaliasLoader loader = { 0 };
+        GThreadPool *pool = NULL;
+
+        g_return_val_if_fail(paths != NULL || n_paths == 0, NULL);
+
+        loader.paths = paths;
+        loader.plugins = g_ptr_array_new_full(n_paths, ldm_modalias_loader_free_plugin);
+        g_ptr_array_set_size(loader.plugins, (gint)n_paths);
+
+        if (n_threads == 0) {
+                n_threads = g_get_num_processors();
+        }
+        n_threads = MIN(n_threads, n_paths);
+
+        /* Not worth spinning up threads */
+        if (n_threads < 2) {
+                for (guint i = 0; i < n_paths; i++) {
+                        ldm_modalias_loader_load_one(&loader, i);
+                }
+                return loader.plugins;
+        }
+
+        pool = g_thread_pool_new(ldm_modalias_loader_worker, &loader, (gint)n_threads, TRUE, NULL);
+        if (!pool) {
+                for (guint i = 0; i < n_paths; i++) {
+                        ldm_modalias_loader_load_one(&loader, i);
+                }
+                return loader.plugins;
+        }
+
+        for (guint i = 0; i < n_paths; i++) {
+                g_thread_pool_push(pool, GUINT_TO_POINTER(i + 1), NULL);
+        }
+
+        /* Wait for every file to be loaded */
+        g_thread_pool_free(pool, FALSE, TRUE);
+
+        return loader.plugins;
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
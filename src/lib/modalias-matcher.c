@@ -0,0 +1,402 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Linux Driver Management Developers, Solus Project
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+
+#include <fnmatch.h>
+#include <string.h>
+
+#include "modalias-matcher.h"
+
+/*
+ * Each pattern is broken into a sequence of tokens (literal character, `?`
+ * or `*`) and inserted into a shared trie, so that every pattern sharing a
+ * prefix such as `pci:v000010DEd0000` is only ever walked once.
+ *
+ * Patterns using bracket expressions are rare in modalias files and are
+ * kept aside to be tested with fnmatch() directly, preserving the exact
+ * semantics of #ldm_modalias_matches for every pattern.
+ */
+typedef enum {
+        LDM_MATCHER_NODE_ROOT = 0,
+        LDM_MATCHER_NODE_LITERAL,
+        LDM_MATCHER_NODE_ANY,
+        LDM_MATCHER_NODE_STAR,
+} LdmMatcherNodeKind;
+
+typedef struct LdmMatcherNode {
+        guint32 child;    /* First child node, 0 if none */
+        guint32 sibling;  /* Next sibling node, 0 if none */
+        guint32 terminal; /* First entry (+1) ending at this node */
+
+        /* Star nodes only: earliest position walked in the current match */
+        guint32 seen_generation;
+        guint32 seen_pos;
+
+        guint8 kind;
+        gchar label;
+} LdmMatcherNode;
+
+typedef struct LdmMatcherEntry {
+        gpointer data;
+        gchar *pattern;     /* Only retained for the fnmatch fallback */
+        guint32 prefix_len; /* Literal characters leading the fallback pattern */
+        guint32 next;       /* Next entry (+1) ending on the same node */
+} LdmMatcherEntry;
+
+struct _LdmModaliasMatcher {
+        GArray *nodes;    /* LdmMatcherNode, root is always index 0 */
+        GArray *entries;  /* LdmMatcherEntry, in insertion order */
+        GArray *fallback; /* Indices into entries requiring fnmatch() */
+        GArray *hits;     /* Scratch space reused between matches */
+        guint32 generation;
+};
+
+typedef struct LdmMatcherWalk {
+        LdmModaliasMatcher *self;
+        const gchar *string;
+        guint32 len;
+} LdmMatcherWalk;
+
+#define NODE(s, i) (&g_array_index((s)->nodes, LdmMatcherNode, (i)))
+#define ENTRY(s, i) (&g_array_index((s)->entries, LdmMatcherEntry, (i)))
+
+static void ldm_modalias_matcher_entry_clear(gpointer v)
+{
+        LdmMatcherEntry *entry = v;
+
+        g_clear_pointer(&entry->pattern, g_free);
+}
+
+/**
+ * ldm_modalias_matcher_new:
+ *
+ * Construct a new, empty matcher
+ */
+LdmModaliasMatcher *ldm_modalias_matcher_new(void)
+{
+        LdmModaliasMatcher *self = NULL;
+        LdmMatcherNode root = { 0 };
+
+        self = g_new0(LdmModaliasMatcher, 1);
+        self->nodes = g_array_new(FALSE, FALSE, sizeof(LdmMatcherNode));
+        self->entries = g_array_new(FALSE, FALSE, sizeof(LdmMatcherEntry));
+        g_array_set_clear_func(self->entries, ldm_modalias_matcher_entry_clear);
+        self->fallback = g_array_new(FALSE, FALSE, sizeof(guint32));
+        self->hits = g_array_new(FALSE, FALSE, sizeof(guint32));
+
+        root.kind = LDM_MATCHER_NODE_ROOT;
+        g_array_append_val(self->nodes, root);
+
+        return self;
+}
+
+/**
+ * ldm_modalias_matcher_free:
+ *
+ * Free a previously allocated matcher
+ */
+void ldm_modalias_matcher_free(LdmModaliasMatcher *self)
+{
+        if (!self) {
+                return;
+        }
+        g_array_unref(self->nodes);
+        g_array_unref(self->entries);
+        g_array_unref(self->fallback);
+        g_array_unref(self->hits);
+        g_free(self);
+}
+
+/**
+ * ldm_modalias_matcher_get_child:
+ *
+ * Find or create the child of parent_id with the given kind and label
+ */
+static guint32 ldm_modalias_matcher_get_child(LdmModaliasMatcher *self, guint32 parent_id,
+                                              LdmMatcherNodeKind kind, gchar label)
+{
+        LdmMatcherNode node = { 0 };
+        guint32 child_id = 0;
+
+        for (child_id = NODE(self, parent_id)->child; child_id != 0;
+             child_id = NODE(self, child_id)->sibling) {
+                LdmMatcherNode *child = NODE(self, child_id);
+
+                if (child->kind == kind && child->label == label) {
+                        return child_id;
+                }
+        }
+
+        node.kind = (guint8)kind;
+        node.label = label;
+        node.sibling = NODE(self, parent_id)->child;
+        g_array_append_val(self->nodes, node);
+
+        child_id = self->nodes->len - 1;
+        NODE(self, parent_id)->child = child_id;
+
+        return child_id;
+}
+
+/**
+ * ldm_modalias_matcher_can_compile:
+ *
+ * Bracket expressions and dangling escapes are left to fnmatch()
+ */
+static gboolean ldm_modalias_matcher_can_compile(const gchar *pattern)
+{
+        for (const gchar *c = pattern; *c; c++) {
+                if (*c == '[') {
+                        return FALSE;
+                }
+                if (*c == '\\' && *(++c) == '\0') {
+                        return FALSE;
+                }
+        }
+        return TRUE;
+}
+
+/**
+ * ldm_modalias_matcher_add:
+ * @pattern: fnmatch style pattern to compile
+ * @data: Opaque data returned when the pattern matches
+ *
+ * Compile a new pattern into the matcher. The same pattern may be added
+ * more than once with differing data.
+ */
+void ldm_modalias_matcher_add(LdmModaliasMatcher *self, const gchar *pattern, gpointer data)
+{
+        LdmMatcherEntry entry = { 0 };
+        guint32 entry_id = 0;
+        guint32 node_id = 0;
+
+        g_return_if_fail(self != NULL);
+        g_return_if_fail(pattern != NULL);
+
+        entry.data = data;
+        entry_id = self->entries->len;
+
+        if (!ldm_modalias_matcher_can_compile(pattern)) {
+                entry.pattern = g_strdup(pattern);
+                entry.prefix_len = (guint32)strcspn(pattern, "*?[\\");
+                g_array_append_val(self->entries, entry);
+                g_array_append_val(self->fallback, entry_id);
+                return;
+        }
+
+        for (const gchar *c = pattern; *c; c++) {
+                switch (*c) {
+                case '*':
+                        /* Consecutive stars are equivalent to a single star */
+                        if (NODE(self, node_id)->kind == LDM_MATCHER_NODE_STAR) {
+                                continue;
+                        }
+                        node_id =
+                            ldm_modalias_matcher_get_child(self, node_id, LDM_MATCHER_NODE_STAR, 0);
+                        break;
+                case '?':
+                        node_id =
+                            ldm_modalias_matcher_get_child(self, node_id, LDM_MATCHER_NODE_ANY, 0);
+                        break;
+                default:
+                        /* Escaped characters are always literal */
+                        if (*c == '\\') {
+                                ++c;
+                        }
+                        node_id = ldm_modalias_matcher_get_child(self,
+                                                                 node_id,
+                                                                 LDM_MATCHER_NODE_LITERAL,
+                                                                 *c);
+                        break;
+                }
+        }
+
+        entry.next = NODE(self, node_id)->terminal;
+        g_array_append_val(self->entries, entry);
+        NODE(self, node_id)->terminal = entry_id + 1;
+}
+
+/**
+ * ldm_modalias_matcher_size:
+ *
+ * Returns: The number of patterns added to this matcher
+ */
+guint ldm_modalias_matcher_size(LdmModaliasMatcher *self)
+{
+        g_return_val_if_fail(self != NULL, 0);
+        return self->entries->len;
+}
+
+static void ldm_modalias_matcher_walk_star(LdmMatcherWalk *walk, guint32 star_id, guint32 pos);
+
+/**
+ * ldm_modalias_matcher_walk:
+ *
+ * Consume the string from pos onwards against the children of node_id
+ */
+static void ldm_modalias_matcher_walk(LdmMatcherWalk *walk, guint32 node_id, guint32 pos)
+{
+        LdmModaliasMatcher *self = walk->self;
+        guint32 child_id = 0;
+
+        /* String consumed, record all patterns ending here */
+        if (pos == walk->len) {
+                guint32 entry_id = NODE(self, node_id)->terminal;
+
+                while (entry_id != 0) {
+                        guint32 hit = entry_id - 1;
+
+                        g_array_append_val(self->hits, hit);
+                        entry_id = ENTRY(self, hit)->next;
+                }
+        }
+
+        for (child_id = NODE(self, node_id)->child; child_id != 0;
+             child_id = NODE(self, child_id)->sibling) {
+                LdmMatcherNode *child = NODE(self, child_id);
+
+                switch (child->kind) {
+                case LDM_MATCHER_NODE_LITERAL:
+                        if (pos < walk->len && walk->string[pos] == child->label) {
+                                ldm_modalias_matcher_walk(walk, child_id, pos + 1);
+                        }
+                        break;
+                case LDM_MATCHER_NODE_ANY:
+                        if (pos < walk->len) {
+                                ldm_modalias_matcher_walk(walk, child_id, pos + 1);
+                        }
+                        break;
+                case LDM_MATCHER_NODE_STAR:
+                        ldm_modalias_matcher_walk_star(walk, child_id, pos);
+                        break;
+                default:
+                        g_assert_not_reached();
+                }
+        }
+}
+
+/**
+ * ldm_modalias_matcher_walk_star:
+ *
+ * A star may consume any number of characters. Each star node remembers the
+ * earliest position it has been walked from during this match, as everything
+ * from that position onwards has already been visited. This bounds a match to
+ * O(nodes * length) and ensures each pattern is reported at most once.
+ */
+static void ldm_modalias_matcher_walk_star(LdmMatcherWalk *walk, guint32 star_id, guint32 pos)
+{
+        LdmModaliasMatcher *self = walk->self;
+        LdmMatcherNode *star = NODE(self, star_id);
+        guint32 end = walk->len;
+
+        if (star->seen_generation == self->generation) {
+                if (pos >= star->seen_pos) {
+                        return;
+                }
+                end = star->seen_pos - 1;
+        }
+
+        star->seen_generation = self->generation;
+        star->seen_pos = pos;
+
+        for (guint32 i = pos; i <= end; i++) {
+                ldm_modalias_matcher_walk(walk, star_id, i);
+        }
+}
+
+static gint ldm_modalias_matcher_sort_hits(gconstpointer a, gconstpointer b)
+{
+        guint32 hitA = *(const guint32 *)a;
+        guint32 hitB = *(const guint32 *)b;
+
+        return hitA < hitB ? -1 : (hitA > hitB ? 1 : 0);
+}
+
+/**
+ * ldm_modalias_matcher_match:
+ * @string: Device modalias to test
+ * @results: (nullable): Array to append the data of each matching pattern to
+ *
+ * Test the string against all compiled patterns at once. Matching data is
+ * appended to results in the order the patterns were added, with the same
+ * semantics as calling fnmatch() on each pattern in turn.
+ *
+ * The matcher keeps scratch state between calls, so concurrent matching
+ * on the same instance is not supported.
+ *
+ * Returns: TRUE if any pattern matched the string
+ */
+gboolean ldm_modalias_matcher_match(LdmModaliasMatcher *self, const gchar *string,
+                                    GPtrArray *results)
+{
+        LdmMatcherWalk walk = { 0 };
+        gboolean ret = FALSE;
+
+        g_return_val_if_fail(self != NULL, FALSE);
+        g_return_val_if_fail(string != NULL, FALSE);
+
+        /* Invalidate the star markers from any previous match */
+        if (++self->generation == 0) {
+                for (guint i = 0; i < self->nodes->len; i++) {
+                        NODE(self, i)->seen_generation = 0;
+                }
+                self->generation = 1;
+        }
+
+        walk.self = self;
+        walk.string = string;
+        walk.len = (guint32)strlen(string);
+
+        g_array_set_size(self->hits, 0);
+        ldm_modalias_matcher_walk(&walk, 0, 0);
+
+        /* Patterns the trie can't hold are rejected on their literal prefix
+         * before resorting to fnmatch() */
+        for (guint i = 0; i < self->fallback->len; i++) {
+                guint32 hit = g_array_index(self->fallback, guint32, i);
+                LdmMatcherEntry *entry = ENTRY(self, hit);
+
+                if (entry->prefix_len > walk.len ||
+                    memcmp(entry->pattern, string, entry->prefix_len) != 0) {
+                        continue;
+                }
+                if (fnmatch(entry->pattern, string, 0) == 0) {
+                        g_array_append_val(self->hits, hit);
+                }
+        }
+
+        ret = self->hits->len > 0;
+        if (!ret || !results) {
+                return ret;
+        }
+
+        g_array_sort(self->hits, ldm_modalias_matcher_sort_hits);
+        for (guint i = 0; i < self->hits->len; i++) {
+                guint32 hit = g_array_index(self->hits, guint32, i);
+                g_ptr_array_add(results, ENTRY(self, hit)->data);
+        }
+
+        return ret;
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
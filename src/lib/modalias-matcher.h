@@ -0,0 +1,52 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Linux Driver Management Developers, Solus Project
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+#include "util.h"
+
+G_BEGIN_DECLS
+
+/*
+ * LdmModaliasMatcher
+ *
+ * Private helper which compiles a set of `fnmatch` style modalias patterns
+ * into a single trie, allowing a modalias string to be tested against every
+ * pattern in one pass.
+ */
+typedef struct _LdmModaliasMatcher LdmModaliasMatcher;
+
+LdmModaliasMatcher *ldm_modalias_matcher_new(void);
+void ldm_modalias_matcher_free(LdmModaliasMatcher *matcher);
+
+void ldm_modalias_matcher_add(LdmModaliasMatcher *matcher, const gchar *pattern, gpointer data);
+guint ldm_modalias_matcher_size(LdmModaliasMatcher *matcher);
+gboolean ldm_modalias_matcher_match(LdmModaliasMatcher *matcher, const gchar *string,
+                                    GPtrArray *results);
+
+DEF_AUTOFREE(LdmModaliasMatcher, ldm_modalias_matcher_free)
+
+G_END_DECLS
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
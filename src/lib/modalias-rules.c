@@ -0,0 +1,338 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Linux Driver Management Developers, Solus Project
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+
+#include "ldm-private.h"
+#include "modalias-rules.h"
+
+/* Block size for the strings of rules added after loading */
+#define LDM_MODALIAS_RULES_CHUNK_SIZE 4096
+
+struct _LdmModaliasRules {
+        gchar *strings;         /* Every match, and each distinct driver and package */
+        GStringChunk *added;    /* Strings of rules added later, NULL until needed */
+        LdmModaliasRule *rules; /* Pointing into strings or added */
+        guint n_rules;
+        guint n_allocated;
+        GHashTable *positions; /* Match -> rule position + 1, NULL until needed */
+};
+
+/*
+ * State used while the file contents are being split
+ */
+typedef struct LdmModaliasRulesParser {
+        GArray *rules;    /* LdmModaliasRule, pointing into the file contents */
+        GHashTable *seen; /* Match -> rule position + 1 */
+} LdmModaliasRulesParser;
+
+/**
+ * ldm_modalias_rules_parse_rule:
+ *
+ * Add a rule as it is parsed. As with #LdmModaliasPlugin, a repeated match
+ * replaces the earlier rule, but keeps its position.
+ */
+static void ldm_modalias_rules_parse_rule(const gchar *match, const gchar *driver,
+                                          const gchar *package, gpointer userdata)
+{
+        LdmModaliasRulesParser *parser = userdata;
+        LdmModaliasRule rule = {
+                .match = match,
+                .driver = driver,
+                .package = package,
+        };
+        guint position = 0;
+
+        /* Consecutive rules almost always share their names, so share the
+         * pointers too, allowing compaction to skip looking them up. */
+        if (parser->rules->len > 0) {
+                const LdmModaliasRule *last =
+                    &g_array_index(parser->rules, LdmModaliasRule, parser->rules->len - 1);
+
+                if (g_str_equal(last->driver, driver)) {
+                        rule.driver = last->driver;
+                }
+                if (g_str_equal(last->package, package)) {
+                        rule.package = last->package;
+                }
+        }
+
+        position = GPOINTER_TO_UINT(g_hash_table_lookup(parser->seen, match));
+        if (position > 0) {
+                g_array_index(parser->rules, LdmModaliasRule, position - 1) = rule;
+                return;
+        }
+
+        g_array_append_val(parser->rules, rule);
+        g_hash_table_insert(parser->seen, (gpointer)match, GUINT_TO_POINTER(parser->rules->len));
+}
+
+/**
+ * ldm_modalias_rules_intern:
+ *
+ * Copy a driver or package name into the string storage, unless it is
+ * already there.
+ */
+static const gchar *ldm_modalias_rules_intern(GHashTable *names, const gchar *name, gchar **cursor)
+{
+        gchar *ret = g_hash_table_lookup(names, name);
+
+        if (ret) {
+                return ret;
+        }
+
+        ret = *cursor;
+        *cursor = g_stpcpy(ret, name) + 1;
+        g_hash_table_insert(names, (gpointer)name, ret);
+
+        return ret;
+}
+
+/**
+ * ldm_modalias_rules_compact:
+ *
+ * Move the parsed rules out of the file contents and into our own exactly
+ * sized storage. Only the match is unique to each rule: the driver and
+ * package are stored once, as a file typically names just a handful of them
+ * across every rule.
+ */
+static void ldm_modalias_rules_compact(LdmModaliasRules *self, GArray *parsed)
+{
+        g_autoptr(GHashTable) names = NULL;
+        gchar *cursor = NULL;
+        gsize size = 0;
+
+        names = g_hash_table_new(g_str_hash, g_str_equal);
+
+        /* Find out how much storage we need */
+        for (guint i = 0; i < parsed->len; i++) {
+                const LdmModaliasRule *rule = &g_array_index(parsed, LdmModaliasRule, i);
+                const LdmModaliasRule *last = i > 0 ? rule - 1 : NULL;
+
+                size += strlen(rule->match) + 1;
+                if ((!last || last->driver != rule->driver) &&
+                    g_hash_table_add(names, (gpointer)rule->driver)) {
+                        size += strlen(rule->driver) + 1;
+                }
+                if ((!last || last->package != rule->package) &&
+                    g_hash_table_add(names, (gpointer)rule->package)) {
+                        size += strlen(rule->package) + 1;
+                }
+        }
+        g_hash_table_remove_all(names);
+
+        self->strings = g_malloc(MAX(size, 1));
+        self->rules = g_new(LdmModaliasRule, parsed->len);
+        self->n_rules = parsed->len;
+        self->n_allocated = parsed->len;
+
+        cursor = self->strings;
+        for (guint i = 0; i < parsed->len; i++) {
+                const LdmModaliasRule *rule = &g_array_index(parsed, LdmModaliasRule, i);
+                const LdmModaliasRule *last = i > 0 ? rule - 1 : NULL;
+
+                self->rules[i].match = cursor;
+                cursor = g_stpcpy(cursor, rule->match) + 1;
+
+                if (last && last->driver == rule->driver) {
+                        self->rules[i].driver = self->rules[i - 1].driver;
+                } else {
+                        self->rules[i].driver =
+                            ldm_modalias_rules_intern(names, rule->driver, &cursor);
+                }
+                if (last && last->package == rule->package) {
+                        self->rules[i].package = self->rules[i - 1].package;
+                } else {
+                        self->rules[i].package =
+                            ldm_modalias_rules_intern(names, rule->package, &cursor);
+                }
+        }
+}
+
+/**
+ * ldm_modalias_rules_new:
+ *
+ * Construct a new, empty, set of rules
+ */
+LdmModaliasRules *ldm_modalias_rules_new(void)
+{
+        return g_new0(LdmModaliasRules, 1);
+}
+
+/**
+ * ldm_modalias_rules_new_from_file:
+ * @filename: Path to a `.modaliases` file
+ *
+ * Read every rule from the given file
+ *
+ * Returns: A new set of rules, or NULL if the file couldn't be read
+ */
+LdmModaliasRules *ldm_modalias_rules_new_from_file(const gchar *filename)
+{
+        LdmModaliasRules *self = NULL;
+        LdmModaliasRulesParser parser = { 0 };
+        g_autofree gchar *contents = NULL;
+
+        g_return_val_if_fail(filename != NULL, NULL);
+
+        contents = ldm_modalias_read_file(filename);
+        if (!contents) {
+                return NULL;
+        }
+
+        parser.rules = g_array_new(FALSE, FALSE, sizeof(LdmModaliasRule));
+        parser.seen = g_hash_table_new(g_str_hash, g_str_equal);
+
+        ldm_modalias_parse_data(contents, ldm_modalias_rules_parse_rule, &parser);
+
+        self = g_new0(LdmModaliasRules, 1);
+        ldm_modalias_rules_compact(self, parser.rules);
+
+        g_hash_table_unref(parser.seen);
+        g_array_unref(parser.rules);
+
+        return self;
+}
+
+/**
+ * ldm_modalias_rules_free:
+ *
+ * Free a previously allocated set of rules, and the strings they point to
+ */
+void ldm_modalias_rules_free(LdmModaliasRules *self)
+{
+        if (!self) {
+                return;
+        }
+        g_clear_pointer(&self->positions, g_hash_table_unref);
+        g_clear_pointer(&self->added, g_string_chunk_free);
+        g_free(self->rules);
+        g_free(self->strings);
+        g_free(self);
+}
+
+/**
+ * ldm_modalias_rules_get_positions:
+ *
+ * Return the position of every match, building the table on first use as
+ * the rules of most files are never added to.
+ */
+static GHashTable *ldm_modalias_rules_get_positions(LdmModaliasRules *self)
+{
+        if (self->positions) {
+                return self->positions;
+        }
+
+        self->positions = g_hash_table_new(g_str_hash, g_str_equal);
+        for (guint i = 0; i < self->n_rules; i++) {
+                g_hash_table_insert(self->positions,
+                                    (gpointer)self->rules[i].match,
+                                    GUINT_TO_POINTER(i + 1));
+        }
+
+        return self->positions;
+}
+
+/**
+ * ldm_modalias_rules_intern_added:
+ *
+ * Store a driver or package name for an added rule, sharing any earlier copy
+ */
+static const gchar *ldm_modalias_rules_intern_added(LdmModaliasRules *self, const gchar *name)
+{
+        return name ? g_string_chunk_insert_const(self->added, name) : NULL;
+}
+
+/**
+ * ldm_modalias_rules_add:
+ * @match: fnmatch style modalias match
+ * @driver: (nullable): Kernel driver for the match
+ * @package: (nullable): Package providing @driver
+ *
+ * Copy a new rule into the set. A rule with the same match is replaced,
+ * keeping its position, and the strings of both remain valid until the set
+ * is freed.
+ */
+void ldm_modalias_rules_add(LdmModaliasRules *self, const gchar *match, const gchar *driver,
+                            const gchar *package)
+{
+        LdmModaliasRule rule = { 0 };
+        GHashTable *positions = NULL;
+        guint position = 0;
+
+        g_return_if_fail(self != NULL);
+        g_return_if_fail(match != NULL);
+
+        if (!self->added) {
+                self->added = g_string_chunk_new(LDM_MODALIAS_RULES_CHUNK_SIZE);
+        }
+
+        rule.match = g_string_chunk_insert(self->added, match);
+        rule.driver = ldm_modalias_rules_intern_added(self, driver);
+        rule.package = ldm_modalias_rules_intern_added(self, package);
+
+        positions = ldm_modalias_rules_get_positions(self);
+        position = GPOINTER_TO_UINT(g_hash_table_lookup(positions, match));
+        if (position > 0) {
+                self->rules[position - 1] = rule;
+                return;
+        }
+
+        if (self->n_rules == self->n_allocated) {
+                self->n_allocated = MAX(self->n_allocated * 2, 16);
+                self->rules = g_renew(LdmModaliasRule, self->rules, self->n_allocated);
+        }
+
+        self->rules[self->n_rules] = rule;
+        ++self->n_rules;
+        g_hash_table_insert(positions, (gpointer)rule.match, GUINT_TO_POINTER(self->n_rules));
+}
+
+/**
+ * ldm_modalias_rules_size:
+ *
+ * Returns: The number of rules in the set
+ */
+guint ldm_modalias_rules_size(LdmModaliasRules *self)
+{
+        g_return_val_if_fail(self != NULL, 0);
+
+        return self->n_rules;
+}
+
+/**
+ * ldm_modalias_rules_get:
+ * @index: Position of the rule, in file order
+ *
+ * Returns: (transfer none): The rule at the given position
+ */
+const LdmModaliasRule *ldm_modalias_rules_get(LdmModaliasRules *self, guint index)
+{
+        g_return_val_if_fail(self != NULL, NULL);
+        g_return_val_if_fail(index < self->n_rules, NULL);
+
+        return &self->rules[index];
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
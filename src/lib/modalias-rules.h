@@ -0,0 +1,68 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Linux Driver Management Developers, Solus Project
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+
+#pragma once
+
+#include <glib.h>
+
+#include "util.h"
+
+G_BEGIN_DECLS
+
+/*
+ * A single `alias` line of a modaliases file
+ */
+typedef struct LdmModaliasRule {
+        const gchar *match;
+        const gchar *driver;
+        const gchar *package;
+} LdmModaliasRule;
+
+/*
+ * LdmModaliasRules
+ *
+ * Private helper holding modalias rules as plain structs in a flat array,
+ * in place of one #LdmModalias object per rule.
+ *
+ * A `.modaliases` file is read in one go and split in place, after which the
+ * strings of every rule are packed into shared storage holding each
+ * distinct driver and package name only once. Rules added later are copied
+ * into storage of their own.
+ */
+typedef struct _LdmModaliasRules LdmModaliasRules;
+
+LdmModaliasRules *ldm_modalias_rules_new(void);
+LdmModaliasRules *ldm_modalias_rules_new_from_file(const gchar *filename);
+void ldm_modalias_rules_free(LdmModaliasRules *rules);
+
+void ldm_modalias_rules_add(LdmModaliasRules *rules, const gchar *match, const gchar *driver,
+                            const gchar *package);
+
+guint ldm_modalias_rules_size(LdmModaliasRules *rules);
+const LdmModaliasRule *ldm_modalias_rules_get(LdmModaliasRules *rules, guint index);
+
+DEF_AUTOFREE(LdmModaliasRules, ldm_modalias_rules_free)
+
+G_END_DECLS
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
@@ -0,0 +1,115 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Linux Driver Management Developers, Solus Project
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+
+#include "ldm-private.h"
+#include "modalias-vendors.h"
+
+/**
+ * ldm_modalias_vendors_get_bit:
+ *
+ * Spread the bus and vendor across the bitset, as vendor IDs of different
+ * buses tend to share their low bits.
+ */
+static guint ldm_modalias_vendors_get_bit(const LdmModaliasKey *key)
+{
+        guint32 hash = (key->vendor * 31u + key->bus) * 2654435761u;
+
+        return hash % LDM_MODALIAS_VENDORS_BITS;
+}
+
+/**
+ * ldm_modalias_vendors_init:
+ *
+ * Reset the set to accept nothing at all
+ */
+void ldm_modalias_vendors_init(LdmModaliasVendors *self)
+{
+        memset(self, 0, sizeof(LdmModaliasVendors));
+}
+
+/**
+ * ldm_modalias_vendors_add_match:
+ * @match: An fnmatch style modalias match
+ *
+ * Accept every modalias with the same bus and vendor as the match
+ */
+void ldm_modalias_vendors_add_match(LdmModaliasVendors *self, const gchar *match)
+{
+        LdmModaliasKey key = { 0 };
+        guint bit = 0;
+
+        if (!ldm_modalias_parse_match_vendor(match, &key)) {
+                self->any = TRUE;
+                return;
+        }
+
+        bit = ldm_modalias_vendors_get_bit(&key);
+        self->bits[bit / 64] |= G_GUINT64_CONSTANT(1) << (bit % 64);
+}
+
+/**
+ * ldm_modalias_vendors_merge:
+ *
+ * Accept everything that the other set accepts, too
+ */
+void ldm_modalias_vendors_merge(LdmModaliasVendors *self, const LdmModaliasVendors *other)
+{
+        for (guint i = 0; i < G_N_ELEMENTS(self->bits); i++) {
+                self->bits[i] |= other->bits[i];
+        }
+        self->any |= other->any;
+}
+
+/**
+ * ldm_modalias_vendors_accepts:
+ * @modalias: A device modalias as set by the kernel
+ *
+ * Determine whether any rule in the set could match the modalias. Rules
+ * always fix their bus when they fix their vendor, so a modalias on a bus
+ * we can't parse can only be matched by rules that don't. A malformed
+ * modalias on a known bus is always accepted, as its vendor can't be
+ * trusted.
+ *
+ * Returns: FALSE if no rule in the set can match the modalias
+ */
+gboolean ldm_modalias_vendors_accepts(const LdmModaliasVendors *self, const gchar *modalias)
+{
+        LdmModaliasKey key = { 0 };
+        guint bit = 0;
+
+        if (self->any) {
+                return TRUE;
+        }
+
+        if (!ldm_modalias_parse_device_key(modalias, &key)) {
+                return key.bus != LDM_MODALIAS_BUS_NONE;
+        }
+
+        bit = ldm_modalias_vendors_get_bit(&key);
+        return (self->bits[bit / 64] & (G_GUINT64_CONSTANT(1) << (bit % 64))) != 0;
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
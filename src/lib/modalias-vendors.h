@@ -0,0 +1,54 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Linux Driver Management Developers, Solus Project
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define LDM_MODALIAS_VENDORS_BITS 1024
+
+/*
+ * LdmModaliasVendors
+ *
+ * Private helper recording the bus and vendor of every rule in a set, as
+ * a single hash bitset. Device modaliases whose vendor isn't in the set
+ * can then be rejected without testing any of the rules.
+ *
+ * Distinct vendors may share a bit, so a modalias that is accepted might
+ * still match no rule. A rule that doesn't fix its vendor, i.e.
+ * `pci:v*d00001C60*`, makes the set accept every modalias.
+ */
+typedef struct LdmModaliasVendors {
+        guint64 bits[LDM_MODALIAS_VENDORS_BITS / 64];
+        gboolean any; /* Some rule may match any vendor */
+} LdmModaliasVendors;
+
+void ldm_modalias_vendors_init(LdmModaliasVendors *vendors);
+void ldm_modalias_vendors_add_match(LdmModaliasVendors *vendors, const gchar *match);
+void ldm_modalias_vendors_merge(LdmModaliasVendors *vendors, const LdmModaliasVendors *other);
+gboolean ldm_modalias_vendors_accepts(const LdmModaliasVendors *vendors, const gchar *modalias);
+
+G_END_DECLS
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
@@ -12,7 +12,11 @@
 #define _GNU_SOURCE
 
 #include <fnmatch.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
+#include "ldm-private.h"
 #include "modalias.h"
 #include "util.h"
 
@@ -235,7 +239,7 @@ LdmModalias *ldm_modalias_new(const gchar *match, const gchar *driver, const cha
 const gchar *ldm_modalias_get_driver(LdmModalias *self)
 {
         g_return_val_if_fail(self != NULL, NULL);
-        return (const gchar *)self->driver;
+        return self->driver;
 }
 
 /**
@@ -263,7 +267,7 @@ const gchar *ldm_modalias_get_match(LdmModalias *self)
 const gchar *ldm_modalias_get_package(LdmModalias *self)
 {
         g_return_val_if_fail(self != NULL, NULL);
-        return (const gchar *)self->package;
+        return self->package;
 }
 
 /**
@@ -296,33 +300,384 @@ gboolean ldm_modalias_matches(LdmModalias *self, const gchar *match_string)
 gboolean ldm_modalias_matches_device(LdmModalias *self, LdmDevice *match_device)
 {
         g_return_val_if_fail(match_device != NULL, FALSE);
-        g_autoptr(GList) kids = NULL;
-        GList *elem = NULL;
-        const gchar *id = NULL;
-
-        /* Root match? */
-        id = ldm_device_get_modalias(match_device);
-        if (id && ldm_modalias_matches(self, id)) {
-                return TRUE;
+        GPtrArray *modaliases = NULL;
+
+        /* Try the device, then child devices (interfaces) */
+        modaliases = ldm_device_get_modaliases(match_device);
+        for (guint i = 0; i < modaliases->len; i++) {
+                if (ldm_modalias_matches(self, modaliases->pdata[i])) {
+                        return TRUE;
+                }
+        }
+
+        return FALSE;
+}
+
+/*
+ * Field layout of the kernel modalias formats that can be indexed. Each value
+ * is fixed width hex, preceded by a short tag, i.e. `pci:v000010DEd00001C60..`
+ */
+typedef struct LdmModaliasField {
+        const gchar *tag;
+        guint8 width;
+} LdmModaliasField;
+
+typedef struct LdmModaliasGrammar {
+        const gchar *prefix;
+        LdmModaliasBus bus;
+        const LdmModaliasField *fields;
+        guint n_fields;
+        guint vendor_field;
+        guint product_field;
+} LdmModaliasGrammar;
+
+static const LdmModaliasField pci_fields[] = {
+        { "v", 8 },  { "d", 8 },  { "sv", 8 }, { "sd", 8 },
+        { "bc", 2 }, { "sc", 2 }, { "i", 2 },
+};
+
+static const LdmModaliasField usb_fields[] = {
+        { "v", 4 },  { "p", 4 },  { "d", 4 },   { "dc", 2 }, { "dsc", 2 },
+        { "dp", 2 }, { "ic", 2 }, { "isc", 2 }, { "ip", 2 }, { "in", 2 },
+};
+
+static const LdmModaliasField hid_fields[] = {
+        { "b", 4 },
+        { "g", 4 },
+        { "v", 8 },
+        { "p", 8 },
+};
+
+static const LdmModaliasGrammar modalias_grammars[] = {
+        { "pci:", LDM_MODALIAS_BUS_PCI, pci_fields, G_N_ELEMENTS(pci_fields), 0, 1 },
+        { "usb:", LDM_MODALIAS_BUS_USB, usb_fields, G_N_ELEMENTS(usb_fields), 0, 1 },
+        { "hid:", LDM_MODALIAS_BUS_HID, hid_fields, G_N_ELEMENTS(hid_fields), 2, 3 },
+};
+
+/**
+ * ldm_modalias_hex_value:
+ *
+ * Same as g_ascii_xdigit_value, without a function call for every digit of
+ * every modalias
+ */
+static inline gint ldm_modalias_hex_value(gchar c)
+{
+        if (c >= '0' && c <= '9') {
+                return c - '0';
+        }
+        if (c >= 'A' && c <= 'F') {
+                return c - 'A' + 10;
+        }
+        if (c >= 'a' && c <= 'f') {
+                return c - 'a' + 10;
+        }
+        return -1;
+}
+
+/**
+ * ldm_modalias_parse_hex:
+ *
+ * Parse exactly width hex digits from the string
+ */
+static gboolean ldm_modalias_parse_hex(const gchar *str, guint width, guint32 *value)
+{
+        guint32 ret = 0;
+
+        for (guint i = 0; i < width; i++) {
+                gint digit = ldm_modalias_hex_value(str[i]);
+                if (digit < 0) {
+                        return FALSE;
+                }
+                ret = (ret << 4) | (guint32)digit;
+        }
+
+        *value = ret;
+        return TRUE;
+}
+
+/**
+ * ldm_modalias_parse_key:
+ * @modalias: Device modalias or fnmatch style match
+ * @is_match: Whether we're parsing a match rather than a device modalias
+ * @vendor_only: Whether a match need only fix the vendor, not the product
+ * @key: Key to store the identifying fields in
+ *
+ * Device modaliases must conform to the grammar in full. A match may only
+ * use a lone `*` in place of the fields preceding the vendor and product,
+ * i.e. `hid:b0003g*v00001532p00000215`, and anything may follow them. This
+ * guarantees any device matched by the rule has the very same key.
+ *
+ * The bus is set on the key whenever the prefix is known, even when the
+ * remainder could not be parsed.
+ */
+static gboolean ldm_modalias_parse_key(const gchar *modalias, gboolean is_match,
+                                       gboolean vendor_only, LdmModaliasKey *key)
+{
+        const LdmModaliasGrammar *grammar = NULL;
+        const gchar *c = NULL;
+        guint last_key_field = 0;
+
+        memset(key, 0, sizeof(*key));
+
+        for (guint i = 0; i < G_N_ELEMENTS(modalias_grammars); i++) {
+                /* Not g_str_has_prefix, which measures the whole modalias */
+                const gchar *prefix = modalias_grammars[i].prefix;
+
+                if (strncmp(modalias, prefix, strlen(prefix)) == 0) {
+                        grammar = &modalias_grammars[i];
+                        break;
+                }
         }
 
-        /* Any kids? */
-        kids = ldm_device_get_children(match_device);
-        if (!kids) {
+        if (!grammar) {
                 return FALSE;
         }
 
-        /* Try matching child devices (interfaces) */
-        for (elem = kids; elem; elem = elem->next) {
-                LdmDevice *child_device = NULL;
+        key->bus = (guint8)grammar->bus;
+        last_key_field = MAX(grammar->vendor_field, grammar->product_field);
+        if (vendor_only) {
+                last_key_field = grammar->vendor_field;
+        }
+        c = modalias + strlen(grammar->prefix);
+
+        for (guint i = 0; i < grammar->n_fields; i++) {
+                const LdmModaliasField *field = &grammar->fields[i];
+                gboolean is_key =
+                    i == grammar->vendor_field || (!vendor_only && i == grammar->product_field);
+                gsize tag_len = strlen(field->tag);
+                guint32 value = 0;
+
+                if (strncmp(c, field->tag, tag_len) != 0) {
+                        return FALSE;
+                }
+                c += tag_len;
+
+                /* Leading fields may be wildcarded entirely in a match, so long
+                 * as the next tag can't be confused with hex digits, otherwise
+                 * the star may skip to a later field of the device. */
+                if (is_match && !is_key && *c == '*') {
+                        if (i + 1 >= grammar->n_fields ||
+                            g_ascii_isxdigit(grammar->fields[i + 1].tag[0])) {
+                                return FALSE;
+                        }
+                        ++c;
+                        continue;
+                }
+
+                if (!ldm_modalias_parse_hex(c, field->width, &value)) {
+                        return FALSE;
+                }
+                c += field->width;
 
-                child_device = LDM_DEVICE(elem->data);
-                if (ldm_modalias_matches_device(self, child_device)) {
+                if (i == grammar->vendor_field) {
+                        key->vendor = value;
+                } else if (i == grammar->product_field) {
+                        key->product = value;
+                }
+
+                /* Remainder of a match is irrelevant to the key */
+                if (is_match && i == last_key_field) {
                         return TRUE;
                 }
         }
 
-        return FALSE;
+        return *c == '\0';
+}
+
+/**
+ * ldm_modalias_parse_device_key:
+ * @modalias: A device modalias as set by the kernel
+ * @key: (out caller-allocates): Key to store the identifying fields in
+ *
+ * Parse the `pci:`, `usb:` or `hid:` device modalias into its identifying
+ * vendor and device/product fields.
+ *
+ * Returns: TRUE if the modalias was parsed fully
+ */
+gboolean ldm_modalias_parse_device_key(const gchar *modalias, LdmModaliasKey *key)
+{
+        g_return_val_if_fail(modalias != NULL, FALSE);
+        g_return_val_if_fail(key != NULL, FALSE);
+
+        return ldm_modalias_parse_key(modalias, FALSE, FALSE, key);
+}
+
+/**
+ * ldm_modalias_parse_match_key:
+ * @match: An fnmatch style modalias match
+ * @key: (out caller-allocates): Key to store the identifying fields in
+ *
+ * Attempt to extract the exact vendor and device/product fields from a
+ * modalias match. This will fail if the match uses any wildcards in those
+ * fields, as the match cannot then be indexed by key.
+ *
+ * Returns: TRUE if the match has an exact key
+ */
+gboolean ldm_modalias_parse_match_key(const gchar *match, LdmModaliasKey *key)
+{
+        g_return_val_if_fail(match != NULL, FALSE);
+        g_return_val_if_fail(key != NULL, FALSE);
+
+        return ldm_modalias_parse_key(match, TRUE, FALSE, key);
+}
+
+/**
+ * ldm_modalias_parse_match_vendor:
+ * @match: An fnmatch style modalias match
+ * @key: (out caller-allocates): Key to store the bus and vendor in
+ *
+ * Attempt to extract the exact vendor field alone from a modalias match,
+ * which may use wildcards for the device/product field. The product of the
+ * key is always zero.
+ *
+ * Returns: TRUE if the match fixes its vendor
+ */
+gboolean ldm_modalias_parse_match_vendor(const gchar *match, LdmModaliasKey *key)
+{
+        g_return_val_if_fail(match != NULL, FALSE);
+        g_return_val_if_fail(key != NULL, FALSE);
+
+        return ldm_modalias_parse_key(match, TRUE, TRUE, key);
+}
+
+/**
+ * ldm_modalias_key_hash:
+ *
+ * #GHashFunc for #LdmModaliasKey
+ */
+guint ldm_modalias_key_hash(gconstpointer v)
+{
+        const LdmModaliasKey *key = v;
+
+        return (key->vendor * 31u + key->product) * 31u + key->bus;
+}
+
+/**
+ * ldm_modalias_key_equal:
+ *
+ * #GEqualFunc for #LdmModaliasKey
+ */
+gboolean ldm_modalias_key_equal(gconstpointer a, gconstpointer b)
+{
+        const LdmModaliasKey *keyA = a;
+        const LdmModaliasKey *keyB = b;
+
+        return keyA->bus == keyB->bus && keyA->vendor == keyB->vendor &&
+               keyA->product == keyB->product;
+}
+
+/**
+ * ldm_modalias_parse_data:
+ * @data: NUL terminated contents of a `.modaliases` file, modified in place
+ * @func: Function to call for each alias in the file
+ * @userdata: Data to pass to @func
+ *
+ * Parse every `alias match driver package` line in the buffer, skipping
+ * comments and blank lines. Each line is split by terminating its fields
+ * within @data itself, so the strings passed to @func remain valid for as
+ * long as @data does and no memory is allocated while parsing.
+ */
+void ldm_modalias_parse_data(gchar *data, LdmModaliasFileFunc func, gpointer userdata)
+{
+        gchar *line = data;
+
+        g_return_if_fail(data != NULL);
+        g_return_if_fail(func != NULL);
+
+        while (line && *line) {
+                gchar *fields[4] = { NULL };
+                gchar *work = NULL;
+                gchar *end = NULL;
+
+                /* Terminate this line and find the next */
+                end = strchr(line, '\n');
+                if (end) {
+                        *end = '\0';
+                        ++end;
+                }
+
+                work = g_strstrip(line);
+                line = end;
+
+                /* Empty lines and comments are uninteresting. */
+                if (*work == '\0' || *work == '#') {
+                        continue;
+                }
+
+                /* Split on the first three spaces, the package takes the rest */
+                fields[0] = work;
+                for (guint i = 1; i < G_N_ELEMENTS(fields); i++) {
+                        gchar *space = strchr(fields[i - 1], ' ');
+                        if (!space) {
+                                break;
+                        }
+                        *space = '\0';
+                        fields[i] = space + 1;
+                }
+
+                if (!fields[3]) {
+                        continue;
+                }
+
+                if (!g_str_equal(fields[0], "alias")) {
+                        g_warning("unknown directive '%s'", fields[0]);
+                        continue;
+                }
+
+                func(fields[1], fields[2], fields[3], userdata);
+        }
+}
+
+/**
+ * ldm_modalias_read_file:
+ * @filename: Path to a `.modaliases` file
+ *
+ * Read the entire file into memory, ready for #ldm_modalias_parse_data.
+ *
+ * Returns: (transfer full): The NUL terminated file contents, or NULL if the
+ * file couldn't be read
+ */
+gchar *ldm_modalias_read_file(const gchar *filename)
+{
+        g_autoptr(GError) error = NULL;
+        gchar *contents = NULL;
+
+        g_return_val_if_fail(filename != NULL, NULL);
+
+        if (!g_file_get_contents(filename, &contents, NULL, &error)) {
+                fprintf(stderr, "Failed to open %s: %s\n", filename, error->message);
+                return NULL;
+        }
+
+        return contents;
+}
+
+/**
+ * ldm_modalias_parse_file:
+ * @filename: Path to a `.modaliases` file
+ * @func: Function to call for each alias in the file
+ * @userdata: Data to pass to @func
+ *
+ * Read and parse the file with #ldm_modalias_parse_data. The strings passed
+ * to @func are only valid for the duration of the call.
+ *
+ * Returns: TRUE if the file could be read
+ */
+gboolean ldm_modalias_parse_file(const gchar *filename, LdmModaliasFileFunc func, gpointer userdata)
+{
+        g_autofree gchar *contents = NULL;
+
+        g_return_val_if_fail(filename != NULL, FALSE);
+        g_return_val_if_fail(func != NULL, FALSE);
+
+        contents = ldm_modalias_read_file(filename);
+        if (!contents) {
+                return FALSE;
+        }
+
+        ldm_modalias_parse_data(contents, func, userdata);
+
+        return TRUE;
 }
 
 /*
@@ -130,18 +130,17 @@ product:
 }
 
 /**
- * ldm_pci_device_assign_address:
+ * ldm_pci_device_init_address:
+ * @sysname: Name of the device within sysfs, i.e. "0000:01:00.0"
  *
- * Query and set up our PCI device address.
+ * Set up our PCI device address from its sysfs name.
  */
-static void ldm_pci_device_assign_address(LdmDevice *self, udev_device *device)
+void ldm_pci_device_init_address(LdmDevice *self, const gchar *sysname)
 {
         LdmPCIDevice *pci = LDM_PCI_DEVICE(self);
-        const char *sys = NULL;
 
         /* Push this address into our internal notation */
-        sys = udev_device_get_sysname(device);
-        if (sscanf(sys,
+        if (sscanf(sysname,
                    "0000:%x:%x.%d",
                    &pci->address.bus,
                    &pci->address.dev,
@@ -162,7 +161,7 @@ void ldm_pci_device_init_private(LdmDevice *self, udev_device *device)
         int pci_class = 0;
 
         ldm_pci_device_assign_pvid(self, device);
-        ldm_pci_device_assign_address(self, device);
+        ldm_pci_device_init_address(self, udev_device_get_sysname(device));
 
         /* Are we boot_vga ? */
         sysattr = udev_device_get_sysattr_value(device, "boot_vga");
@@ -18,7 +18,11 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "ldm-private.h"
+#include "modalias-db.h"
+#include "modalias-index.h"
 #include "modalias-plugin.h"
+#include "modalias-rules.h"
 #include "util.h"
 
 struct _LdmModaliasPluginClass {
@@ -63,8 +67,22 @@ static LdmProvider *ldm_modalias_plugin_get_provider(LdmPlugin *plugin, LdmDevic
 struct _LdmModaliasPlugin {
         LdmPlugin parent;
 
-        /* Our known modalias implementations */
-        GHashTable *modaliases;
+        /* Compiled form of our source file, if we found a valid one */
+        LdmModaliasDb *db;
+
+        /* Rules from our source file when it wasn't compiled, and any added.
+         * Only one of db and rules holds the rules of the source file. */
+        LdmModaliasRules *rules;
+
+        /* Indexed form of our rules, NULL when it needs rebuilding */
+        LdmModaliasIndex *index;
+
+        /* Vendors of all our rules, for rejecting devices outright */
+        LdmModaliasVendors vendors;
+        gboolean vendors_valid;
+
+        /* Bumped whenever the rules change */
+        guint serial;
 };
 
 G_DEFINE_TYPE(LdmModaliasPlugin, ldm_modalias_plugin, LDM_TYPE_PLUGIN)
@@ -78,7 +96,9 @@ static void ldm_modalias_plugin_dispose(GObject *obj)
 {
         LdmModaliasPlugin *self = LDM_MODALIAS_PLUGIN(obj);
 
-        g_clear_pointer(&self->modaliases, g_hash_table_unref);
+        g_clear_pointer(&self->index, ldm_modalias_index_free);
+        g_clear_pointer(&self->rules, ldm_modalias_rules_free);
+        g_clear_pointer(&self->db, ldm_modalias_db_free);
 
         G_OBJECT_CLASS(ldm_modalias_plugin_parent_class)->dispose(obj);
 }
@@ -107,8 +127,33 @@ static void ldm_modalias_plugin_class_init(LdmModaliasPluginClass *klazz)
  */
 static void ldm_modalias_plugin_init(LdmModaliasPlugin *self)
 {
-        /* Map name to modalias */
-        self->modaliases = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_object_unref);
+        self->rules = ldm_modalias_rules_new();
+}
+
+/**
+ * ldm_modalias_plugin_get_index:
+ *
+ * Return the index for our rules, building it first if they have changed
+ * since the index was last built. The index borrows the match strings owned
+ * by the rules, and returns the package of each match.
+ */
+static LdmModaliasIndex *ldm_modalias_plugin_get_index(LdmModaliasPlugin *self)
+{
+        guint n_rules = 0;
+
+        if (self->index) {
+                return self->index;
+        }
+
+        self->index = ldm_modalias_index_new();
+
+        n_rules = ldm_modalias_rules_size(self->rules);
+        for (guint i = 0; i < n_rules; i++) {
+                const LdmModaliasRule *rule = ldm_modalias_rules_get(self->rules, i);
+                ldm_modalias_index_add(self->index, rule->match, (gpointer)rule->package);
+        }
+
+        return self->index;
 }
 
 /**
@@ -124,6 +169,48 @@ LdmPlugin *ldm_modalias_plugin_new(const gchar *name)
         return g_object_new(LDM_TYPE_MODALIAS_PLUGIN, "name", name, "priority", 0, NULL);
 }
 
+/**
+ * ldm_modalias_plugin_open_db:
+ * @filename: Path to a modaliases file
+ *
+ * Find a valid compiled database for the modaliases file, preferring one
+ * shipped alongside it by `mkmodaliases --compile`. Failing that we'll use
+ * our cache, compiling the file into it first if we have permission.
+ *
+ * Returns: A new database, or NULL if the text form must be used
+ */
+static LdmModaliasDb *ldm_modalias_plugin_open_db(const gchar *filename)
+{
+        g_autofree gchar *sidecar_path = NULL;
+        g_autofree gchar *cache_path = NULL;
+        g_autofree gchar *cache_dir = NULL;
+        LdmModaliasDb *db = NULL;
+
+        sidecar_path = g_strdup_printf("%s.bin", filename);
+        db = ldm_modalias_db_open(sidecar_path, filename);
+        if (db) {
+                return db;
+        }
+
+        cache_path = ldm_modalias_db_get_cache_path(filename);
+        db = ldm_modalias_db_open(cache_path, filename);
+        if (db) {
+                return db;
+        }
+
+        cache_dir = g_path_get_dirname(cache_path);
+        if (g_mkdir_with_parents(cache_dir, 00755) != 0 || access(cache_dir, W_OK) != 0) {
+                return NULL;
+        }
+
+        if (!ldm_modalias_db_write(filename, cache_path, NULL)) {
+                g_debug("failed to cache compiled form of %s", filename);
+                return NULL;
+        }
+
+        return ldm_modalias_db_open(cache_path, filename);
+}
+
 /**
  * ldm_modalias_plugin_new_from_filename:
  * @filename: Path to a modaliases file
@@ -131,15 +218,19 @@ LdmPlugin *ldm_modalias_plugin_new(const gchar *name)
  * Create a new LdmPlugin for modalias detection. The named file will be
  * opened and the resulting plugin will be seeded from that file.
  *
+ * A compiled form of the file is used instead where available, see
+ * #ldm_modalias_plugin_compile. This is mapped directly into memory,
+ * avoiding the cost of parsing the text form. Otherwise the text form is
+ * read in one go and split in place, and its rules packed together with
+ * each distinct driver and package name stored only once.
+ *
  * Returns: (transfer full): A newly initialised LdmModaliasPlugin
  */
 LdmPlugin *ldm_modalias_plugin_new_from_filename(const gchar *filename)
 {
-        FILE *fp = NULL;
-        char *bfr = NULL;
-        size_t n = 0;
-        ssize_t read = 0;
         LdmPlugin *ret = NULL;
+        LdmModaliasDb *db = NULL;
+        LdmModaliasRules *rules = NULL;
         g_autofree gchar *path = NULL;
 
         g_return_val_if_fail(filename != NULL, NULL);
@@ -147,86 +238,87 @@ LdmPlugin *ldm_modalias_plugin_new_from_filename(const gchar *filename)
                 return NULL;
         }
 
-        fp = fopen(filename, "r");
-        if (!fp) {
-                fprintf(stderr, "Failed to open %s: %s\n", filename, strerror(errno));
-                return NULL;
-        }
-
         /* Strip suffix if set */
         path = g_path_get_basename(filename);
         if (g_str_has_suffix(path, ".modaliases")) {
                 path[strlen(path) - strlen(".modaliases")] = '\0';
         }
 
-        ret = ldm_modalias_plugin_new(path);
-
-        /* Walk the line. */
-        while ((read = getline(&bfr, &n, fp)) > 0) {
-                gchar *work = NULL;
-                gchar **splits = NULL;
-                LdmModalias *alias = NULL;
-
-                /* Strip the newline from it */
-                if (bfr[read - 1] == '\n') {
-                        bfr[read - 1] = '\0';
-                        --read;
-                }
-
-                /* Empty lines are uninteresting. */
-                if (read < 1) {
-                        continue;
-                }
-
-                work = g_strstrip(bfr);
-
-                /* Comment? */
-                if (g_str_has_prefix(work, "#")) {
-                        goto next_line;
-                }
+        db = ldm_modalias_plugin_open_db(filename);
+        if (db) {
+                ret = ldm_modalias_plugin_new(path);
+                LDM_MODALIAS_PLUGIN(ret)->db = db;
+                return ret;
+        }
 
-                splits = g_strsplit(work, " ", 4);
-                if (!splits || g_strv_length(splits) != 4) {
-                        goto next_line;
-                }
+        /* Fall back to parsing the text form */
+        rules = ldm_modalias_rules_new_from_file(filename);
+        if (!rules) {
+                return NULL;
+        }
 
-                if (!g_str_equal(splits[0], "alias")) {
-                        g_warning("unknown directive '%s'", splits[0]);
-                        goto next_line;
-                }
+        ret = ldm_modalias_plugin_new(path);
+        ldm_modalias_rules_free(LDM_MODALIAS_PLUGIN(ret)->rules);
+        LDM_MODALIAS_PLUGIN(ret)->rules = rules;
+        return ret;
+}
 
-                alias = ldm_modalias_new(splits[1], splits[2], splits[3]);
-                if (!alias) {
-                        g_warning("invalid alias '%s'", work);
-                        goto next_line;
-                }
+/**
+ * ldm_modalias_plugin_compile:
+ * @filename: Path to a modaliases file
+ * @output: (nullable): Path to write the compiled form to
+ *
+ * Compile the modaliases file into a binary database, which will then be
+ * used by #ldm_modalias_plugin_new_from_filename in place of the text form.
+ * When @output is NULL, the database is written alongside @filename with an
+ * additional `.bin` suffix, where it will be found automatically.
+ *
+ * The database is only used for as long as @filename retains the size and
+ * contents that it had when compiled, wherever it is installed.
+ *
+ * Returns: TRUE if the database was written successfully
+ *
+ * Since: 1.0.3
+ */
+gboolean ldm_modalias_plugin_compile(const gchar *filename, const gchar *output)
+{
+        g_autoptr(GError) error = NULL;
+        g_autofree gchar *output_path = NULL;
 
-                /* Add modalias. */
-                ldm_modalias_plugin_add_modalias(LDM_MODALIAS_PLUGIN(ret), alias);
+        g_return_val_if_fail(filename != NULL, FALSE);
 
-        next_line:
-                if (splits) {
-                        g_strfreev(splits);
-                }
-                free(bfr);
-                bfr = NULL;
-        }
+        output_path = output ? g_strdup(output) : g_strdup_printf("%s.bin", filename);
 
-        if (bfr) {
-                free(bfr);
+        if (!ldm_modalias_db_write(filename, output_path, &error)) {
+                fprintf(stderr, "Failed to compile %s: %s\n", filename, error->message);
+                return FALSE;
         }
 
-        fclose(fp);
+        return TRUE;
+}
 
-        return ret;
+/**
+ * ldm_modalias_plugin_copy_db_rule:
+ *
+ * Copy a single rule of the compiled database into our own rules
+ */
+static void ldm_modalias_plugin_copy_db_rule(const gchar *match, const gchar *driver,
+                                             const gchar *package, gpointer userdata)
+{
+        ldm_modalias_rules_add(userdata, match, driver, package);
 }
 
 /**
  * ldm_modalias_plugin_add_modalias:
  * @modalias: (transfer full): Modalias object to add to the table
  *
- * Add a new modalias object to the plugin table. This method will take a new
- * reference to the modalias.
+ * Add a new modalias object to the plugin table, replacing any existing
+ * rule with the same match. The fields of the modalias are copied into the
+ * plugin's own compact rule storage, and the object itself is released.
+ *
+ * A plugin using the compiled form of its file first copies those rules
+ * into its own storage, so that the replacement behaves the same whether
+ * or not the file was compiled.
  */
 void ldm_modalias_plugin_add_modalias(LdmModaliasPlugin *self, LdmModalias *modalias)
 {
@@ -238,14 +330,145 @@ void ldm_modalias_plugin_add_modalias(LdmModaliasPlugin *self, LdmModalias *moda
         id = ldm_modalias_get_match(modalias);
         g_assert(id != NULL);
 
-        g_hash_table_replace(self->modaliases, g_strdup(id), g_object_ref_sink(modalias));
+        /* Compiled rules can't be replaced in place, so we take them over */
+        if (self->db) {
+                ldm_modalias_db_foreach(self->db, ldm_modalias_plugin_copy_db_rule, self->rules);
+                g_clear_pointer(&self->db, ldm_modalias_db_free);
+        }
+
+        ldm_modalias_rules_add(self->rules,
+                               id,
+                               ldm_modalias_get_driver(modalias),
+                               ldm_modalias_get_package(modalias));
+
+        /* We own the (possibly floating) reference now */
+        g_object_unref(g_object_ref_sink(modalias));
+
+        /* Rebuild on next use */
+        g_clear_pointer(&self->index, ldm_modalias_index_free);
+        self->vendors_valid = FALSE;
+        ++self->serial;
+}
+
+/**
+ * ldm_modalias_plugin_foreach_rule:
+ * @func: Function to call for each rule
+ * @userdata: Data to pass to @func
+ *
+ * Private accessor to walk every rule of the plugin, in the same order that
+ * the plugin itself tests them. The strings passed to @func remain valid
+ * until the plugin is modified or destroyed.
+ */
+void ldm_modalias_plugin_foreach_rule(LdmModaliasPlugin *self, LdmModaliasFileFunc func,
+                                      gpointer userdata)
+{
+        guint n_rules = 0;
+
+        g_return_if_fail(self != NULL);
+        g_return_if_fail(func != NULL);
+
+        if (self->db) {
+                ldm_modalias_db_foreach(self->db, func, userdata);
+        }
+
+        n_rules = ldm_modalias_rules_size(self->rules);
+        for (guint i = 0; i < n_rules; i++) {
+                const LdmModaliasRule *rule = ldm_modalias_rules_get(self->rules, i);
+                func(rule->match, rule->driver, rule->package, userdata);
+        }
+}
+
+/**
+ * ldm_modalias_plugin_get_serial:
+ *
+ * Private accessor for the modification serial of the plugin, which changes
+ * every time a modalias is added so that external indexes can be refreshed.
+ */
+guint ldm_modalias_plugin_get_serial(LdmModaliasPlugin *self)
+{
+        g_return_val_if_fail(self != NULL, 0);
+
+        return self->serial;
+}
+
+/**
+ * ldm_modalias_plugin_add_vendor:
+ *
+ * Note the vendor of a single rule
+ */
+static void ldm_modalias_plugin_add_vendor(const gchar *match, __ldm_unused__ const gchar *driver,
+                                           __ldm_unused__ const gchar *package, gpointer userdata)
+{
+        ldm_modalias_vendors_add_match(userdata, match);
+}
+
+/**
+ * ldm_modalias_plugin_get_vendors:
+ *
+ * Private accessor for the vendors of all rules in the plugin, gathered
+ * first if the rules have changed since. Any device modalias it doesn't
+ * accept can't be matched by the plugin.
+ */
+const LdmModaliasVendors *ldm_modalias_plugin_get_vendors(LdmModaliasPlugin *self)
+{
+        g_return_val_if_fail(self != NULL, NULL);
+
+        if (self->vendors_valid) {
+                return &self->vendors;
+        }
+
+        ldm_modalias_vendors_init(&self->vendors);
+        ldm_modalias_plugin_foreach_rule(self, ldm_modalias_plugin_add_vendor, &self->vendors);
+        self->vendors_valid = TRUE;
+
+        return &self->vendors;
+}
+
+/**
+ * ldm_modalias_plugin_match_device:
+ * @device: Device (or interface) to test
+ * @results: Scratch array for matches
+ *
+ * Test the device and all of its children against our compiled database
+ * and then our index, returning the package of the first match. Those of
+ * a vendor we have no rules for are skipped.
+ */
+static const gchar *ldm_modalias_plugin_match_device(LdmModaliasPlugin *self, LdmDevice *device,
+                                                     GPtrArray *results)
+{
+        const LdmModaliasVendors *vendors = NULL;
+        GPtrArray *modaliases = NULL;
+
+        vendors = ldm_modalias_plugin_get_vendors(self);
+
+        /* Root match, then child devices (interfaces) */
+        modaliases = ldm_device_get_modaliases(device);
+        for (guint i = 0; i < modaliases->len; i++) {
+                const gchar *id = modaliases->pdata[i];
+
+                if (!ldm_modalias_vendors_accepts(vendors, id)) {
+                        continue;
+                }
+                if (self->db) {
+                        const gchar *package = ldm_modalias_db_lookup(self->db, id);
+                        if (package) {
+                                return package;
+                        }
+                }
+                if (ldm_modalias_rules_size(self->rules) > 0 &&
+                    ldm_modalias_index_lookup(ldm_modalias_plugin_get_index(self), id, results)) {
+                        return results->pdata[0];
+                }
+        }
+
+        return NULL;
 }
 
 /**
  * ldm_modalias_plugin_get_provider:
  * @device: Test input device
  *
- * Walk our modaliases and attempt to find a match from one of those lines. If
+ * Look the device up in our modalias index by bus, vendor and product. If
  * we match the device off against our table, return a new #LdmProvider to help
  * configure that device.
  *
@@ -254,22 +477,20 @@ void ldm_modalias_plugin_add_modalias(LdmModaliasPlugin *self, LdmModalias *moda
 static LdmProvider *ldm_modalias_plugin_get_provider(LdmPlugin *plugin, LdmDevice *device)
 {
         LdmModaliasPlugin *self = LDM_MODALIAS_PLUGIN(plugin);
-        LdmProvider *ret = NULL;
-        GHashTableIter iter = { 0 };
-        __ldm_unused__ gpointer key = NULL;
-        LdmModalias *modalias = NULL;
-
-        g_hash_table_iter_init(&iter, self->modaliases);
-        while (g_hash_table_iter_next(&iter, &key, (void **)&modalias)) {
-                if (!ldm_modalias_matches_device(modalias, device)) {
-                        continue;
-                }
+        const gchar *package = NULL;
+        g_autoptr(GPtrArray) results = NULL;
 
-                ret = ldm_provider_new(plugin, device, ldm_modalias_get_package(modalias));
-                return ret;
+        if (!self->db && ldm_modalias_rules_size(self->rules) < 1) {
+                return NULL;
         }
 
-        return NULL;
+        results = g_ptr_array_new();
+        package = ldm_modalias_plugin_match_device(self, device, results);
+        if (!package) {
+                return NULL;
+        }
+
+        return ldm_provider_new(plugin, device, package);
 }
 
 /*
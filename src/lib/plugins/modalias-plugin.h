@@ -40,6 +40,8 @@ LdmPlugin *ldm_modalias_plugin_new_from_filename(const gchar *filename);
 
 void ldm_modalias_plugin_add_modalias(LdmModaliasPlugin *driver, LdmModalias *modalias);
 
+gboolean ldm_modalias_plugin_compile(const gchar *filename, const gchar *output);
+
 G_END_DECLS
 
 /*
@@ -13,26 +13,24 @@
 
 #include "../lib/util.h"
 #include "config.h"
+#include "ldm.h"
+#include "modalias-set.h"
+#include "module-probe.h"
 
 #include <errno.h>
 #include <glib.h>
-#include <libkmod.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
-typedef struct kmod_ctx kmod_ctx;
-typedef struct kmod_module kmod_module;
-typedef struct kmod_list kmod_list;
-
-DEF_AUTOFREE(kmod_ctx, kmod_unref)
-DEF_AUTOFREE(kmod_module, kmod_module_unref)
-DEF_AUTOFREE(kmod_list, kmod_module_info_free_list)
-
 static void print_usage(const char *progname)
 {
-        fprintf(stderr, "%s usage: package-name [.ko files]\n", progname);
+        fprintf(stderr, "%s usage: [--optimize] package-name [.ko files]\n", progname);
+        fprintf(stderr, "       %s --index [directory] package-name [module names]\n", progname);
+        fprintf(stderr, "       %s --manifest [manifest file] [--tree directory]\n", progname);
+        fprintf(stderr, "       %s --tree [directory] package-name\n", progname);
+        fprintf(stderr, "       %s --compile [.modaliases files]\n", progname);
         fprintf(stderr, "Run '%s --help' for further information\n", progname);
 }
 
@@ -53,11 +51,32 @@ the Free Software Foundation; either version 2.1 of the License, or\n\
  */
 
 static gboolean opt_version = FALSE;
+static gboolean opt_compile = FALSE;
+static gboolean opt_optimize = FALSE;
 static gchar *opt_filename = NULL;
+static gchar *opt_manifest = NULL;
+static gchar *opt_tree = NULL;
+static gchar *opt_output_dir = NULL;
+static gchar *opt_index = NULL;
+static gint opt_jobs = 0;
 static gchar **opt_strings = NULL;
 
 static GOptionEntry cli_entries[] = {
         { "version", 'v', 0, G_OPTION_ARG_NONE, &opt_version, "Print version and exit", NULL },
+        { "compile",
+          'c',
+          0,
+          G_OPTION_ARG_NONE,
+          &opt_compile,
+          "Compile .modaliases files into their binary form",
+          NULL },
+        { "optimize",
+          'O',
+          0,
+          G_OPTION_ARG_NONE,
+          &opt_optimize,
+          "Remove rules made redundant by others, and sort the output",
+          NULL },
         { "output",
           'o',
           0,
@@ -65,6 +84,41 @@ static GOptionEntry cli_entries[] = {
           &opt_filename,
           "Redirect to the given file",
           NULL },
+        { "manifest",
+          'm',
+          0,
+          G_OPTION_ARG_FILENAME,
+          &opt_manifest,
+          "Generate a .modaliases file for each package in the manifest",
+          "FILE" },
+        { "tree",
+          't',
+          0,
+          G_OPTION_ARG_FILENAME,
+          &opt_tree,
+          "Use the modules of the given tree, such as /lib/modules/$version",
+          "DIRECTORY" },
+        { "output-dir",
+          'd',
+          0,
+          G_OPTION_ARG_FILENAME,
+          &opt_output_dir,
+          "Write each package's .modaliases file to the given directory",
+          "DIRECTORY" },
+        { "index",
+          'i',
+          0,
+          G_OPTION_ARG_FILENAME,
+          &opt_index,
+          "Read aliases from the depmod index of the given tree instead of the modules",
+          "DIRECTORY" },
+        { "jobs",
+          'j',
+          0,
+          G_OPTION_ARG_INT,
+          &opt_jobs,
+          "Number of modules to examine at once, defaulting to the number of CPUs",
+          "N" },
         { G_OPTION_REMAINING,
           0,
           0,
@@ -75,103 +129,444 @@ static GOptionEntry cli_entries[] = {
         { 0 },
 };
 
-/**
- * Examine just one kmod module and emit the info to the output file.
+/*
+ * The modules belonging to one package, in the order they were given
  */
-static gboolean examine_module(const gchar *package_name, FILE *fileh, kmod_module *module)
+typedef struct ModaliasPackage {
+        gchar *name;
+        GPtrArray *paths;
+        GPtrArray *probes; /* ModuleProbe, once the modules are known */
+} ModaliasPackage;
+
+static ModaliasPackage *modalias_package_new(const gchar *name)
 {
-        const char *kname = NULL;
-        autofree(kmod_list) *list = NULL;
-        kmod_list *iter = NULL;
+        ModaliasPackage *package = g_new0(ModaliasPackage, 1);
 
-        kname = kmod_module_get_name(module);
+        package->name = g_strdup(name);
+        package->paths = g_ptr_array_new_with_free_func(g_free);
+        package->probes = g_ptr_array_new();
 
-        /* Attempt probe */
-        if (kmod_module_get_info(module, &list) < 0) {
-                fprintf(stderr, "Couldn't probe module '%s'\n", kname);
+        return package;
+}
+
+static void modalias_package_free(gpointer v)
+{
+        ModaliasPackage *package = v;
+
+        g_ptr_array_unref(package->probes);
+        g_ptr_array_unref(package->paths);
+        g_free(package->name);
+        g_free(package);
+}
+
+/**
+ * Number of modules to examine at once
+ */
+static guint get_n_jobs(void)
+{
+        if (opt_jobs > 0) {
+                return (guint)opt_jobs;
+        }
+        return g_get_num_processors();
+}
+
+/**
+ * Ensure the path exists, and looks like a kernel module. Modules are only
+ * named when reading from the index.
+ */
+static gboolean check_module_path(const gchar *path)
+{
+        if (opt_index) {
+                return TRUE;
+        }
+        if (access(path, F_OK) != 0) {
+                fprintf(stderr, "Kernel module does not exist: %s\n", path);
                 return FALSE;
-        };
+        }
+        if (!module_path_is_kernel_module(path)) {
+                fprintf(stderr, "File does not appear to be a kernel module: %s\n", path);
+                return FALSE;
+        }
+        return TRUE;
+}
 
-        /* Walk all the aliases now */
-        kmod_list_foreach(iter, list)
-        {
-                const char *key = kmod_module_info_get_key(iter);
-                if (!key || !g_str_equal(key, "alias")) {
-                        continue;
-                }
-                const char *value = kmod_module_info_get_value(iter);
-                if (fprintf(fileh, "alias %s %s %s\n", value, kname, package_name) < 0) {
-                        return FALSE;
+/**
+ * Find the aliases of every module, from the depmod index when requested.
+ * Optimising sorts the aliases anyway, so their order needn't be kept.
+ */
+static gboolean probe_modules(ModuleProbe *probes, guint n_probes)
+{
+        if (opt_index) {
+                return module_probe_all_from_index(probes, n_probes, opt_index, !opt_optimize);
+        }
+        return module_probe_all(probes, n_probes, get_n_jobs());
+}
+
+/**
+ * Emit the aliases of each probed module, in order, for one package. When
+ * optimising, they're gathered up first so that redundant rules may be
+ * removed.
+ */
+static gboolean write_modaliases(FILE *fileh, const gchar *package_name, GPtrArray *probes)
+{
+        autofree(ModaliasSet) *set = NULL;
+        guint n_rules = 0, n_removed = 0;
+
+        if (opt_optimize) {
+                set = modalias_set_new();
+        }
+
+        for (guint i = 0; i < probes->len; i++) {
+                ModuleProbe *probe = probes->pdata[i];
+
+                for (guint j = 0; j < probe->aliases->len; j++) {
+                        const gchar *value = probe->aliases->pdata[j];
+
+                        if (set) {
+                                modalias_set_add(set, value, probe->name, probe->package);
+                                continue;
+                        }
+                        if (fprintf(fileh,
+                                    "alias %s %s %s\n",
+                                    value,
+                                    probe->name,
+                                    probe->package) < 0) {
+                                return FALSE;
+                        }
                 }
-        };
+        }
 
-        return TRUE;
+        if (!set) {
+                return TRUE;
+        }
+
+        n_rules = modalias_set_size(set);
+        n_removed = modalias_set_optimize(set);
+        fprintf(stderr, "Removed %u of %u rules for %s\n", n_removed, n_rules, package_name);
+
+        return modalias_set_write(set, fileh);
 }
 
 /**
- * Construct a modaliases file for the given package name and module paths.
+ * Write the modaliases of one package to the named file, or stdout if no
+ * file is given.
  */
-static int mkmodaliases(const char *package_name, gchar **paths, guint n_paths)
+static gboolean write_modaliases_file(const gchar *filename, const gchar *package_name,
+                                      GPtrArray *probes)
 {
         FILE *output_file = NULL;
-        autofree(kmod_ctx) *ctx = NULL;
-        int ret = EXIT_FAILURE;
+        gboolean ret = FALSE;
 
         /* Default to stdout if no path is set */
-        if (opt_filename) {
-                output_file = fopen(opt_filename, "w");
+        if (filename) {
+                output_file = fopen(filename, "w");
         } else {
                 output_file = stdout;
         }
 
         /* Make sure we have something to write to */
         if (!output_file) {
-                fprintf(stderr, "Failed to open %s for writing: %s", opt_filename, strerror(errno));
-                return EXIT_FAILURE;
+                fprintf(stderr, "Failed to open %s for writing: %s\n", filename, strerror(errno));
+                return FALSE;
+        }
+
+        ret = write_modaliases(output_file, package_name, probes);
+
+        if (output_file != stdout) {
+                if (fclose(output_file) != 0) {
+                        ret = FALSE;
+                }
+
+                if (!ret && unlink(filename) != 0) {
+                        fprintf(stderr,
+                                "Failed to unlink() erronous output file %s: %s\n",
+                                filename,
+                                strerror(errno));
+                }
+        }
+
+        return ret;
+}
+
+/**
+ * Construct a modaliases file for the given package name and module paths.
+ */
+static int mkmodaliases(const char *package_name, gchar **paths, guint n_paths)
+{
+        g_autoptr(GPtrArray) probes = NULL;
+        ModuleProbe *probe_data = NULL;
+        int ret = EXIT_FAILURE;
+
+        probe_data = g_new0(ModuleProbe, n_paths);
+        probes = g_ptr_array_sized_new(n_paths);
+        for (guint i = 0; i < n_paths; i++) {
+                module_probe_init(&probe_data[i], package_name, paths[i]);
+                g_ptr_array_add(probes, &probe_data[i]);
         }
 
-        /* Open kmod context with no host kernel knowledge */
-        ctx = kmod_new(NULL, NULL);
-        if (!ctx) {
-                fprintf(stderr, "Cannot init kmod: %s\n", strerror(errno));
+        if (!probe_modules(probe_data, n_paths)) {
                 goto cleanup;
         }
 
-        /* Walk all modules and pass our fileh */
+        if (!write_modaliases_file(opt_filename, package_name, probes)) {
+                goto cleanup;
+        }
+
+        /* All good so far */
+        ret = EXIT_SUCCESS;
+
+cleanup:
         for (guint i = 0; i < n_paths; i++) {
-                const gchar *kpath = paths[i];
-                autofree(kmod_module) *module = NULL;
+                module_probe_clear(&probe_data[i]);
+        }
+        g_free(probe_data);
 
-                int ret = kmod_module_new_from_path(ctx, kpath, &module);
-                if (ret != 0) {
-                        fprintf(stderr, "Couldn't open module: %s %s\n", kpath, strerror(errno));
-                        goto cleanup;
+        return ret;
+}
+
+/**
+ * Resolve a module path from the manifest, relative to the tree if given
+ */
+static gchar *resolve_module_path(const gchar *path)
+{
+        if (opt_tree && !g_path_is_absolute(path)) {
+                return g_build_filename(opt_tree, path, NULL);
+        }
+        return g_strdup(path);
+}
+
+/**
+ * Read the manifest, one package per line followed by the paths of its
+ * modules, separated by whitespace. A package may span several lines, and
+ * blank lines and those starting with '#' are ignored.
+ */
+static gboolean load_manifest(const gchar *filename, GPtrArray *packages)
+{
+        g_autoptr(GError) error = NULL;
+        g_autoptr(GHashTable) names = NULL;
+        g_autofree gchar *contents = NULL;
+        gchar **lines = NULL;
+        gboolean ret = FALSE;
+
+        if (!g_file_get_contents(filename, &contents, NULL, &error)) {
+                fprintf(stderr, "Failed to read manifest: %s\n", error->message);
+                return FALSE;
+        }
+
+        names = g_hash_table_new(g_str_hash, g_str_equal);
+        lines = g_strsplit(contents, "\n", -1);
+
+        for (guint i = 0; lines[i]; i++) {
+                ModaliasPackage *package = NULL;
+                gchar **fields = NULL;
+                guint n_fields = 0;
+                const gchar *line = g_strstrip(lines[i]);
+
+                if (*line == '\0' || *line == '#') {
+                        continue;
                 }
 
-                if (!examine_module(package_name, output_file, module)) {
+                fields = g_strsplit_set(line, " \t", -1);
+                for (guint j = 0; fields[j]; j++) {
+                        if (*fields[j] != '\0') {
+                                fields[n_fields++] = fields[j];
+                        } else {
+                                g_free(fields[j]);
+                        }
+                }
+                fields[n_fields] = NULL;
+
+                if (n_fields < 2) {
+                        fprintf(stderr,
+                                "%s:%u: Expected a package name and modules\n",
+                                filename,
+                                i + 1);
+                        g_strfreev(fields);
                         goto cleanup;
                 }
+
+                package = g_hash_table_lookup(names, fields[0]);
+                if (!package) {
+                        package = modalias_package_new(fields[0]);
+                        g_ptr_array_add(packages, package);
+                        g_hash_table_insert(names, package->name, package);
+                }
+                for (guint j = 1; j < n_fields; j++) {
+                        g_ptr_array_add(package->paths, resolve_module_path(fields[j]));
+                }
+
+                g_strfreev(fields);
         }
 
-        /* All good so far */
-        ret = EXIT_SUCCESS;
+        ret = TRUE;
 
 cleanup:
-        if (output_file != stdout) {
-                fflush(output_file);
-                fclose(output_file);
+        g_strfreev(lines);
+        return ret;
+}
 
-                if (ret != EXIT_SUCCESS && unlink(opt_filename) != 0) {
-                        fprintf(stderr,
-                                "Failed to unlink() erronous output file %s: %s\n",
-                                opt_filename,
-                                strerror(errno));
+static gint sort_paths(gconstpointer a, gconstpointer b)
+{
+        return strcmp(*(const gchar **)a, *(const gchar **)b);
+}
+
+/**
+ * Gather every kernel module beneath the directory. Symbolic links aren't
+ * followed, as a module tree links to the kernel sources with "build" and
+ * "source".
+ */
+static gboolean find_tree_modules(const gchar *directory, GPtrArray *paths)
+{
+        g_autoptr(GError) error = NULL;
+        GDir *dir = NULL;
+        const gchar *name = NULL;
+        gboolean ret = TRUE;
+
+        dir = g_dir_open(directory, 0, &error);
+        if (!dir) {
+                fprintf(stderr, "Failed to open module tree: %s\n", error->message);
+                return FALSE;
+        }
+
+        while ((name = g_dir_read_name(dir)) != NULL && ret) {
+                g_autofree gchar *path = g_build_filename(directory, name, NULL);
+
+                if (g_file_test(path, G_FILE_TEST_IS_SYMLINK)) {
+                        continue;
+                }
+                if (g_file_test(path, G_FILE_TEST_IS_DIR)) {
+                        ret = find_tree_modules(path, paths);
+                } else if (module_path_is_kernel_module(path)) {
+                        g_ptr_array_add(paths, g_steal_pointer(&path));
                 }
         }
 
+        g_dir_close(dir);
         return ret;
 }
 
+/**
+ * Construct a modaliases file for every package of the manifest, or for the
+ * whole tree when no manifest is given, examining all of the modules at
+ * once.
+ */
+static int mkmodaliases_batch(gchar **strings, guint n_strings)
+{
+        g_autoptr(GPtrArray) packages = NULL;
+        ModuleProbe *probe_data = NULL;
+        guint n_probes = 0, n = 0;
+        int ret = EXIT_FAILURE;
+
+        packages = g_ptr_array_new_with_free_func(modalias_package_free);
+
+        if (opt_manifest) {
+                if (n_strings != 0) {
+                        fprintf(stderr, "Package names come from the manifest\n");
+                        return EXIT_FAILURE;
+                }
+                if (!load_manifest(opt_manifest, packages)) {
+                        return EXIT_FAILURE;
+                }
+        } else {
+                ModaliasPackage *package = NULL;
+
+                if (n_strings != 1) {
+                        fprintf(stderr, "A single package name is required for the tree\n");
+                        return EXIT_FAILURE;
+                }
+                if (opt_index) {
+                        fprintf(stderr, "Modules must be listed to use the index\n");
+                        return EXIT_FAILURE;
+                }
+                package = modalias_package_new(strings[0]);
+                g_ptr_array_add(packages, package);
+                if (!find_tree_modules(opt_tree, package->paths)) {
+                        return EXIT_FAILURE;
+                }
+                g_ptr_array_sort(package->paths, sort_paths);
+        }
+
+        /* Make sure they all exist now */
+        for (guint i = 0; i < packages->len; i++) {
+                ModaliasPackage *package = packages->pdata[i];
+
+                for (guint j = 0; j < package->paths->len; j++) {
+                        if (!check_module_path(package->paths->pdata[j])) {
+                                return EXIT_FAILURE;
+                        }
+                }
+                n_probes += package->paths->len;
+        }
+
+        /* Examine every module of every package together */
+        probe_data = g_new0(ModuleProbe, MAX(n_probes, 1));
+        for (guint i = 0; i < packages->len; i++) {
+                ModaliasPackage *package = packages->pdata[i];
+
+                for (guint j = 0; j < package->paths->len; j++) {
+                        module_probe_init(&probe_data[n], package->name, package->paths->pdata[j]);
+                        g_ptr_array_add(package->probes, &probe_data[n]);
+                        ++n;
+                }
+        }
+
+        /* Failures are reported as they happen, but don't stop other
+         * packages from being written */
+        ret = probe_modules(probe_data, n_probes) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+        for (guint i = 0; i < packages->len; i++) {
+                ModaliasPackage *package = packages->pdata[i];
+                g_autofree gchar *basename = NULL;
+                g_autofree gchar *filename = NULL;
+                gboolean success = TRUE;
+
+                for (guint j = 0; j < package->probes->len && success; j++) {
+                        success = ((ModuleProbe *)package->probes->pdata[j])->success;
+                }
+                if (!success) {
+                        fprintf(stderr, "Not writing modaliases for %s\n", package->name);
+                        continue;
+                }
+
+                basename = g_strdup_printf("%s.modaliases", package->name);
+                filename = g_build_filename(opt_output_dir ? opt_output_dir : ".", basename, NULL);
+                if (!write_modaliases_file(filename, package->name, package->probes)) {
+                        ret = EXIT_FAILURE;
+                }
+        }
+
+        for (guint i = 0; i < n_probes; i++) {
+                module_probe_clear(&probe_data[i]);
+        }
+        g_free(probe_data);
+
+        return ret;
+}
+
+/**
+ * Compile each of the given .modaliases files into the binary database used
+ * by libldm, alongside the source file unless an output file is given.
+ */
+static int compile_modaliases(gchar **paths, guint n_paths)
+{
+        if (opt_filename && n_paths != 1) {
+                fprintf(stderr, "Only one .modaliases file may be compiled with --output\n");
+                return EXIT_FAILURE;
+        }
+
+        for (guint i = 0; i < n_paths; i++) {
+                if (access(paths[i], F_OK) != 0) {
+                        fprintf(stderr, "Modaliases file does not exist: %s\n", paths[i]);
+                        return EXIT_FAILURE;
+                }
+                if (!ldm_modalias_plugin_compile(paths[i], opt_filename)) {
+                        return EXIT_FAILURE;
+                }
+        }
+
+        return EXIT_SUCCESS;
+}
+
 int main(int argc, char **argv)
 {
         g_autoptr(GError) error = NULL;
@@ -196,6 +591,25 @@ int main(int argc, char **argv)
         }
 
         n_strings = opt_strings ? g_strv_length(opt_strings) : 0;
+
+        if (opt_compile) {
+                if (n_strings < 1) {
+                        print_usage(argv[0]);
+                        goto cleanup;
+                }
+                ret = compile_modaliases(opt_strings, n_strings);
+                goto cleanup;
+        }
+
+        if (opt_manifest || opt_tree) {
+                if (opt_filename) {
+                        fprintf(stderr, "Use --output-dir to choose where packages are written\n");
+                        goto cleanup;
+                }
+                ret = mkmodaliases_batch(opt_strings, n_strings);
+                goto cleanup;
+        }
+
         if (n_strings < 2) {
                 print_usage(argv[0]);
                 goto cleanup;
@@ -205,14 +619,7 @@ int main(int argc, char **argv)
 
         /* Make sure they all exist now */
         for (guint i = 1; i < n_strings; i++) {
-                if (access(opt_strings[i], F_OK) != 0) {
-                        fprintf(stderr, "Kernel module does not exist: %s\n", opt_strings[i]);
-                        goto cleanup;
-                }
-                if (!g_str_has_suffix(opt_strings[i], ".ko")) {
-                        fprintf(stderr,
-                                "File does not appear to be a kernel module: %s\n",
-                                opt_strings[i]);
+                if (!check_module_path(opt_strings[i])) {
                         goto cleanup;
                 }
         }
@@ -221,9 +628,11 @@ int main(int argc, char **argv)
         ret = mkmodaliases(package_name, opt_strings + 1, n_strings - 1);
 
 cleanup:
-        if (opt_filename) {
-                g_free(opt_filename);
-        }
+        g_free(opt_filename);
+        g_free(opt_manifest);
+        g_free(opt_tree);
+        g_free(opt_output_dir);
+        g_free(opt_index);
         if (opt_strings && *opt_strings) {
                 g_strfreev(opt_strings);
         }
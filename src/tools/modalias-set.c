@@ -0,0 +1,457 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Linux Driver Management Developers, Solus Project
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+
+#include "modalias-set.h"
+
+/* Longest pattern suffix compared without allocating */
+#define MODALIAS_COVER_STACK 256
+
+typedef struct ModaliasRule {
+        gchar *match;
+        const gchar *driver; /* Interned */
+        const gchar *package;
+        guint n_literals; /* Generality of the match, for optimising */
+        guint n_stars;
+        guint n_prefix; /* Characters before the first wildcard */
+} ModaliasRule;
+
+/*
+ * Rules kept while optimising, by the literal prefix of their match. A rule
+ * can only cover matches starting with that same prefix.
+ */
+typedef struct ModaliasCoverIndex {
+        GHashTable *buckets;    /* Literal prefix -> GPtrArray of ModaliasRule */
+        GArray *prefix_lengths; /* Each distinct prefix length in use */
+} ModaliasCoverIndex;
+
+struct ModaliasSet {
+        GPtrArray *rules; /* ModaliasRule, in the order added */
+};
+
+static void modalias_rule_free(gpointer v)
+{
+        ModaliasRule *rule = v;
+
+        /* Rules moved elsewhere leave a hole */
+        if (!rule) {
+                return;
+        }
+        g_free(rule->match);
+        g_free(rule);
+}
+
+/**
+ * modalias_set_new:
+ *
+ * Construct a new, empty, set of rules
+ */
+ModaliasSet *modalias_set_new(void)
+{
+        ModaliasSet *self = g_new0(ModaliasSet, 1);
+
+        self->rules = g_ptr_array_new_with_free_func(modalias_rule_free);
+
+        return self;
+}
+
+/**
+ * modalias_set_free:
+ *
+ * Free a previously allocated set of rules
+ */
+void modalias_set_free(ModaliasSet *self)
+{
+        if (!self) {
+                return;
+        }
+        g_ptr_array_unref(self->rules);
+        g_free(self);
+}
+
+/**
+ * modalias_set_add:
+ *
+ * Add a rule to the end of the set, exactly as given
+ */
+void modalias_set_add(ModaliasSet *self, const gchar *match, const gchar *driver,
+                      const gchar *package)
+{
+        ModaliasRule *rule = NULL;
+
+        g_return_if_fail(self != NULL);
+        g_return_if_fail(match != NULL);
+
+        rule = g_new0(ModaliasRule, 1);
+        rule->match = g_strdup(match);
+        rule->driver = g_intern_string(driver);
+        rule->package = g_intern_string(package);
+        g_ptr_array_add(self->rules, rule);
+}
+
+/**
+ * modalias_set_size:
+ *
+ * Returns: The number of rules within the set
+ */
+guint modalias_set_size(ModaliasSet *self)
+{
+        g_return_val_if_fail(self != NULL, 0);
+
+        return self->rules->len;
+}
+
+/**
+ * modalias_pattern_covers:
+ * @general: fnmatch style pattern
+ * @specific: fnmatch style pattern
+ *
+ * Determine whether every string matched by @specific is also matched by
+ * @general, by matching @specific against @general as though it were a
+ * string. Each `*` of @specific may only be consumed by a `*` of @general,
+ * and each `?` by a `?` or `*`.
+ *
+ * This is conservative: character classes and escapes are only handled by
+ * exact equality, so some covered patterns are not recognised as such.
+ *
+ * Returns: TRUE if @general covers @specific
+ */
+gboolean modalias_pattern_covers(const gchar *general, const gchar *specific)
+{
+        gboolean stack_rows[2][MODALIAS_COVER_STACK];
+        g_autofree gboolean *heap_rows = NULL;
+        gboolean *next = NULL, *row = NULL;
+        gsize prefix = 0;
+        gsize n_general = 0, n_specific = 0;
+
+        g_return_val_if_fail(general != NULL, FALSE);
+        g_return_val_if_fail(specific != NULL, FALSE);
+
+        if (strpbrk(general, "[\\") || strpbrk(specific, "[\\")) {
+                return g_str_equal(general, specific);
+        }
+
+        /* Most candidates differ within the literal prefix */
+        prefix = strcspn(general, "*?");
+        if (strncmp(general, specific, prefix) != 0) {
+                return FALSE;
+        }
+        general += prefix;
+        specific += prefix;
+
+        n_general = strlen(general);
+        n_specific = strlen(specific);
+        if (n_specific < MODALIAS_COVER_STACK) {
+                next = stack_rows[0];
+                row = stack_rows[1];
+        } else {
+                heap_rows = g_new(gboolean, 2 * (n_specific + 1));
+                next = heap_rows;
+                row = heap_rows + n_specific + 1;
+        }
+
+        /* next[j]: whether general[i + 1..] covers specific[j..] */
+        for (gsize j = 0; j <= n_specific; j++) {
+                next[j] = j == n_specific;
+        }
+
+        for (gsize i = n_general; i-- > 0;) {
+                gboolean *swap = NULL;
+                gchar c = general[i];
+
+                if (c == '*') {
+                        /* Consume nothing, or one more token of specific */
+                        row[n_specific] = next[n_specific];
+                        for (gsize j = n_specific; j-- > 0;) {
+                                row[j] = next[j] || row[j + 1];
+                        }
+                } else {
+                        row[n_specific] = FALSE;
+                        for (gsize j = 0; j < n_specific; j++) {
+                                gchar s = specific[j];
+
+                                if (c == '?') {
+                                        row[j] = s != '*' && next[j + 1];
+                                } else {
+                                        row[j] = s == c && next[j + 1];
+                                }
+                        }
+                }
+
+                swap = next;
+                next = row;
+                row = swap;
+        }
+
+        return next[0];
+}
+
+/**
+ * modalias_cover_index_add:
+ *
+ * Make the rule available for covering later candidates
+ */
+static void modalias_cover_index_add(ModaliasCoverIndex *index, ModaliasRule *rule)
+{
+        GPtrArray *bucket = NULL;
+        gchar *prefix = NULL;
+        gboolean known_length = FALSE;
+
+        prefix = g_strndup(rule->match, rule->n_prefix);
+        bucket = g_hash_table_lookup(index->buckets, prefix);
+        if (!bucket) {
+                bucket = g_ptr_array_new();
+                g_hash_table_insert(index->buckets, prefix, bucket);
+        } else {
+                g_free(prefix);
+        }
+        g_ptr_array_add(bucket, rule);
+
+        for (guint i = 0; i < index->prefix_lengths->len && !known_length; i++) {
+                known_length = g_array_index(index->prefix_lengths, guint, i) == rule->n_prefix;
+        }
+        if (!known_length) {
+                g_array_append_val(index->prefix_lengths, rule->n_prefix);
+        }
+}
+
+/**
+ * modalias_cover_index_covers:
+ *
+ * Determine whether any rule in the index, for the same driver and package,
+ * covers every match of the rule
+ */
+static gboolean modalias_cover_index_covers(ModaliasCoverIndex *index, ModaliasRule *rule)
+{
+        gsize length = strlen(rule->match);
+
+        for (guint i = 0; i < index->prefix_lengths->len; i++) {
+                guint n_prefix = g_array_index(index->prefix_lengths, guint, i);
+                GPtrArray *bucket = NULL;
+                gchar saved = 0;
+
+                if (n_prefix > length) {
+                        continue;
+                }
+
+                /* Look the prefix up in place */
+                saved = rule->match[n_prefix];
+                rule->match[n_prefix] = '\0';
+                bucket = g_hash_table_lookup(index->buckets, rule->match);
+                rule->match[n_prefix] = saved;
+
+                if (!bucket) {
+                        continue;
+                }
+
+                for (guint j = 0; j < bucket->len; j++) {
+                        ModaliasRule *general = bucket->pdata[j];
+
+                        if (general->driver == rule->driver && general->package == rule->package &&
+                            modalias_pattern_covers(general->match, rule->match)) {
+                                return TRUE;
+                        }
+                }
+        }
+
+        return FALSE;
+}
+
+/**
+ * modalias_rule_sort_generality:
+ *
+ * Order rules from the most general to the most specific, i.e. by the
+ * fewest literal characters and then the most `*` wildcards.
+ */
+static gint modalias_rule_sort_generality(gconstpointer a, gconstpointer b)
+{
+        const ModaliasRule *ruleA = *(ModaliasRule **)a;
+        const ModaliasRule *ruleB = *(ModaliasRule **)b;
+
+        if (ruleA->n_literals != ruleB->n_literals) {
+                return ruleA->n_literals < ruleB->n_literals ? -1 : 1;
+        }
+        if (ruleA->n_stars != ruleB->n_stars) {
+                return ruleA->n_stars > ruleB->n_stars ? -1 : 1;
+        }
+
+        return strcmp(ruleA->match, ruleB->match);
+}
+
+static gint modalias_rule_sort_match(gconstpointer a, gconstpointer b)
+{
+        const ModaliasRule *ruleA = *(ModaliasRule **)a;
+        const ModaliasRule *ruleB = *(ModaliasRule **)b;
+
+        return strcmp(ruleA->match, ruleB->match);
+}
+
+/**
+ * modalias_set_dedupe:
+ *
+ * Remove every rule whose match is repeated later on. As when the file is
+ * loaded, the last driver and package given for a match replace those of
+ * the earlier rule.
+ */
+static void modalias_set_dedupe(ModaliasSet *self)
+{
+        g_autoptr(GHashTable) positions = NULL;
+        GPtrArray *unique = NULL;
+
+        positions = g_hash_table_new(g_str_hash, g_str_equal);
+        unique = g_ptr_array_new_full(self->rules->len, modalias_rule_free);
+
+        for (guint i = 0; i < self->rules->len; i++) {
+                ModaliasRule *rule = self->rules->pdata[i];
+                guint position = 0;
+
+                self->rules->pdata[i] = NULL;
+
+                position = GPOINTER_TO_UINT(g_hash_table_lookup(positions, rule->match));
+                if (position > 0) {
+                        ModaliasRule *earlier = unique->pdata[position - 1];
+
+                        earlier->driver = rule->driver;
+                        earlier->package = rule->package;
+                        modalias_rule_free(rule);
+                        continue;
+                }
+
+                g_ptr_array_add(unique, rule);
+                g_hash_table_insert(positions, rule->match, GUINT_TO_POINTER(unique->len));
+        }
+
+        g_ptr_array_unref(self->rules);
+        self->rules = unique;
+}
+
+/**
+ * modalias_set_optimize:
+ *
+ * Remove every rule that can't change the outcome of a lookup, i.e. those
+ * replaced by a later rule with the same match, and those whose matches are
+ * all covered by another rule for the same driver and package. The
+ * remaining rules are sorted by their match, keeping rules for similar
+ * devices together.
+ *
+ * Every modalias matched by the original set is matched by the optimised
+ * set with the same driver and package, and vice versa.
+ *
+ * Returns: The number of rules removed
+ */
+guint modalias_set_optimize(ModaliasSet *self)
+{
+        g_autoptr(GPtrArray) kept = NULL;
+        g_autoptr(GPtrArray) candidates = NULL;
+        ModaliasCoverIndex index = { 0 };
+        guint n_rules = 0;
+
+        g_return_val_if_fail(self != NULL, 0);
+
+        n_rules = self->rules->len;
+        modalias_set_dedupe(self);
+
+        for (guint i = 0; i < self->rules->len; i++) {
+                ModaliasRule *rule = self->rules->pdata[i];
+
+                rule->n_literals = rule->n_stars = 0;
+                rule->n_prefix = (guint)strcspn(rule->match, "*?");
+                for (const gchar *c = rule->match; *c; c++) {
+                        if (*c == '*') {
+                                ++rule->n_stars;
+                        } else if (*c != '?') {
+                                ++rule->n_literals;
+                        }
+                }
+        }
+
+        /* A rule can only be covered by one at least as general, so keeping
+         * the most general rules first means that no kept rule is ever
+         * covered by one seen later. */
+        candidates = g_ptr_array_new_with_free_func(modalias_rule_free);
+        for (guint i = 0; i < self->rules->len; i++) {
+                g_ptr_array_add(candidates, self->rules->pdata[i]);
+                self->rules->pdata[i] = NULL;
+        }
+        g_ptr_array_sort(candidates, modalias_rule_sort_generality);
+
+        index.buckets = g_hash_table_new_full(g_str_hash,
+                                              g_str_equal,
+                                              g_free,
+                                              (GDestroyNotify)g_ptr_array_unref);
+        index.prefix_lengths = g_array_new(FALSE, FALSE, sizeof(guint));
+
+        kept = g_ptr_array_new_with_free_func(modalias_rule_free);
+        for (guint i = 0; i < candidates->len; i++) {
+                ModaliasRule *rule = candidates->pdata[i];
+
+                if (modalias_cover_index_covers(&index, rule)) {
+                        continue;
+                }
+
+                modalias_cover_index_add(&index, rule);
+                g_ptr_array_add(kept, rule);
+                candidates->pdata[i] = NULL;
+        }
+
+        g_hash_table_unref(index.buckets);
+        g_array_unref(index.prefix_lengths);
+
+        g_ptr_array_sort(kept, modalias_rule_sort_match);
+
+        g_ptr_array_unref(self->rules);
+        self->rules = g_steal_pointer(&kept);
+
+        return n_rules - self->rules->len;
+}
+
+/**
+ * modalias_set_write:
+ * @fileh: File to write the `.modaliases` file contents to
+ *
+ * Returns: TRUE if every rule was written
+ */
+gboolean modalias_set_write(ModaliasSet *self, FILE *fileh)
+{
+        g_return_val_if_fail(self != NULL, FALSE);
+
+        for (guint i = 0; i < self->rules->len; i++) {
+                ModaliasRule *rule = self->rules->pdata[i];
+                int written = 0;
+
+                written = fprintf(fileh,
+                                  "alias %s %s %s\n",
+                                  rule->match,
+                                  rule->driver,
+                                  rule->package);
+                if (written < 0) {
+                        return FALSE;
+                }
+        }
+
+        return TRUE;
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
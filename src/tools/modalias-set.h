@@ -0,0 +1,51 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Linux Driver Management Developers, Solus Project
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#pragma once
+
+#include <glib.h>
+#include <stdio.h>
+
+#include "../lib/util.h"
+
+/*
+ * ModaliasSet
+ *
+ * The rules gathered for a `.modaliases` file, allowing them to be
+ * optimised before they are written out.
+ */
+typedef struct ModaliasSet ModaliasSet;
+
+ModaliasSet *modalias_set_new(void);
+void modalias_set_free(ModaliasSet *set);
+
+void modalias_set_add(ModaliasSet *set, const gchar *match, const gchar *driver,
+                      const gchar *package);
+guint modalias_set_size(ModaliasSet *set);
+guint modalias_set_optimize(ModaliasSet *set);
+gboolean modalias_set_write(ModaliasSet *set, FILE *fileh);
+
+gboolean modalias_pattern_covers(const gchar *general, const gchar *specific);
+
+DEF_AUTOFREE(ModaliasSet, modalias_set_free)
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
@@ -0,0 +1,391 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Linux Driver Management Developers, Solus Project
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <libkmod.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../lib/util.h"
+#include "module-probe.h"
+
+typedef struct kmod_ctx kmod_ctx;
+typedef struct kmod_module kmod_module;
+typedef struct kmod_list kmod_list;
+
+DEF_AUTOFREE(kmod_ctx, kmod_unref)
+DEF_AUTOFREE(kmod_module, kmod_module_unref)
+DEF_AUTOFREE(kmod_list, kmod_module_info_free_list)
+
+/*
+ * Modules waiting to be probed, claimed in order by each worker
+ */
+typedef struct ModuleProbeQueue {
+        ModuleProbe *probes;
+        guint n_probes;
+        gint next;
+} ModuleProbeQueue;
+
+/**
+ * module_probe_init:
+ *
+ * Prepare to probe the module at the given path on behalf of the package
+ */
+void module_probe_init(ModuleProbe *probe, const gchar *package, const gchar *path)
+{
+        memset(probe, 0, sizeof(ModuleProbe));
+        probe->package = package;
+        probe->path = g_strdup(path);
+        probe->aliases = g_ptr_array_new_with_free_func(g_free);
+}
+
+/**
+ * module_probe_clear:
+ *
+ * Free the contents of the probe, but not the probe itself
+ */
+void module_probe_clear(ModuleProbe *probe)
+{
+        g_clear_pointer(&probe->path, g_free);
+        g_clear_pointer(&probe->name, g_free);
+        g_clear_pointer(&probe->aliases, g_ptr_array_unref);
+}
+
+/**
+ * module_path_is_kernel_module:
+ *
+ * Determine whether the path names a kernel module, compressed or otherwise.
+ * Compressed modules can only be probed if libkmod was built to support them.
+ */
+gboolean module_path_is_kernel_module(const gchar *path)
+{
+        static const gchar *suffixes[] = { ".ko", ".ko.xz", ".ko.zst", ".ko.gz" };
+
+        for (guint i = 0; i < G_N_ELEMENTS(suffixes); i++) {
+                if (g_str_has_suffix(path, suffixes[i])) {
+                        return TRUE;
+                }
+        }
+
+        return FALSE;
+}
+
+/**
+ * Examine just one kmod module, storing each of its aliases
+ */
+static void module_probe_run(kmod_ctx *ctx, ModuleProbe *probe)
+{
+        autofree(kmod_module) *module = NULL;
+        autofree(kmod_list) *list = NULL;
+        kmod_list *iter = NULL;
+        int ret = 0;
+
+        ret = kmod_module_new_from_path(ctx, probe->path, &module);
+        if (ret != 0) {
+                fprintf(stderr, "Couldn't open module: %s %s\n", probe->path, strerror(-ret));
+                return;
+        }
+
+        probe->name = g_strdup(kmod_module_get_name(module));
+
+        /* Attempt probe */
+        if (kmod_module_get_info(module, &list) < 0) {
+                fprintf(stderr, "Couldn't probe module '%s'\n", probe->name);
+                return;
+        }
+
+        /* Walk all the aliases now */
+        kmod_list_foreach(iter, list)
+        {
+                const char *key = kmod_module_info_get_key(iter);
+                if (!key || !g_str_equal(key, "alias")) {
+                        continue;
+                }
+                g_ptr_array_add(probe->aliases, g_strdup(kmod_module_info_get_value(iter)));
+        }
+
+        probe->success = TRUE;
+}
+
+/**
+ * Probe modules from the queue until none are left, using a kmod context of
+ * our own as they can't be shared between threads.
+ */
+static gpointer module_probe_worker(gpointer userdata)
+{
+        ModuleProbeQueue *queue = userdata;
+        autofree(kmod_ctx) *ctx = NULL;
+
+        /* Open kmod context with no host kernel knowledge */
+        ctx = kmod_new(NULL, NULL);
+        if (!ctx) {
+                fprintf(stderr, "Cannot init kmod: %s\n", strerror(errno));
+                return NULL;
+        }
+
+        for (;;) {
+                guint i = (guint)g_atomic_int_add(&queue->next, 1);
+
+                if (i >= queue->n_probes) {
+                        break;
+                }
+                module_probe_run(ctx, &queue->probes[i]);
+        }
+
+        return NULL;
+}
+
+/**
+ * module_probe_all:
+ * @n_jobs: Maximum number of modules to probe at once
+ *
+ * Probe every module, spreading them across a pool of worker threads. The
+ * results don't depend on the number of workers, as each is stored within
+ * its own probe.
+ *
+ * Returns: TRUE if every module was probed successfully
+ */
+gboolean module_probe_all(ModuleProbe *probes, guint n_probes, guint n_jobs)
+{
+        ModuleProbeQueue queue = {
+                .probes = probes,
+                .n_probes = n_probes,
+                .next = 0,
+        };
+        GThread **workers = NULL;
+
+        n_jobs = CLAMP(n_jobs, 1, MAX(n_probes, 1));
+
+        if (n_jobs == 1) {
+                module_probe_worker(&queue);
+        } else {
+                workers = g_new0(GThread *, n_jobs);
+                for (guint i = 0; i < n_jobs; i++) {
+                        workers[i] = g_thread_new("mkmodaliases", module_probe_worker, &queue);
+                }
+                for (guint i = 0; i < n_jobs; i++) {
+                        g_thread_join(workers[i]);
+                }
+                g_free(workers);
+        }
+
+        for (guint i = 0; i < n_probes; i++) {
+                if (!probes[i].success) {
+                        return FALSE;
+                }
+        }
+
+        return TRUE;
+}
+
+/**
+ * module_name_from_path:
+ *
+ * Find the name of a module from its path, or a name as it was given, in the
+ * same form as kmod: without any directory or suffix, and using underscores
+ * in place of dashes.
+ */
+gchar *module_name_from_path(const gchar *path)
+{
+        const gchar *basename = strrchr(path, '/');
+        gchar *ret = NULL;
+
+        basename = basename ? basename + 1 : path;
+        ret = g_strndup(basename, strcspn(basename, "."));
+        g_strdelimit(ret, "-", '_');
+
+        return ret;
+}
+
+/**
+ * Read one of the indexes written by depmod into the directory, preferring
+ * the text form. Otherwise the binary form is read, which libkmod dumps as
+ * text ordered by key.
+ */
+static gchar *module_index_read(kmod_ctx *ctx, const gchar *directory, const gchar *name,
+                                enum kmod_index type)
+{
+        g_autofree gchar *path = NULL;
+        g_autofree gchar *dump_path = NULL;
+        gchar *contents = NULL;
+        int fd = -1;
+
+        path = g_build_filename(directory, name, NULL);
+        if (g_file_get_contents(path, &contents, NULL, NULL)) {
+                return contents;
+        }
+
+        fd = g_file_open_tmp("mkmodaliases-XXXXXX", &dump_path, NULL);
+        if (fd < 0) {
+                return NULL;
+        }
+        if (kmod_dump_index(ctx, type, fd) == 0) {
+                g_file_get_contents(dump_path, &contents, NULL, NULL);
+        }
+        close(fd);
+        unlink(dump_path);
+
+        return contents;
+}
+
+/**
+ * Store each alias of modules.alias by the name of its module, in the order
+ * depmod wrote them. The strings remain within the contents.
+ */
+static void module_index_parse_aliases(gchar *contents, GHashTable *aliases)
+{
+        gchar *line = contents;
+
+        while (line && *line) {
+                gchar *end = strchr(line, '\n');
+                gchar *match = NULL, *module = NULL;
+                GPtrArray *values = NULL;
+
+                if (end) {
+                        *end = '\0';
+                }
+
+                /* alias $match $module */
+                module = g_str_has_prefix(line, "alias ") ? strrchr(line, ' ') : NULL;
+                if (module && module > line + 5) {
+                        *module++ = '\0';
+                        match = line + 6;
+
+                        values = g_hash_table_lookup(aliases, module);
+                        if (!values) {
+                                values = g_ptr_array_new();
+                                g_hash_table_insert(aliases, module, values);
+                        }
+                        g_ptr_array_add(values, match);
+                }
+
+                line = end ? end + 1 : NULL;
+        }
+}
+
+/**
+ * Find the name of every module known to depmod from modules.dep, each
+ * line starting with either the path of the module or, when dumped from
+ * the binary form, its name.
+ */
+static void module_index_parse_modules(const gchar *contents, GHashTable *modules)
+{
+        const gchar *line = contents;
+
+        while (line && *line) {
+                const gchar *end = strchr(line, '\n');
+                g_autofree gchar *key = NULL;
+
+                key = g_strndup(line, strcspn(line, ": \n"));
+                if (*key != '\0' && *key != '#') {
+                        g_hash_table_add(modules, module_name_from_path(key));
+                }
+
+                line = end ? end + 1 : NULL;
+        }
+}
+
+/**
+ * module_probe_all_from_index:
+ * @directory: Module tree containing the depmod indexes, i.e. /lib/modules/$version
+ * @ordered: Whether the aliases of each module must be in the order declared
+ *
+ * Find the aliases of every module from the indexes already written by
+ * depmod, instead of examining each module. Modules may be given by path
+ * or by name, and must be known to depmod.
+ *
+ * depmod writes modules.alias in the same order as the aliases are found
+ * within each module, so the results are identical to #module_probe_all.
+ * When only modules.alias.bin is available, the aliases of each module are
+ * instead ordered by their match, so that is refused when @ordered is set.
+ *
+ * Returns: TRUE if every module was found
+ */
+gboolean module_probe_all_from_index(ModuleProbe *probes, guint n_probes, const gchar *directory,
+                                     gboolean ordered)
+{
+        autofree(kmod_ctx) *ctx = NULL;
+        g_autoptr(GHashTable) aliases = NULL;
+        g_autoptr(GHashTable) modules = NULL;
+        g_autofree gchar *alias_contents = NULL;
+        g_autofree gchar *dep_contents = NULL;
+        g_autofree gchar *alias_path = NULL;
+        gboolean ret = TRUE;
+
+        alias_path = g_build_filename(directory, "modules.alias", NULL);
+        if (ordered && access(alias_path, F_OK) != 0) {
+                fprintf(stderr,
+                        "No modules.alias found in %s, and modules.alias.bin doesn't keep the "
+                        "order of aliases: use --optimize, or examine the modules instead\n",
+                        directory);
+                return FALSE;
+        }
+
+        ctx = kmod_new(directory, NULL);
+        if (!ctx) {
+                fprintf(stderr, "Cannot init kmod: %s\n", strerror(errno));
+                return FALSE;
+        }
+
+        alias_contents =
+            module_index_read(ctx, directory, "modules.alias", KMOD_INDEX_MODULES_ALIAS);
+        dep_contents = module_index_read(ctx, directory, "modules.dep", KMOD_INDEX_MODULES_DEP);
+        if (!alias_contents || !dep_contents) {
+                fprintf(stderr, "No module index found in %s, run depmod first\n", directory);
+                return FALSE;
+        }
+
+        aliases = g_hash_table_new_full(g_str_hash,
+                                        g_str_equal,
+                                        NULL,
+                                        (GDestroyNotify)g_ptr_array_unref);
+        module_index_parse_aliases(alias_contents, aliases);
+
+        /* Modules without any aliases are only listed here */
+        modules = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+        module_index_parse_modules(dep_contents, modules);
+
+        for (guint i = 0; i < n_probes; i++) {
+                ModuleProbe *probe = &probes[i];
+                GPtrArray *values = NULL;
+
+                probe->name = module_name_from_path(probe->path);
+                if (!g_hash_table_contains(modules, probe->name)) {
+                        fprintf(stderr, "Module not found in index: %s\n", probe->path);
+                        ret = FALSE;
+                        continue;
+                }
+
+                values = g_hash_table_lookup(aliases, probe->name);
+                for (guint j = 0; values && j < values->len; j++) {
+                        g_ptr_array_add(probe->aliases, g_strdup(values->pdata[j]));
+                }
+                probe->success = TRUE;
+        }
+
+        return ret;
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
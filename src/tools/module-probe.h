@@ -0,0 +1,51 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Linux Driver Management Developers, Solus Project
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+/*
+ * ModuleProbe
+ *
+ * A kernel module to be examined for the aliases it declares, and the
+ * results of doing so.
+ */
+typedef struct ModuleProbe {
+        const gchar *package; /* Package owning the module */
+        gchar *path;          /* Path to the .ko file, possibly compressed */
+        gchar *name;          /* Module name, once probed */
+        GPtrArray *aliases;   /* Each alias in the order declared, once probed */
+        gboolean success;
+} ModuleProbe;
+
+void module_probe_init(ModuleProbe *probe, const gchar *package, const gchar *path);
+void module_probe_clear(ModuleProbe *probe);
+
+gboolean module_probe_all(ModuleProbe *probes, guint n_probes, guint n_jobs);
+gboolean module_probe_all_from_index(ModuleProbe *probes, guint n_probes, const gchar *directory,
+                                     gboolean ordered);
+
+gboolean module_path_is_kernel_module(const gchar *path);
+gchar *module_name_from_path(const gchar *path);
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
@@ -0,0 +1,282 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Linux Driver Management Developers, Solus Project
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <umockdev.h>
+
+#include "ldm.h"
+#include "util.h"
+
+DEF_AUTOFREE(UMockdevTestbed, g_object_unref)
+
+#define BENCH_ITERATIONS 10
+
+/* Size of the synthetic system, resembling a large server */
+#define BENCH_PCI_BUSES 16
+#define BENCH_PCI_FUNCTIONS 64
+#define BENCH_USB_DEVICES 8
+#define BENCH_USB_INTERFACES 4
+
+/**
+ * Add USB devices, each with a handful of interfaces, beneath a controller
+ */
+static guint populate_usb(UMockdevTestbed *bed, const gchar *controller, guint bus)
+{
+        g_autofree gchar *root_name = NULL;
+        g_autofree gchar *root = NULL;
+        guint ret = 0;
+
+        root_name = g_strdup_printf("usb%u", bus);
+        root = umockdev_testbed_add_device(bed,
+                                           "usb",
+                                           root_name,
+                                           controller,
+                                           "idVendor",
+                                           "1d6b",
+                                           "idProduct",
+                                           "0002",
+                                           NULL,
+                                           "DEVTYPE",
+                                           "usb_device",
+                                           NULL);
+        if (!root) {
+                return 0;
+        }
+        ++ret;
+
+        for (guint i = 0; i < BENCH_USB_DEVICES; i++) {
+                g_autofree gchar *name = NULL;
+                g_autofree gchar *device = NULL;
+
+                name = g_strdup_printf("%u-%u", bus, i + 1);
+                device = umockdev_testbed_add_device(bed,
+                                                     "usb",
+                                                     name,
+                                                     root,
+                                                     "idVendor",
+                                                     "046d",
+                                                     "idProduct",
+                                                     "c52b",
+                                                     NULL,
+                                                     "DEVTYPE",
+                                                     "usb_device",
+                                                     "ID_VENDOR_FROM_DATABASE",
+                                                     "Logitech, Inc.",
+                                                     NULL);
+                if (!device) {
+                        continue;
+                }
+                ++ret;
+
+                for (guint j = 0; j < BENCH_USB_INTERFACES; j++) {
+                        g_autofree gchar *interface_name = NULL;
+                        g_autofree gchar *modalias = NULL;
+                        g_autofree gchar *interface = NULL;
+
+                        interface_name = g_strdup_printf("%s:1.%u", name, j);
+                        modalias = g_strdup_printf(
+                            "usb:v046DpC52Bd1211dc00dsc00dp00ic03isc01ip%02uin%02u", j, j);
+                        interface = umockdev_testbed_add_device(bed,
+                                                                "usb",
+                                                                interface_name,
+                                                                device,
+                                                                "modalias",
+                                                                modalias,
+                                                                NULL,
+                                                                "DEVTYPE",
+                                                                "usb_interface",
+                                                                NULL);
+                        if (interface) {
+                                ++ret;
+                        }
+                }
+        }
+
+        return ret;
+}
+
+/**
+ * Populate the testbed with PCI functions across several buses, giving
+ * the first function of each bus a USB controller.
+ */
+static guint populate_testbed(UMockdevTestbed *bed)
+{
+        guint ret = 0;
+
+        for (guint bus = 0; bus < BENCH_PCI_BUSES; bus++) {
+                for (guint i = 0; i < BENCH_PCI_FUNCTIONS; i++) {
+                        g_autofree gchar *name = NULL;
+                        g_autofree gchar *modalias = NULL;
+                        g_autofree gchar *device = NULL;
+
+                        name = g_strdup_printf("0000:%02x:%02x.%x", bus, i / 8, i % 8);
+                        modalias = g_strdup_printf(
+                            "pci:v00008086d0000%04Xsv00008086sd00000000bc0Csc03i30", i);
+                        device = umockdev_testbed_add_device(bed,
+                                                             "pci",
+                                                             name,
+                                                             NULL,
+                                                             "vendor",
+                                                             "0x8086",
+                                                             "device",
+                                                             "0x1234",
+                                                             "class",
+                                                             "0x0c0330",
+                                                             "modalias",
+                                                             modalias,
+                                                             NULL,
+                                                             "PCI_CLASS",
+                                                             "C0330",
+                                                             "ID_VENDOR_FROM_DATABASE",
+                                                             "Intel Corporation",
+                                                             NULL);
+                        if (!device) {
+                                continue;
+                        }
+                        ++ret;
+
+                        if (i == 0) {
+                                ret += populate_usb(bed, device, bus + 1);
+                        }
+                }
+        }
+
+        return ret;
+}
+
+/**
+ * Construct a manager, returning the number of devices it found
+ */
+static guint enumerate(LdmManagerFlags flags, const gchar *snapshot_path)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        g_autoptr(GPtrArray) devices = NULL;
+
+        manager = g_object_new(LDM_TYPE_MANAGER,
+                               "flags",
+                               flags,
+                               "snapshot-path",
+                               snapshot_path,
+                               NULL);
+        devices = ldm_manager_get_devices(manager, LDM_DEVICE_TYPE_ANY);
+
+        return devices->len;
+}
+
+int main(__ldm_unused__ int argc, __ldm_unused__ char **argv)
+{
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autofree gchar *directory = NULL;
+        g_autofree gchar *snapshot_path = NULL;
+        static const struct {
+                const gchar *name;
+                LdmManagerFlags flags;
+                gboolean cold; /* Remove the snapshot before each manager */
+        } modes[] = {
+                { "Serial         ", LDM_MANAGER_FLAGS_NO_MONITOR, FALSE },
+                { "Parallel       ",
+                  LDM_MANAGER_FLAGS_NO_MONITOR | LDM_MANAGER_FLAGS_PARALLEL_ENUMERATE,
+                  FALSE },
+                { "Snapshot (cold)",
+                  LDM_MANAGER_FLAGS_NO_MONITOR | LDM_MANAGER_FLAGS_SNAPSHOT,
+                  TRUE },
+                { "Snapshot (warm)",
+                  LDM_MANAGER_FLAGS_NO_MONITOR | LDM_MANAGER_FLAGS_SNAPSHOT,
+                  FALSE },
+        };
+        guint n_sysfs = 0, n_devices = 0;
+        gint64 serial = 0;
+        int ret = EXIT_FAILURE;
+
+        if (!umockdev_in_mock_environment()) {
+                fprintf(stderr, "Must be run within umockdev-wrapper\n");
+                return EXIT_FAILURE;
+        }
+
+        directory = g_dir_make_tmp("ldm-bench-XXXXXX", NULL);
+        if (!directory) {
+                fprintf(stderr, "Failed to create temporary directory\n");
+                return EXIT_FAILURE;
+        }
+        snapshot_path = g_build_filename(directory, "devices.snapshot", NULL);
+
+        bed = umockdev_testbed_new();
+        n_sysfs = populate_testbed(bed);
+
+        /* Warm the page cache, and find the number of top level devices */
+        n_devices = enumerate(modes[0].flags, snapshot_path);
+
+        fprintf(stdout,
+                "Sysfs devices: %u, top level devices: %u, processors: %u\n",
+                n_sysfs,
+                n_devices,
+                g_get_num_processors());
+
+        for (guint i = 0; i < G_N_ELEMENTS(modes); i++) {
+                gint64 elapsed = 0;
+
+                for (guint n = 0; n < BENCH_ITERATIONS; n++) {
+                        gint64 start = 0;
+                        guint found = 0;
+
+                        if (modes[i].cold) {
+                                g_unlink(snapshot_path);
+                        }
+
+                        start = g_get_monotonic_time();
+                        found = enumerate(modes[i].flags, snapshot_path);
+                        elapsed += g_get_monotonic_time() - start;
+
+                        if (found != n_devices) {
+                                fprintf(stderr,
+                                        "%s enumeration found other devices\n",
+                                        modes[i].name);
+                                goto cleanup;
+                        }
+                }
+
+                /* Every other mode is compared against plain enumeration */
+                if (i == 0) {
+                        serial = MAX(elapsed, 1);
+                }
+
+                fprintf(stdout,
+                        "%s : %.2f ms/manager (%.2fx serial)\n",
+                        modes[i].name,
+                        (gdouble)elapsed / 1000.0 / BENCH_ITERATIONS,
+                        (gdouble)serial / (gdouble)MAX(elapsed, 1));
+        }
+
+        ret = EXIT_SUCCESS;
+
+cleanup:
+        g_unlink(snapshot_path);
+        g_rmdir(directory);
+
+        return ret;
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
@@ -0,0 +1,138 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Linux Driver Management Developers, Solus Project
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <umockdev.h>
+
+#include "ldm.h"
+#include "util.h"
+
+DEF_AUTOFREE(UMockdevTestbed, g_object_unref)
+
+#define BENCH_ITERATIONS 10
+
+/* Number of display controllers, among every other PCI function */
+#define BENCH_GPUS 2
+
+/**
+ * Add a PCI function of the given class, named by its position
+ */
+static gboolean add_pci_function(UMockdevTestbed *bed, guint index, const gchar *pci_class)
+{
+        g_autofree gchar *name = NULL;
+        g_autofree gchar *device = NULL;
+
+        name = g_strdup_printf("0000:%02x:%02x.%x", index / 256, (index / 8) % 32, index % 8);
+        device = umockdev_testbed_add_device(bed,
+                                             "pci",
+                                             name,
+                                             NULL,
+                                             "vendor",
+                                             "0x8086",
+                                             "device",
+                                             "0x1234",
+                                             "class",
+                                             pci_class,
+                                             NULL,
+                                             "ID_VENDOR_FROM_DATABASE",
+                                             "Intel Corporation",
+                                             NULL);
+
+        return device != NULL;
+}
+
+/**
+ * Time constructing a manager, returning the number of devices it found
+ */
+static guint time_manager(LdmManagerFlags flags, gint64 *elapsed)
+{
+        guint ret = 0;
+        gint64 start = 0;
+
+        start = g_get_monotonic_time();
+        for (guint n = 0; n < BENCH_ITERATIONS; n++) {
+                g_autoptr(LdmManager) manager = NULL;
+                g_autoptr(GPtrArray) devices = NULL;
+
+                manager = ldm_manager_new(flags);
+                devices = ldm_manager_get_devices(manager, LDM_DEVICE_TYPE_ANY);
+                ret = devices->len;
+        }
+        *elapsed = (g_get_monotonic_time() - start) / BENCH_ITERATIONS;
+
+        return ret;
+}
+
+int main(__ldm_unused__ int argc, __ldm_unused__ char **argv)
+{
+        autofree(UMockdevTestbed) *bed = NULL;
+        static const guint sizes[] = { 64, 256, 1024, 4096 };
+        guint n_functions = 0;
+
+        if (!umockdev_in_mock_environment()) {
+                fprintf(stderr, "Must be run within umockdev-wrapper\n");
+                return EXIT_FAILURE;
+        }
+
+        bed = umockdev_testbed_new();
+
+        /* The GPUs come first, the other functions grow around them */
+        for (; n_functions < BENCH_GPUS; n_functions++) {
+                if (!add_pci_function(bed, n_functions, "0x030000")) {
+                        fprintf(stderr, "Failed to add GPU\n");
+                        return EXIT_FAILURE;
+                }
+        }
+
+        for (guint i = 0; i < G_N_ELEMENTS(sizes); i++) {
+                gint64 full = 0, quick = 0;
+                guint n_quick = 0;
+
+                for (; n_functions < sizes[i]; n_functions++) {
+                        if (!add_pci_function(bed, n_functions, "0x0c0330")) {
+                                fprintf(stderr, "Failed to add PCI function\n");
+                                return EXIT_FAILURE;
+                        }
+                }
+
+                time_manager(LDM_MANAGER_FLAGS_NO_MONITOR, &full);
+                n_quick = time_manager(LDM_MANAGER_FLAGS_NO_MONITOR | LDM_MANAGER_FLAGS_GPU_QUICK,
+                                       &quick);
+                if (n_quick != BENCH_GPUS) {
+                        fprintf(stderr, "GPU enumeration found %u devices\n", n_quick);
+                        return EXIT_FAILURE;
+                }
+
+                fprintf(stdout,
+                        "PCI functions: %4u, full : %8.2f ms, GPU quick : %6.2f ms\n",
+                        n_functions,
+                        (gdouble)full / 1000.0,
+                        (gdouble)quick / 1000.0);
+        }
+
+        return EXIT_SUCCESS;
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
@@ -0,0 +1,162 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Linux Driver Management Developers, Solus Project
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+
+#include <glob.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ldm.h"
+#include "modalias-loader.h"
+#include "util.h"
+
+#define BENCH_ITERATIONS 10
+
+/* Copies of each test file, to resemble a full driver repository */
+#define BENCH_COPIES 16
+
+/**
+ * Populate a temporary directory with copies of the test data, returning
+ * the sorted paths of the copies.
+ */
+static GPtrArray *populate_directory(const gchar *directory)
+{
+        GPtrArray *ret = g_ptr_array_new_with_free_func(g_free);
+        glob_t glo = { 0 };
+
+        if (glob(TEST_DATA_ROOT "/*.modaliases", 0, NULL, &glo) != 0) {
+                return ret;
+        }
+
+        for (guint copy = 0; copy < BENCH_COPIES; copy++) {
+                for (size_t i = 0; i < glo.gl_pathc; i++) {
+                        g_autofree gchar *contents = NULL;
+                        g_autofree gchar *basename = NULL;
+                        g_autofree gchar *filename = NULL;
+                        gsize length = 0;
+
+                        if (!g_file_get_contents(glo.gl_pathv[i], &contents, &length, NULL)) {
+                                continue;
+                        }
+
+                        basename = g_path_get_basename(glo.gl_pathv[i]);
+                        filename = g_strdup_printf("%s/%02u-%s", directory, copy, basename);
+                        if (!g_file_set_contents(filename, contents, (gssize)length, NULL)) {
+                                continue;
+                        }
+                        g_ptr_array_add(ret, g_steal_pointer(&filename));
+                }
+        }
+
+        globfree(&glo);
+        g_ptr_array_sort(ret, (GCompareFunc)g_strcmp0);
+        return ret;
+}
+
+/**
+ * Load every path, ensuring the plugins come back in the same order
+ */
+static gboolean load_all(GPtrArray *paths, guint n_threads)
+{
+        g_autoptr(GPtrArray) plugins = NULL;
+
+        plugins = ldm_modalias_loader_load((gchar **)paths->pdata, paths->len, n_threads);
+
+        for (guint i = 0; i < paths->len; i++) {
+                g_autofree gchar *name = NULL;
+
+                if (!plugins->pdata[i]) {
+                        return FALSE;
+                }
+
+                name = g_path_get_basename(paths->pdata[i]);
+                name[strlen(name) - strlen(".modaliases")] = '\0';
+                if (!g_str_equal(ldm_plugin_get_name(plugins->pdata[i]), name)) {
+                        return FALSE;
+                }
+        }
+
+        return TRUE;
+}
+
+int main(__ldm_unused__ int argc, __ldm_unused__ char **argv)
+{
+        g_autoptr(GPtrArray) paths = NULL;
+        g_autofree gchar *directory = NULL;
+        guint thread_counts[] = { 1, 4, 0 };
+        int ret = EXIT_FAILURE;
+
+        directory = g_dir_make_tmp("ldm-bench-XXXXXX", NULL);
+        if (!directory) {
+                fprintf(stderr, "Failed to create temporary directory\n");
+                return EXIT_FAILURE;
+        }
+
+        paths = populate_directory(directory);
+        if (paths->len < 1) {
+                fprintf(stderr, "No test data found in %s\n", TEST_DATA_ROOT);
+                goto cleanup;
+        }
+
+        /* Warm the page cache (and modalias cache, if writable) first */
+        if (!load_all(paths, 1)) {
+                fprintf(stderr, "Failed to load modalias files\n");
+                goto cleanup;
+        }
+
+        fprintf(stdout, "Files: %u, processors: %u\n", paths->len, g_get_num_processors());
+
+        for (guint i = 0; i < G_N_ELEMENTS(thread_counts); i++) {
+                guint n_threads = thread_counts[i];
+                gint64 start = 0, elapsed = 0;
+
+                start = g_get_monotonic_time();
+                for (guint n = 0; n < BENCH_ITERATIONS; n++) {
+                        if (!load_all(paths, n_threads)) {
+                                fprintf(stderr, "Plugins loaded out of order\n");
+                                goto cleanup;
+                        }
+                }
+                elapsed = g_get_monotonic_time() - start;
+
+                fprintf(stdout,
+                        "%2u thread(s)%s : %.2f ms/directory\n",
+                        n_threads ? n_threads : g_get_num_processors(),
+                        n_threads ? "     " : " (all)",
+                        (gdouble)elapsed / 1000.0 / BENCH_ITERATIONS);
+        }
+
+        ret = EXIT_SUCCESS;
+
+cleanup:
+        for (guint i = 0; i < paths->len; i++) {
+                g_unlink(paths->pdata[i]);
+        }
+        g_rmdir(directory);
+
+        return ret;
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
@@ -0,0 +1,340 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Linux Driver Management Developers, Solus Project
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+
+#include <fnmatch.h>
+#include <glob.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "modalias-index.h"
+#include "modalias-matcher.h"
+#include "modalias-vendors.h"
+#include "util.h"
+
+#define BENCH_ITERATIONS 200
+
+/**
+ * Collect every `alias` pattern from all of the .modaliases files in the
+ * test data, giving us the merged NVIDIA + razer database.
+ */
+static GPtrArray *load_patterns(void)
+{
+        GPtrArray *ret = g_ptr_array_new_with_free_func(g_free);
+        glob_t glo = { 0 };
+
+        if (glob(TEST_DATA_ROOT "/*.modaliases", 0, NULL, &glo) != 0) {
+                return ret;
+        }
+
+        for (size_t i = 0; i < glo.gl_pathc; i++) {
+                g_autofree gchar *contents = NULL;
+                gchar **lines = NULL;
+
+                if (!g_file_get_contents(glo.gl_pathv[i], &contents, NULL, NULL)) {
+                        continue;
+                }
+
+                lines = g_strsplit(contents, "\n", -1);
+                for (guint j = 0; lines[j]; j++) {
+                        gchar **splits = g_strsplit(g_strstrip(lines[j]), " ", 4);
+
+                        if (g_strv_length(splits) == 4 && g_str_equal(splits[0], "alias")) {
+                                g_ptr_array_add(ret, g_strdup(splits[1]));
+                        }
+                        g_strfreev(splits);
+                }
+                g_strfreev(lines);
+        }
+
+        globfree(&glo);
+        return ret;
+}
+
+/**
+ * Collect every device modalias from the umockdev recordings in the test data
+ */
+static GPtrArray *load_devices(void)
+{
+        GPtrArray *ret = g_ptr_array_new_with_free_func(g_free);
+        glob_t glo = { 0 };
+
+        if (glob(TEST_DATA_ROOT "/*.umockdev", 0, NULL, &glo) != 0) {
+                return ret;
+        }
+
+        for (size_t i = 0; i < glo.gl_pathc; i++) {
+                g_autofree gchar *contents = NULL;
+                gchar **lines = NULL;
+
+                if (!g_file_get_contents(glo.gl_pathv[i], &contents, NULL, NULL)) {
+                        continue;
+                }
+
+                lines = g_strsplit(contents, "\n", -1);
+                for (guint j = 0; lines[j]; j++) {
+                        if (g_str_has_prefix(lines[j], "A: modalias=")) {
+                                g_ptr_array_add(ret, g_strdup(lines[j] + strlen("A: modalias=")));
+                        }
+                }
+                g_strfreev(lines);
+        }
+
+        globfree(&glo);
+        return ret;
+}
+
+/**
+ * Existing behaviour: fnmatch() every pattern in turn
+ */
+static guint match_loop(GPtrArray *patterns, const gchar *device, GPtrArray *results)
+{
+        for (guint i = 0; i < patterns->len; i++) {
+                if (fnmatch(patterns->pdata[i], device, 0) == 0) {
+                        g_ptr_array_add(results, patterns->pdata[i]);
+                }
+        }
+        return results->len;
+}
+
+/**
+ * Count each test made while profiling the index
+ */
+static void count_eval(__ldm_unused__ const gchar *match, __ldm_unused__ gpointer owner,
+                       __ldm_unused__ gboolean matched, __ldm_unused__ guint64 nanoseconds,
+                       gpointer userdata)
+{
+        guint *n_evals = userdata;
+
+        ++(*n_evals);
+}
+
+/**
+ * Time index lookups for just those devices on the given bus, as the mixed
+ * set is otherwise dominated by whichever bus has the most devices.
+ *
+ * Returns: Nanoseconds per lookup, or 0 if no device is on the bus
+ */
+static gdouble time_index_bus(LdmModaliasIndex *index, GPtrArray *devices, const gchar *bus,
+                              GPtrArray *results)
+{
+        gint64 start = 0;
+        guint n_lookups = 0;
+
+        start = g_get_monotonic_time();
+        for (guint n = 0; n < BENCH_ITERATIONS; n++) {
+                for (guint i = 0; i < devices->len; i++) {
+                        if (!g_str_has_prefix(devices->pdata[i], bus)) {
+                                continue;
+                        }
+                        g_ptr_array_set_size(results, 0);
+                        ldm_modalias_index_lookup(index, devices->pdata[i], results);
+                        ++n_lookups;
+                }
+        }
+
+        if (n_lookups == 0) {
+                return 0;
+        }
+        return (gdouble)(g_get_monotonic_time() - start) * 1000.0 / n_lookups;
+}
+
+int main(__ldm_unused__ int argc, __ldm_unused__ char **argv)
+{
+        g_autoptr(GPtrArray) patterns = NULL;
+        g_autoptr(GPtrArray) devices = NULL;
+        g_autoptr(GPtrArray) expected = NULL;
+        g_autoptr(GPtrArray) actual = NULL;
+        autofree(LdmModaliasMatcher) *matcher = NULL;
+        autofree(LdmModaliasIndex) *index = NULL;
+        LdmModaliasVendors vendors = { 0 };
+        gint64 start = 0, loop_time = 0, matcher_time = 0, compile_time = 0;
+        gint64 index_time = 0, index_build_time = 0, profile_time = 0;
+        gint64 filtered_time = 0;
+        gdouble pci_time = 0, usb_time = 0;
+        guint n_lookups = 0, n_matches = 0, n_evals = 0, n_rejected = 0;
+
+        patterns = load_patterns();
+        devices = load_devices();
+        if (patterns->len < 1 || devices->len < 1) {
+                fprintf(stderr, "No test data found in %s\n", TEST_DATA_ROOT);
+                return EXIT_FAILURE;
+        }
+
+        start = g_get_monotonic_time();
+        matcher = ldm_modalias_matcher_new();
+        for (guint i = 0; i < patterns->len; i++) {
+                ldm_modalias_matcher_add(matcher, patterns->pdata[i], patterns->pdata[i]);
+        }
+        compile_time = g_get_monotonic_time() - start;
+
+        start = g_get_monotonic_time();
+        index = ldm_modalias_index_new();
+        for (guint i = 0; i < patterns->len; i++) {
+                ldm_modalias_index_add(index, patterns->pdata[i], patterns->pdata[i]);
+        }
+        index_build_time = g_get_monotonic_time() - start;
+
+        ldm_modalias_vendors_init(&vendors);
+        for (guint i = 0; i < patterns->len; i++) {
+                ldm_modalias_vendors_add_match(&vendors, patterns->pdata[i]);
+        }
+
+        /* Both approaches must agree exactly before we time anything */
+        expected = g_ptr_array_new();
+        actual = g_ptr_array_new();
+        for (guint i = 0; i < devices->len; i++) {
+                g_ptr_array_set_size(expected, 0);
+                g_ptr_array_set_size(actual, 0);
+
+                n_matches += match_loop(patterns, devices->pdata[i], expected);
+                ldm_modalias_matcher_match(matcher, devices->pdata[i], actual);
+
+                if (expected->len != actual->len ||
+                    memcmp(expected->pdata, actual->pdata, sizeof(gpointer) * expected->len) != 0) {
+                        fprintf(stderr,
+                                "Matcher disagrees with fnmatch for %s\n",
+                                (const gchar *)devices->pdata[i]);
+                        return EXIT_FAILURE;
+                }
+
+                g_ptr_array_set_size(actual, 0);
+                ldm_modalias_index_lookup(index, devices->pdata[i], actual);
+
+                if (expected->len != actual->len ||
+                    memcmp(expected->pdata, actual->pdata, sizeof(gpointer) * expected->len) != 0) {
+                        fprintf(stderr,
+                                "Index disagrees with fnmatch for %s\n",
+                                (const gchar *)devices->pdata[i]);
+                        return EXIT_FAILURE;
+                }
+
+                if (!ldm_modalias_vendors_accepts(&vendors, devices->pdata[i])) {
+                        if (expected->len > 0) {
+                                fprintf(stderr,
+                                        "Vendor filter rejects matching %s\n",
+                                        (const gchar *)devices->pdata[i]);
+                                return EXIT_FAILURE;
+                        }
+                        ++n_rejected;
+                }
+        }
+
+        start = g_get_monotonic_time();
+        for (guint n = 0; n < BENCH_ITERATIONS; n++) {
+                for (guint i = 0; i < devices->len; i++) {
+                        g_ptr_array_set_size(expected, 0);
+                        match_loop(patterns, devices->pdata[i], expected);
+                }
+        }
+        loop_time = g_get_monotonic_time() - start;
+
+        start = g_get_monotonic_time();
+        for (guint n = 0; n < BENCH_ITERATIONS; n++) {
+                for (guint i = 0; i < devices->len; i++) {
+                        g_ptr_array_set_size(actual, 0);
+                        ldm_modalias_matcher_match(matcher, devices->pdata[i], actual);
+                }
+        }
+        matcher_time = g_get_monotonic_time() - start;
+
+        start = g_get_monotonic_time();
+        for (guint n = 0; n < BENCH_ITERATIONS; n++) {
+                for (guint i = 0; i < devices->len; i++) {
+                        g_ptr_array_set_size(actual, 0);
+                        ldm_modalias_index_lookup(index, devices->pdata[i], actual);
+                }
+        }
+        index_time = g_get_monotonic_time() - start;
+
+        start = g_get_monotonic_time();
+        for (guint n = 0; n < BENCH_ITERATIONS; n++) {
+                for (guint i = 0; i < devices->len; i++) {
+                        g_ptr_array_set_size(actual, 0);
+                        if (ldm_modalias_vendors_accepts(&vendors, devices->pdata[i])) {
+                                ldm_modalias_index_lookup(index, devices->pdata[i], actual);
+                        }
+                }
+        }
+        filtered_time = g_get_monotonic_time() - start;
+
+        pci_time = time_index_bus(index, devices, "pci:", actual);
+        usb_time = time_index_bus(index, devices, "usb:", actual);
+
+        /* Profiling tests each match individually, so only those sharing the
+         * bus and literal prefix of the device should ever reach fnmatch() */
+        ldm_modalias_index_set_eval_func(index, count_eval, &n_evals);
+        start = g_get_monotonic_time();
+        for (guint n = 0; n < BENCH_ITERATIONS; n++) {
+                for (guint i = 0; i < devices->len; i++) {
+                        g_ptr_array_set_size(actual, 0);
+                        ldm_modalias_index_lookup(index, devices->pdata[i], actual);
+                }
+        }
+        profile_time = g_get_monotonic_time() - start;
+        ldm_modalias_index_set_eval_func(index, NULL, NULL);
+
+        n_lookups = BENCH_ITERATIONS * devices->len;
+
+        fprintf(stdout,
+                "Rules: %u, device modaliases: %u, matches: %u\n",
+                patterns->len,
+                devices->len,
+                n_matches);
+        fprintf(stdout, "Compile time      : %" G_GINT64_FORMAT " us\n", compile_time);
+        fprintf(stdout,
+                "Index build time  : %" G_GINT64_FORMAT " us (%u keys)\n",
+                index_build_time,
+                ldm_modalias_index_n_keys(index));
+        fprintf(stdout,
+                "fnmatch() loop    : %.1f ns/lookup\n",
+                (gdouble)loop_time * 1000.0 / n_lookups);
+        fprintf(stdout,
+                "Compiled matcher  : %.1f ns/lookup\n",
+                (gdouble)matcher_time * 1000.0 / n_lookups);
+        fprintf(stdout,
+                "Key index         : %.1f ns/lookup\n",
+                (gdouble)index_time * 1000.0 / n_lookups);
+        fprintf(stdout,
+                "Vendor filtered   : %.1f ns/lookup (%u of %u modaliases rejected)\n",
+                (gdouble)filtered_time * 1000.0 / n_lookups,
+                n_rejected,
+                devices->len);
+        fprintf(stdout, "Key index (PCI)   : %.1f ns/lookup\n", pci_time);
+        fprintf(stdout, "Key index (USB)   : %.1f ns/lookup\n", usb_time);
+        fprintf(stdout,
+                "Profiled index    : %.1f ns/lookup (%.1f rules tested/lookup)\n",
+                (gdouble)profile_time * 1000.0 / n_lookups,
+                (gdouble)n_evals / n_lookups);
+        if (matcher_time > 0 && index_time > 0) {
+                fprintf(stdout,
+                        "Speedup           : %.1fx (matcher), %.1fx (index)\n",
+                        (gdouble)loop_time / (gdouble)matcher_time,
+                        (gdouble)loop_time / (gdouble)index_time);
+        }
+
+        return EXIT_SUCCESS;
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
@@ -0,0 +1,302 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Linux Driver Management Developers, Solus Project
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+
+#include <glob.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ldm-private.h"
+#include "modalias-rules.h"
+#include "util.h"
+
+#define BENCH_ITERATIONS 20
+
+/* Size of the generated database, far larger than any we ship */
+#define BENCH_LARGE_RULES 100000
+
+/*
+ * Count every allocation made by the process, including those made by GLib
+ * and GObject on our behalf, by interposing the allocator.
+ */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n_members, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static guint64 n_allocations = 0;
+
+void *malloc(size_t size)
+{
+        ++n_allocations;
+        return __libc_malloc(size);
+}
+
+void *calloc(size_t n_members, size_t size)
+{
+        ++n_allocations;
+        return __libc_calloc(n_members, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+        ++n_allocations;
+        return __libc_realloc(ptr, size);
+}
+
+/**
+ * Previous behaviour: getline() and g_strsplit() every line, storing each
+ * rule as a new LdmModalias keyed by a copy of its match.
+ */
+static gpointer load_legacy(const gchar *filename, guint *n_rules)
+{
+        GHashTable *modaliases = NULL;
+        FILE *fp = NULL;
+        char *bfr = NULL;
+        size_t n = 0;
+        ssize_t read = 0;
+
+        fp = fopen(filename, "r");
+        if (!fp) {
+                return NULL;
+        }
+
+        modaliases = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_object_unref);
+
+        while ((read = getline(&bfr, &n, fp)) > 0) {
+                gchar **splits = NULL;
+
+                if (bfr[read - 1] == '\n') {
+                        bfr[read - 1] = '\0';
+                }
+
+                splits = g_strsplit(g_strstrip(bfr), " ", 4);
+                if (g_strv_length(splits) == 4 && g_str_equal(splits[0], "alias")) {
+                        LdmModalias *alias = ldm_modalias_new(splits[1], splits[2], splits[3]);
+                        g_hash_table_replace(modaliases,
+                                             g_strdup(splits[1]),
+                                             g_object_ref_sink(alias));
+                }
+                g_strfreev(splits);
+                free(bfr);
+                bfr = NULL;
+        }
+
+        free(bfr);
+        fclose(fp);
+
+        *n_rules = g_hash_table_size(modaliases);
+        return modaliases;
+}
+
+/**
+ * Current behaviour: read the file once and split it in place
+ */
+static gpointer load_in_place(const gchar *filename, guint *n_rules)
+{
+        LdmModaliasRules *rules = NULL;
+
+        rules = ldm_modalias_rules_new_from_file(filename);
+        if (!rules) {
+                return NULL;
+        }
+
+        *n_rules = ldm_modalias_rules_size(rules);
+        return rules;
+}
+
+typedef struct BenchLoader {
+        const gchar *name;
+        gpointer (*load)(const gchar *filename, guint *n_rules);
+        GDestroyNotify free;
+} BenchLoader;
+
+/**
+ * Load every file in turn into @loaded, returning the number of rules found
+ */
+static guint load_all(gchar **paths, size_t n_paths, const BenchLoader *loader, GPtrArray *loaded)
+{
+        guint ret = 0;
+
+        for (size_t i = 0; i < n_paths; i++) {
+                guint n_rules = 0;
+                gpointer v = loader->load(paths[i], &n_rules);
+
+                if (v) {
+                        g_ptr_array_add(loaded, v);
+                        ret += n_rules;
+                }
+        }
+
+        return ret;
+}
+
+/**
+ * Run one loader across all of the files, reporting allocations, the heap
+ * memory held by the loaded rules, and time
+ */
+static guint bench_loader(gchar **paths, size_t n_paths, const BenchLoader *loader,
+                          guint iterations)
+{
+        g_autoptr(GPtrArray) loaded = NULL;
+        guint64 allocations = 0;
+        gint64 start = 0, elapsed = 0;
+        size_t heap = 0;
+        guint n_rules = 0;
+
+        loaded = g_ptr_array_new_full((guint)n_paths, loader->free);
+
+        /* Don't count one-off setup, such as type registration */
+        load_all(paths, n_paths, loader, loaded);
+        g_ptr_array_set_size(loaded, 0);
+
+        heap = mallinfo2().uordblks;
+        allocations = n_allocations;
+        n_rules = load_all(paths, n_paths, loader, loaded);
+        allocations = n_allocations - allocations;
+        heap = mallinfo2().uordblks - heap;
+        g_ptr_array_set_size(loaded, 0);
+
+        start = g_get_monotonic_time();
+        for (guint n = 0; n < iterations; n++) {
+                load_all(paths, n_paths, loader, loaded);
+                g_ptr_array_set_size(loaded, 0);
+        }
+        elapsed = g_get_monotonic_time() - start;
+
+        fprintf(stdout,
+                "%s: %.2f allocations/rule, %.1f bytes/rule, %.1f us/load (%" G_GUINT64_FORMAT
+                " allocations, %zu bytes for %u rules)\n",
+                loader->name,
+                n_rules ? (gdouble)allocations / n_rules : 0.0,
+                n_rules ? (gdouble)heap / n_rules : 0.0,
+                (gdouble)elapsed / iterations,
+                allocations,
+                heap,
+                n_rules);
+
+        return n_rules;
+}
+
+/**
+ * Run every loader across the files, ensuring they agree on the rule count
+ */
+static gboolean bench_loaders(gchar **paths, size_t n_paths, guint iterations)
+{
+        const BenchLoader legacy = {
+                .name = "getline + GObject",
+                .load = load_legacy,
+                .free = (GDestroyNotify)g_hash_table_unref,
+        };
+        const BenchLoader arena = {
+                .name = "Rule arena       ",
+                .load = load_in_place,
+                .free = (GDestroyNotify)ldm_modalias_rules_free,
+        };
+        guint n_legacy = 0, n_arena = 0;
+
+        n_legacy = bench_loader(paths, n_paths, &legacy, iterations);
+        n_arena = bench_loader(paths, n_paths, &arena, iterations);
+
+        if (n_legacy != n_arena) {
+                fprintf(stderr, "Loaders disagree: %u vs %u rules\n", n_legacy, n_arena);
+                return FALSE;
+        }
+
+        return TRUE;
+}
+
+/**
+ * Write a database of distinct PCI rules, all sharing one driver and package
+ */
+static gchar *write_large_file(const gchar *directory)
+{
+        g_autoptr(GString) contents = NULL;
+        gchar *filename = NULL;
+
+        contents = g_string_new("# Generated by bench-parse\n");
+        for (guint i = 0; i < BENCH_LARGE_RULES; i++) {
+                g_string_append_printf(contents,
+                                       "alias pci:v%08Xd%08Xsv*sd*bc03sc*i* "
+                                       "nvidia nvidia-glx-driver\n",
+                                       0x10DE + i / 0x10000,
+                                       i % 0x10000);
+        }
+
+        filename = g_build_filename(directory, "large.modaliases", NULL);
+        if (!g_file_set_contents(filename, contents->str, (gssize)contents->len, NULL)) {
+                g_free(filename);
+                return NULL;
+        }
+
+        return filename;
+}
+
+int main(__ldm_unused__ int argc, __ldm_unused__ char **argv)
+{
+        g_autofree gchar *directory = NULL;
+        g_autofree gchar *large_file = NULL;
+        glob_t glo = { 0 };
+        int ret = EXIT_FAILURE;
+
+        if (glob(TEST_DATA_ROOT "/*.modaliases", 0, NULL, &glo) != 0) {
+                fprintf(stderr, "No test data found in %s\n", TEST_DATA_ROOT);
+                return EXIT_FAILURE;
+        }
+
+        fprintf(stdout, "Test data:\n");
+        if (!bench_loaders(glo.gl_pathv, glo.gl_pathc, BENCH_ITERATIONS)) {
+                goto cleanup;
+        }
+
+        directory = g_dir_make_tmp("ldm-bench-XXXXXX", NULL);
+        if (directory) {
+                large_file = write_large_file(directory);
+        }
+        if (!large_file) {
+                fprintf(stderr, "Failed to write generated database\n");
+                goto cleanup;
+        }
+
+        fprintf(stdout, "Generated, %u rules:\n", BENCH_LARGE_RULES);
+        if (!bench_loaders(&large_file, 1, 1)) {
+                goto cleanup;
+        }
+
+        ret = EXIT_SUCCESS;
+
+cleanup:
+        if (large_file) {
+                unlink(large_file);
+        }
+        if (directory) {
+                rmdir(directory);
+        }
+        globfree(&glo);
+
+        return ret;
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
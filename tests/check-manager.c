@@ -12,6 +12,7 @@
 #define _GNU_SOURCE
 
 #include <check.h>
+#include <glib/gstdio.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <umockdev.h>
@@ -26,6 +27,9 @@ DEF_AUTOFREE(UMockdevTestbed, g_object_unref)
 #define OPTIMUS_MOCKDEV_FILE TEST_DATA_ROOT "/optimus765m.umockdev"
 #define BLUETOOTH_UMOCKDEV_FILE TEST_DATA_ROOT "/bluetoothUSB.umockdev"
 #define WIFI_UMOCKDEV_FILE TEST_DATA_ROOT "/wifi.umockdev"
+#define YETI_UMOCKDEV_FILE TEST_DATA_ROOT "/blueYeti.umockdev"
+#define LOGITECH_UMOCKDEV_FILE TEST_DATA_ROOT "/logitechm305.umockdev"
+#define RAZER_UMOCKDEV_FILE TEST_DATA_ROOT "/razerMamba.umockdev"
 
 START_TEST(test_manager_simple)
 {
@@ -58,6 +62,18 @@ START_TEST(test_manager_simple)
 
         vendor_id = ldm_device_get_vendor_id(nvidia_device);
         fail_if(vendor_id != LDM_PCI_VENDOR_ID_NVIDIA, "NVIDIA device vendor is not NVIDIA");
+
+        /* Udev properties remain available after construction */
+        fail_if(g_strcmp0(ldm_device_get_udev_property(nvidia_device, "PCI_ID"), "10DE:1C60") != 0,
+                "Wrong PCI_ID property");
+        fail_if(g_strcmp0(ldm_device_get_udev_property(nvidia_device, "ID_VENDOR_FROM_DATABASE"),
+                          "NVIDIA Corporation") != 0,
+                "Wrong ID_VENDOR_FROM_DATABASE property");
+        fail_if(g_strcmp0(ldm_device_get_udev_property(nvidia_device, "PCI_SUBSYS_ID"),
+                          "1558:65A4") != 0,
+                "Wrong PCI_SUBSYS_ID property");
+        fail_if(ldm_device_get_udev_property(nvidia_device, "ID_MODEL") != NULL,
+                "Found a property that isn't set");
 }
 END_TEST
 
@@ -160,6 +176,324 @@ START_TEST(test_manager_wifi_pci)
 }
 END_TEST
 
+/**
+ * Ensure both devices have the same path, priority and children
+ */
+static void assert_same_device(LdmDevice *device, LdmDevice *other)
+{
+        g_autoptr(GList) kids = NULL;
+        g_autoptr(GList) other_kids = NULL;
+
+        fail_if(!g_str_equal(ldm_device_get_path(device), ldm_device_get_path(other)),
+                "Device order differs: %s vs %s",
+                ldm_device_get_path(device),
+                ldm_device_get_path(other));
+        fail_if(ldm_device_get_priority(device) != ldm_device_get_priority(other),
+                "Device priority differs for %s",
+                ldm_device_get_path(device));
+        fail_if(ldm_device_get_device_type(device) != ldm_device_get_device_type(other),
+                "Device type differs for %s",
+                ldm_device_get_path(device));
+        fail_if(ldm_device_get_attributes(device) != ldm_device_get_attributes(other),
+                "Device attributes differ for %s",
+                ldm_device_get_path(device));
+        fail_if(g_strcmp0(ldm_device_get_modalias(device), ldm_device_get_modalias(other)) != 0,
+                "Device modalias differs for %s",
+                ldm_device_get_path(device));
+        fail_if(g_strcmp0(ldm_device_get_name(device), ldm_device_get_name(other)) != 0 ||
+                    g_strcmp0(ldm_device_get_vendor(device), ldm_device_get_vendor(other)) != 0,
+                "Device name differs for %s",
+                ldm_device_get_path(device));
+        fail_if(ldm_device_get_vendor_id(device) != ldm_device_get_vendor_id(other) ||
+                    ldm_device_get_product_id(device) != ldm_device_get_product_id(other),
+                "Device IDs differ for %s",
+                ldm_device_get_path(device));
+        fail_if(g_strcmp0(ldm_device_get_udev_property(device, "MODALIAS"),
+                          ldm_device_get_udev_property(other, "MODALIAS")) != 0,
+                "Device properties differ for %s",
+                ldm_device_get_path(device));
+
+        kids = ldm_device_get_children(device);
+        other_kids = ldm_device_get_children(other);
+        fail_if(g_list_length(kids) != g_list_length(other_kids),
+                "Children differ for %s",
+                ldm_device_get_path(device));
+
+        for (GList *elem = kids; elem; elem = elem->next) {
+                LdmDevice *match = NULL;
+
+                for (GList *other_elem = other_kids; other_elem; other_elem = other_elem->next) {
+                        if (g_str_equal(ldm_device_get_path(elem->data),
+                                        ldm_device_get_path(other_elem->data))) {
+                                match = other_elem->data;
+                                break;
+                        }
+                }
+                fail_if(!match, "Missing child %s", ldm_device_get_path(elem->data));
+                assert_same_device(elem->data, match);
+        }
+}
+
+/**
+ * Ensure parallel enumeration finds the very same devices, in the same
+ * order and with the same parents, as enumerating serially
+ */
+START_TEST(test_manager_parallel)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        g_autoptr(LdmManager) parallel_manager = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(GPtrArray) devices = NULL;
+        g_autoptr(GPtrArray) parallel_devices = NULL;
+        static const gchar *test_files[] = {
+                NV_MOCKDEV_FILE,
+                BLUETOOTH_UMOCKDEV_FILE,
+                WIFI_UMOCKDEV_FILE,
+                YETI_UMOCKDEV_FILE,
+        };
+
+        bed = umockdev_testbed_new();
+        for (size_t i = 0; i < G_N_ELEMENTS(test_files); i++) {
+                fail_if(!umockdev_testbed_add_from_file(bed, test_files[i], NULL),
+                        "Failed to add device %s",
+                        test_files[i]);
+        }
+
+        manager = ldm_manager_new(LDM_MANAGER_FLAGS_NO_MONITOR);
+        fail_if(!manager, "Failed to get the LdmManager");
+        parallel_manager = ldm_manager_new(LDM_MANAGER_FLAGS_NO_MONITOR |
+                                           LDM_MANAGER_FLAGS_PARALLEL_ENUMERATE);
+        fail_if(!parallel_manager, "Failed to get the parallel LdmManager");
+
+        devices = ldm_manager_get_devices(manager, LDM_DEVICE_TYPE_ANY);
+        parallel_devices = ldm_manager_get_devices(parallel_manager, LDM_DEVICE_TYPE_ANY);
+        fail_if(devices->len < 4, "Missing devices");
+        fail_if(devices->len != parallel_devices->len,
+                "Parallel enumeration found %u devices, expected %u",
+                parallel_devices->len,
+                devices->len);
+
+        for (guint i = 0; i < devices->len; i++) {
+                assert_same_device(devices->pdata[i], parallel_devices->pdata[i]);
+        }
+}
+END_TEST
+
+/**
+ * Ensure GPU_QUICK finds the very same GPUs as a full enumeration, and
+ * nothing else
+ */
+START_TEST(test_manager_gpu_quick)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        g_autoptr(LdmManager) quick_manager = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(GPtrArray) gpus = NULL;
+        g_autoptr(GPtrArray) quick_devices = NULL;
+        static const gchar *test_files[] = {
+                OPTIMUS_MOCKDEV_FILE,
+                WIFI_UMOCKDEV_FILE,
+        };
+
+        bed = umockdev_testbed_new();
+        for (size_t i = 0; i < G_N_ELEMENTS(test_files); i++) {
+                fail_if(!umockdev_testbed_add_from_file(bed, test_files[i], NULL),
+                        "Failed to add device %s",
+                        test_files[i]);
+        }
+
+        manager = ldm_manager_new(LDM_MANAGER_FLAGS_NO_MONITOR);
+        fail_if(!manager, "Failed to get the LdmManager");
+        quick_manager = ldm_manager_new(LDM_MANAGER_FLAGS_NO_MONITOR | LDM_MANAGER_FLAGS_GPU_QUICK);
+        fail_if(!quick_manager, "Failed to get the quick LdmManager");
+
+        gpus = ldm_manager_get_devices(manager, LDM_DEVICE_TYPE_GPU);
+        quick_devices = ldm_manager_get_devices(quick_manager, LDM_DEVICE_TYPE_ANY);
+        fail_if(gpus->len != 2, "Invalid device set");
+        fail_if(quick_devices->len != gpus->len,
+                "GPU_QUICK found %u devices, expected %u",
+                quick_devices->len,
+                gpus->len);
+
+        for (guint i = 0; i < gpus->len; i++) {
+                LdmDevice *gpu = gpus->pdata[i];
+                LdmDevice *quick = quick_devices->pdata[i];
+                guint bus = 0, dev = 0, quick_bus = 0, quick_dev = 0;
+                gint func = 0, quick_func = 0;
+
+                fail_if(!g_str_equal(ldm_device_get_path(gpu), ldm_device_get_path(quick)),
+                        "GPU order differs: %s vs %s",
+                        ldm_device_get_path(gpu),
+                        ldm_device_get_path(quick));
+                fail_if(ldm_device_get_device_type(gpu) != ldm_device_get_device_type(quick) ||
+                            ldm_device_get_attributes(gpu) != ldm_device_get_attributes(quick),
+                        "GPU type differs for %s",
+                        ldm_device_get_path(gpu));
+                fail_if(g_strcmp0(ldm_device_get_name(gpu), ldm_device_get_name(quick)) != 0 ||
+                            ldm_device_get_vendor_id(gpu) != ldm_device_get_vendor_id(quick),
+                        "GPU identity differs for %s",
+                        ldm_device_get_path(gpu));
+
+                ldm_pci_device_get_address(LDM_PCI_DEVICE(gpu), &bus, &dev, &func);
+                ldm_pci_device_get_address(LDM_PCI_DEVICE(quick),
+                                           &quick_bus,
+                                           &quick_dev,
+                                           &quick_func);
+                fail_if(bus != quick_bus || dev != quick_dev || func != quick_func,
+                        "GPU address differs for %s",
+                        ldm_device_get_path(gpu));
+        }
+}
+END_TEST
+
+/**
+ * Ensure a manager rebuilt from a snapshot is identical to the one that
+ * took it, and that the snapshot is only used while it's valid.
+ */
+START_TEST(test_manager_snapshot)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        g_autoptr(LdmManager) snapshot_manager = NULL;
+        g_autoptr(LdmManager) stale_manager = NULL;
+        g_autoptr(LdmManager) invalid_manager = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(GPtrArray) devices = NULL;
+        g_autoptr(GPtrArray) snapshot_devices = NULL;
+        g_autoptr(GPtrArray) stale_devices = NULL;
+        g_autoptr(GPtrArray) invalid_devices = NULL;
+        g_autofree gchar *directory = NULL;
+        g_autofree gchar *path = NULL;
+        LdmManagerFlags flags = LDM_MANAGER_FLAGS_NO_MONITOR | LDM_MANAGER_FLAGS_SNAPSHOT;
+        GStatBuf st = { 0 };
+        ino_t inode = 0;
+        static const gchar *test_files[] = {
+                NV_MOCKDEV_FILE,
+                BLUETOOTH_UMOCKDEV_FILE,
+                YETI_UMOCKDEV_FILE,
+        };
+
+        directory = g_dir_make_tmp("ldm-snapshot-XXXXXX", NULL);
+        fail_if(!directory, "Failed to create temporary directory");
+        path = g_build_filename(directory, "devices.snapshot", NULL);
+
+        bed = umockdev_testbed_new();
+        for (size_t i = 0; i < G_N_ELEMENTS(test_files); i++) {
+                fail_if(!umockdev_testbed_add_from_file(bed, test_files[i], NULL),
+                        "Failed to add device %s",
+                        test_files[i]);
+        }
+
+        /* The first manager enumerates, then takes the snapshot */
+        manager = g_object_new(LDM_TYPE_MANAGER, "flags", flags, "snapshot-path", path, NULL);
+        fail_if(!manager, "Failed to get the LdmManager");
+        fail_if(g_stat(path, &st) != 0, "Snapshot wasn't written");
+        inode = st.st_ino;
+
+        /* The second is rebuilt from it, leaving it in place */
+        snapshot_manager =
+            g_object_new(LDM_TYPE_MANAGER, "flags", flags, "snapshot-path", path, NULL);
+        fail_if(!snapshot_manager, "Failed to get the snapshot LdmManager");
+        fail_if(g_stat(path, &st) != 0 || st.st_ino != inode, "Snapshot was taken again");
+
+        devices = ldm_manager_get_devices(manager, LDM_DEVICE_TYPE_ANY);
+        snapshot_devices = ldm_manager_get_devices(snapshot_manager, LDM_DEVICE_TYPE_ANY);
+        fail_if(devices->len < 3, "Missing devices");
+        fail_if(devices->len != snapshot_devices->len,
+                "Snapshot has %u devices, expected %u",
+                snapshot_devices->len,
+                devices->len);
+        for (guint i = 0; i < devices->len; i++) {
+                assert_same_device(devices->pdata[i], snapshot_devices->pdata[i]);
+        }
+
+        /* A new device leaves the snapshot stale */
+        fail_if(!umockdev_testbed_add_from_file(bed, WIFI_UMOCKDEV_FILE, NULL),
+                "Failed to add device %s",
+                WIFI_UMOCKDEV_FILE);
+        stale_manager = g_object_new(LDM_TYPE_MANAGER, "flags", flags, "snapshot-path", path, NULL);
+        fail_if(!stale_manager, "Failed to get the stale LdmManager");
+        stale_devices = ldm_manager_get_devices(stale_manager, LDM_DEVICE_TYPE_ANY);
+        fail_if(stale_devices->len <= devices->len, "Stale snapshot was used");
+
+        /* As does a broken one */
+        fail_if(!g_file_set_contents(path, "LDMSNAPS", -1, NULL), "Failed to break snapshot");
+        invalid_manager =
+            g_object_new(LDM_TYPE_MANAGER, "flags", flags, "snapshot-path", path, NULL);
+        fail_if(!invalid_manager, "Failed to get the LdmManager");
+        invalid_devices = ldm_manager_get_devices(invalid_manager, LDM_DEVICE_TYPE_ANY);
+        fail_if(invalid_devices->len != stale_devices->len, "Broken snapshot was used");
+
+        g_unlink(path);
+        g_rmdir(directory);
+}
+END_TEST
+
+static void device_removed_cb(__ldm_unused__ LdmManager *manager,
+                              __ldm_unused__ LdmDevice *device, guint *n_removed)
+{
+        ++*n_removed;
+}
+
+static void devices_changed_cb(__ldm_unused__ LdmManager *manager, GPtrArray *added,
+                               GPtrArray *removed, GPtrArray *changes)
+{
+        g_ptr_array_add(changes, g_ptr_array_ref(added));
+        g_ptr_array_add(changes, g_ptr_array_ref(removed));
+}
+
+/**
+ * Ensure a burst of hotplug events is announced once, while each device is
+ * still announced by itself
+ */
+START_TEST(test_manager_devices_changed)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(GPtrArray) changes = NULL;
+        GPtrArray *removed = NULL;
+        guint n_removed = 0;
+        gint64 deadline = 0;
+        static const gchar *test_files[] = {
+                LOGITECH_UMOCKDEV_FILE,
+                RAZER_UMOCKDEV_FILE,
+        };
+
+        bed = umockdev_testbed_new();
+        for (size_t i = 0; i < G_N_ELEMENTS(test_files); i++) {
+                fail_if(!umockdev_testbed_add_from_file(bed, test_files[i], NULL),
+                        "Failed to add device %s",
+                        test_files[i]);
+        }
+
+        manager = ldm_manager_new(LDM_MANAGER_FLAGS_NONE);
+        fail_if(!manager, "Failed to get the LdmManager");
+        fail_if(ldm_manager_get_debounce(manager) == 0, "Events aren't debounced by default");
+        ldm_manager_set_debounce(manager, 100);
+
+        changes = g_ptr_array_new_with_free_func((GDestroyNotify)g_ptr_array_unref);
+        g_signal_connect(manager, "device-removed", G_CALLBACK(device_removed_cb), &n_removed);
+        g_signal_connect(manager, "devices-changed", G_CALLBACK(devices_changed_cb), changes);
+
+        /* Both mice are unplugged at once */
+        umockdev_testbed_uevent(bed, "/sys/devices/pci0000:00/0000:00:14.0/usb1/1-2", "remove");
+        umockdev_testbed_uevent(bed, "/sys/devices/pci0000:00/0000:00:1d.0/usb5/5-2", "remove");
+
+        /* Run for long enough to catch any further emission */
+        deadline = g_get_monotonic_time() + G_USEC_PER_SEC;
+        while (g_get_monotonic_time() < deadline) {
+                if (!g_main_context_iteration(NULL, FALSE)) {
+                        g_usleep(1000);
+                }
+        }
+
+        fail_if(n_removed != 2, "Expected 2 device-removed, got %u", n_removed);
+        fail_if(changes->len != 2, "Expected one devices-changed, got %u", changes->len / 2);
+        removed = changes->pdata[1];
+        fail_if(((GPtrArray *)changes->pdata[0])->len != 0, "No devices were added");
+        fail_if(removed->len != 2, "Expected 2 removed devices, got %u", removed->len);
+}
+END_TEST
+
 /**
  * Standard helper for running a test suite
  */
@@ -189,6 +523,10 @@ static Suite *test_create(void)
         tcase_add_test(tc, test_manager_optimus);
         tcase_add_test(tc, test_manager_bluetooth_usb);
         tcase_add_test(tc, test_manager_wifi_pci);
+        tcase_add_test(tc, test_manager_parallel);
+        tcase_add_test(tc, test_manager_gpu_quick);
+        tcase_add_test(tc, test_manager_snapshot);
+        tcase_add_test(tc, test_manager_devices_changed);
 
         return s;
 }
@@ -0,0 +1,350 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Linux Driver Management Developers, Solus Project
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+
+#include <check.h>
+#include <fnmatch.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "modalias-set.h"
+#include "util.h"
+
+/**
+ * My NVIDIA GPU, useful for testing.
+ */
+#define NVIDIA_MODALIAS "pci:v000010DEd00001C60sv00001558sd000065A4bc03sc00i00"
+
+#define GLX_MATCH "pci:v000010DEd00001C60sv*sd*bc03sc*i*"
+
+/*
+ * A single `alias` line of a modaliases file
+ */
+typedef struct TestRule {
+        gchar *match;
+        gchar *driver;
+        gchar *package;
+} TestRule;
+
+static void test_rule_free(gpointer v)
+{
+        TestRule *rule = v;
+
+        g_free(rule->match);
+        g_free(rule->driver);
+        g_free(rule->package);
+        g_free(rule);
+}
+
+/**
+ * Split the contents of a modaliases file into its rules, in order, keeping
+ * any repeated match as is
+ */
+static GPtrArray *test_rules_parse(const gchar *data)
+{
+        g_auto(GStrv) lines = NULL;
+        GPtrArray *ret = NULL;
+
+        ret = g_ptr_array_new_with_free_func(test_rule_free);
+        lines = g_strsplit(data, "\n", -1);
+
+        for (guint i = 0; lines[i]; i++) {
+                g_auto(GStrv) fields = NULL;
+                TestRule *rule = NULL;
+
+                fields = g_strsplit_set(g_strstrip(lines[i]), " \t", -1);
+                if (g_strv_length(fields) != 4 || !g_str_equal(fields[0], "alias")) {
+                        continue;
+                }
+
+                rule = g_new0(TestRule, 1);
+                rule->match = g_strdup(fields[1]);
+                rule->driver = g_strdup(fields[2]);
+                rule->package = g_strdup(fields[3]);
+                g_ptr_array_add(ret, rule);
+        }
+
+        return ret;
+}
+
+/**
+ * Find the rule used for the modalias, as the plugin would: the first
+ * matching rule, replaced by the last rule repeating its match
+ */
+static TestRule *test_rules_lookup(GPtrArray *rules, const gchar *modalias)
+{
+        TestRule *ret = NULL;
+
+        for (guint i = 0; i < rules->len && !ret; i++) {
+                TestRule *rule = rules->pdata[i];
+
+                if (fnmatch(rule->match, modalias, 0) == 0) {
+                        ret = rule;
+                }
+        }
+
+        for (guint i = 0; i < rules->len && ret; i++) {
+                TestRule *rule = rules->pdata[i];
+
+                if (g_str_equal(rule->match, ret->match)) {
+                        ret = rule;
+                }
+        }
+
+        return ret;
+}
+
+/**
+ * Gather the modalias of every device known to the tests
+ */
+static GPtrArray *test_device_modaliases(void)
+{
+        g_autoptr(GDir) dir = NULL;
+        const gchar *name = NULL;
+        GPtrArray *ret = NULL;
+
+        ret = g_ptr_array_new_with_free_func(g_free);
+        g_ptr_array_add(ret, g_strdup(NVIDIA_MODALIAS));
+
+        dir = g_dir_open(TEST_DATA_ROOT, 0, NULL);
+        ck_assert(dir != NULL);
+
+        while ((name = g_dir_read_name(dir)) != NULL) {
+                g_autofree gchar *path = NULL;
+                g_autofree gchar *contents = NULL;
+                g_auto(GStrv) lines = NULL;
+
+                if (!g_str_has_suffix(name, ".umockdev")) {
+                        continue;
+                }
+
+                path = g_build_filename(TEST_DATA_ROOT, name, NULL);
+                fail_if(!g_file_get_contents(path, &contents, NULL, NULL),
+                        "Failed to read umockdev file");
+
+                lines = g_strsplit(contents, "\n", -1);
+                for (guint i = 0; lines[i]; i++) {
+                        if (g_str_has_prefix(lines[i], "E: MODALIAS=")) {
+                                g_ptr_array_add(ret,
+                                                g_strdup(lines[i] + strlen("E: MODALIAS=")));
+                        }
+                }
+        }
+
+        return ret;
+}
+
+/**
+ * Make up a modalias matched by the pattern, for patterns without classes
+ */
+static gchar *test_instantiate_match(const gchar *match)
+{
+        GString *ret = g_string_new(NULL);
+
+        for (const gchar *c = match; *c; c++) {
+                if (*c == '?') {
+                        g_string_append_c(ret, '0');
+                } else if (*c != '*') {
+                        g_string_append_c(ret, *c);
+                }
+        }
+
+        return g_string_free(ret, FALSE);
+}
+
+/**
+ * Ensure wildcards are only covered by wildcards at least as general
+ */
+START_TEST(test_modalias_set_covers)
+{
+        g_autofree gchar *long_specific = NULL;
+
+        /* `?` covers one character, but never a `*` */
+        fail_if(!modalias_pattern_covers("a?c", "abc"), "? should cover a character");
+        fail_if(!modalias_pattern_covers("a?c", "a?c"), "? should cover itself");
+        fail_if(!modalias_pattern_covers("a*c", "a?c"), "* should cover ?");
+        fail_if(modalias_pattern_covers("a?c", "a*c"), "? should not cover *");
+        fail_if(modalias_pattern_covers("a?c", "ac"), "? should not cover nothing");
+        fail_if(modalias_pattern_covers("a?c", "a??c"), "? should not cover ??");
+
+        /* Several `*` */
+        fail_if(!modalias_pattern_covers("a*c", "a*b*c"), "* should cover *b*");
+        fail_if(!modalias_pattern_covers("a*b*c", "a*bx*c"), "*b* should cover *bx*");
+        fail_if(!modalias_pattern_covers("a**", "a*"), "** should cover *");
+        fail_if(!modalias_pattern_covers("*", "a*b?c"), "* should cover everything");
+        fail_if(modalias_pattern_covers("a*b*c", "a*c"), "*b* should not cover *");
+        fail_if(modalias_pattern_covers("a*b*c", "a*c*b"), "*b*c should not cover *c*b");
+        fail_if(!modalias_pattern_covers(GLX_MATCH, NVIDIA_MODALIAS),
+                "Match should cover its device");
+        fail_if(modalias_pattern_covers(NVIDIA_MODALIAS, GLX_MATCH),
+                "Device should not cover its match");
+
+        /* Classes and escapes are only covered by the same pattern */
+        fail_if(!modalias_pattern_covers("a[bc]d", "a[bc]d"), "[bc] should cover itself");
+        fail_if(modalias_pattern_covers("a*d", "a[bc]d"), "Classes should not be covered");
+        fail_if(modalias_pattern_covers("a[bc]d", "abd"), "Classes should not cover");
+        fail_if(!modalias_pattern_covers("a\\*", "a\\*"), "\\* should cover itself");
+        fail_if(modalias_pattern_covers("a\\*", "a*"), "\\* should not cover *");
+        fail_if(modalias_pattern_covers("a*", "a\\*b"), "Escapes should not be covered");
+
+        /* Too long to be compared without allocating */
+        long_specific = g_strnfill(400, 'a');
+        long_specific[0] = 'x';
+        fail_if(!modalias_pattern_covers("x*", long_specific), "x* should cover a long match");
+        fail_if(modalias_pattern_covers("x*b", long_specific), "x*b should not cover a long match");
+}
+END_TEST
+
+/**
+ * Ensure optimising each bundled modaliases file leaves every device with
+ * the same driver and package as before
+ */
+START_TEST(test_modalias_set_optimize)
+{
+        g_autoptr(GDir) dir = NULL;
+        g_autoptr(GPtrArray) device_modaliases = NULL;
+        const gchar *name = NULL;
+        guint n_files = 0;
+
+        device_modaliases = test_device_modaliases();
+
+        dir = g_dir_open(TEST_DATA_ROOT, 0, NULL);
+        ck_assert(dir != NULL);
+
+        while ((name = g_dir_read_name(dir)) != NULL) {
+                autofree(ModaliasSet) *set = NULL;
+                g_autoptr(GPtrArray) rules = NULL;
+                g_autoptr(GPtrArray) optimized = NULL;
+                g_autoptr(GPtrArray) modaliases = NULL;
+                g_autofree gchar *path = NULL;
+                g_autofree gchar *contents = NULL;
+                g_autofree gchar *written = NULL;
+                gsize written_length = 0;
+                FILE *fileh = NULL;
+                guint n_removed = 0;
+                guint n_matched = 0;
+
+                if (!g_str_has_suffix(name, ".modaliases")) {
+                        continue;
+                }
+                ++n_files;
+
+                path = g_build_filename(TEST_DATA_ROOT, name, NULL);
+                fail_if(!g_file_get_contents(path, &contents, NULL, NULL),
+                        "Failed to read modalias file");
+                rules = test_rules_parse(contents);
+
+                set = modalias_set_new();
+                for (guint i = 0; i < rules->len; i++) {
+                        TestRule *rule = rules->pdata[i];
+                        modalias_set_add(set, rule->match, rule->driver, rule->package);
+                }
+                n_removed = modalias_set_optimize(set);
+                fail_if(modalias_set_size(set) + n_removed != rules->len,
+                        "Optimised set has the wrong size");
+
+                fileh = open_memstream(&written, &written_length);
+                ck_assert(fileh != NULL);
+                fail_if(!modalias_set_write(set, fileh), "Failed to write optimised set");
+                fclose(fileh);
+                optimized = test_rules_parse(written);
+                fail_if(optimized->len != modalias_set_size(set),
+                        "Optimised set was written incorrectly");
+
+                /* Every device, and a device matching each rule */
+                modaliases = g_ptr_array_new_with_free_func(g_free);
+                for (guint i = 0; i < device_modaliases->len; i++) {
+                        g_ptr_array_add(modaliases, g_strdup(device_modaliases->pdata[i]));
+                }
+                for (guint i = 0; i < rules->len; i++) {
+                        TestRule *rule = rules->pdata[i];
+                        g_ptr_array_add(modaliases, test_instantiate_match(rule->match));
+                }
+
+                for (guint i = 0; i < modaliases->len; i++) {
+                        const gchar *modalias = modaliases->pdata[i];
+                        TestRule *before = test_rules_lookup(rules, modalias);
+                        TestRule *after = test_rules_lookup(optimized, modalias);
+
+                        if (!before) {
+                                fail_if(after != NULL, "%s: %s gained a rule", name, modalias);
+                                continue;
+                        }
+                        ++n_matched;
+
+                        fail_if(!after, "%s: %s lost its rule", name, modalias);
+                        fail_if(!g_str_equal(before->driver, after->driver),
+                                "%s: %s changed driver",
+                                name,
+                                modalias);
+                        fail_if(!g_str_equal(before->package, after->package),
+                                "%s: %s changed package",
+                                name,
+                                modalias);
+                }
+
+                fail_if(n_matched < rules->len, "%s: Too few modaliases were matched", name);
+        }
+
+        fail_if(n_files < 1, "No modalias files were found");
+}
+END_TEST
+
+/**
+ * Standard helper for running a test suite
+ */
+static int ldm_test_run(Suite *suite)
+{
+        SRunner *runner = NULL;
+        int n_failed = 0;
+
+        runner = srunner_create(suite);
+        srunner_run_all(runner, CK_VERBOSE);
+        n_failed = srunner_ntests_failed(runner);
+        srunner_free(runner);
+
+        return n_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static Suite *test_create(void)
+{
+        Suite *s = NULL;
+        TCase *tc = NULL;
+
+        s = suite_create(__FILE__);
+        tc = tcase_create(__FILE__);
+        suite_add_tcase(s, tc);
+
+        tcase_add_test(tc, test_modalias_set_covers);
+        tcase_add_test(tc, test_modalias_set_optimize);
+
+        return s;
+}
+
+int main(__ldm_unused__ int argc, __ldm_unused__ char **argv)
+{
+        return ldm_test_run(test_create());
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
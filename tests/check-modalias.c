@@ -12,8 +12,12 @@
 #define _GNU_SOURCE
 
 #include <check.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "ldm-private.h"
 #include "ldm.h"
@@ -104,6 +108,299 @@ START_TEST(test_modalias_file)
 }
 END_TEST
 
+/**
+ * Ensure the compiled plugin lookup agrees with matching each modalias in turn
+ */
+START_TEST(test_modalias_plugin_lookup)
+{
+        g_autoptr(LdmPlugin) driver = NULL;
+        g_autoptr(LdmDevice) nvidia_device = NULL;
+        g_autoptr(LdmDevice) other_device = NULL;
+        g_autoptr(LdmProvider) provider = NULL;
+
+        driver = ldm_modalias_plugin_new_from_filename(NV_MODALIAS_FILE);
+        fail_if(!driver, "Failed to construct driver from modalias file");
+
+        nvidia_device = create_fake_device("GTX 1060", "NVIDIA", NVIDIA_MODALIAS);
+        other_device = create_fake_device("Not a GPU", "NVIDIA", GLX_NO_MATCH);
+
+        provider = ldm_plugin_get_provider(driver, nvidia_device);
+        fail_if(!provider, "Failed to find provider for NVIDIA device");
+        fail_if(!g_str_equal(ldm_provider_get_package(provider), "nvidia-glx-driver"),
+                "Provider has the wrong package");
+
+        fail_if(ldm_plugin_get_provider(driver, other_device) != NULL,
+                "Unsupported device should not have a provider");
+}
+END_TEST
+
+START_TEST(test_modalias_plugin_index)
+{
+        g_autoptr(LdmPlugin) driver = NULL;
+        g_autoptr(LdmDevice) razer_device = NULL;
+        g_autoptr(LdmDevice) other_device = NULL;
+        g_autoptr(LdmProvider) provider = NULL;
+        g_autoptr(LdmProvider) wild_provider = NULL;
+        LdmModaliasPlugin *plugin = NULL;
+
+        driver = ldm_modalias_plugin_new("index-test");
+        plugin = LDM_MODALIAS_PLUGIN(driver);
+
+        /* Exact vendor and product, indexed by key */
+        ldm_modalias_plugin_add_modalias(plugin,
+                                         ldm_modalias_new("hid:b0003g*v00001532p0000021E",
+                                                          "razerkbd",
+                                                          "razer-drivers"));
+        /* Wildcarded product, cannot be indexed */
+        ldm_modalias_plugin_add_modalias(plugin,
+                                         ldm_modalias_new("hid:b0003g*v00001532p0000001?",
+                                                          "razercore",
+                                                          "razer-generic"));
+
+        razer_device = create_fake_device("Keyboard", "Razer", "hid:b0003g0001v00001532p0000021E");
+        other_device = create_fake_device("Mouse", "Razer", "hid:b0003g0001v00001532p00000016");
+
+        provider = ldm_plugin_get_provider(driver, razer_device);
+        fail_if(!provider, "Failed to find provider for indexed device");
+        fail_if(!g_str_equal(ldm_provider_get_package(provider), "razer-drivers"),
+                "Indexed provider has the wrong package");
+
+        wild_provider = ldm_plugin_get_provider(driver, other_device);
+        fail_if(!wild_provider, "Failed to find provider through wildcard rule");
+        fail_if(!g_str_equal(ldm_provider_get_package(wild_provider), "razer-generic"),
+                "Wildcard provider has the wrong package");
+}
+END_TEST
+
+/**
+ * Ensure devices of another vendor are rejected, unless a rule matches any
+ * vendor, including one added after the plugin was first used
+ */
+START_TEST(test_modalias_plugin_vendors)
+{
+        g_autoptr(LdmPlugin) driver = NULL;
+        g_autoptr(LdmDevice) razer_device = NULL;
+        g_autoptr(LdmDevice) other_device = NULL;
+        g_autoptr(LdmProvider) provider = NULL;
+        g_autoptr(LdmProvider) wild_provider = NULL;
+        LdmModaliasPlugin *plugin = NULL;
+
+        driver = ldm_modalias_plugin_new("vendor-test");
+        plugin = LDM_MODALIAS_PLUGIN(driver);
+
+        ldm_modalias_plugin_add_modalias(plugin,
+                                         ldm_modalias_new("hid:b0003g*v00001532p*",
+                                                          "razerkbd",
+                                                          "razer-drivers"));
+
+        razer_device = create_fake_device("Keyboard", "Razer", "hid:b0003g0001v00001532p0000021E");
+        other_device = create_fake_device("Mouse", "Logitech", "hid:b0003g0001v0000046Dp0000C52B");
+
+        provider = ldm_plugin_get_provider(driver, razer_device);
+        fail_if(!provider, "Failed to find provider for vendor rule");
+        fail_if(ldm_plugin_get_provider(driver, other_device) != NULL,
+                "Device of another vendor should not have a provider");
+
+        ldm_modalias_plugin_add_modalias(plugin,
+                                         ldm_modalias_new("hid:b0003g*v*p0000C52B",
+                                                          "hid-generic",
+                                                          "any-vendor"));
+
+        wild_provider = ldm_plugin_get_provider(driver, other_device);
+        fail_if(!wild_provider, "Failed to find provider through vendor wildcard rule");
+        fail_if(!g_str_equal(ldm_provider_get_package(wild_provider), "any-vendor"),
+                "Vendor wildcard provider has the wrong package");
+}
+END_TEST
+
+/**
+ * Ensure a modalias with an existing match replaces the earlier rule
+ */
+START_TEST(test_modalias_plugin_replace)
+{
+        g_autoptr(LdmPlugin) driver = NULL;
+        g_autoptr(LdmDevice) nvidia_device = NULL;
+        g_autoptr(LdmProvider) provider = NULL;
+        g_autoptr(LdmPlugin) compiled_driver = NULL;
+        g_autoptr(LdmProvider) compiled_provider = NULL;
+        g_autofree gchar *tmp_dir = NULL;
+        g_autofree gchar *source = NULL;
+        g_autofree gchar *compiled = NULL;
+        g_autofree gchar *contents = NULL;
+        LdmModaliasPlugin *plugin = NULL;
+
+        driver = ldm_modalias_plugin_new("replace-test");
+        plugin = LDM_MODALIAS_PLUGIN(driver);
+
+        ldm_modalias_plugin_add_modalias(plugin,
+                                         ldm_modalias_new(GLX_MATCH, "nouveau", "old-driver"));
+        ldm_modalias_plugin_add_modalias(plugin,
+                                         ldm_modalias_new(GLX_NO_MATCH, "nvidia", "other-driver"));
+        ldm_modalias_plugin_add_modalias(plugin,
+                                         ldm_modalias_new(GLX_MATCH,
+                                                          "nvidia",
+                                                          "nvidia-glx-driver"));
+
+        nvidia_device = create_fake_device("GTX 1060", "NVIDIA", NVIDIA_MODALIAS);
+
+        provider = ldm_plugin_get_provider(driver, nvidia_device);
+        fail_if(!provider, "Failed to find provider for NVIDIA device");
+        fail_if(!g_str_equal(ldm_provider_get_package(provider), "nvidia-glx-driver"),
+                "Replaced rule should not be used");
+
+        /* The same must hold for a rule of a compiled file */
+        tmp_dir = g_dir_make_tmp("ldm-modalias-XXXXXX", NULL);
+        fail_if(!tmp_dir, "Failed to create temporary directory");
+        source = g_build_filename(tmp_dir, "nvidia-glx-driver.modaliases", NULL);
+        compiled = g_strdup_printf("%s.bin", source);
+
+        fail_if(!g_file_get_contents(NV_MODALIAS_FILE, &contents, NULL, NULL),
+                "Failed to read modalias file");
+        fail_if(!g_file_set_contents(source, contents, -1, NULL), "Failed to copy modalias file");
+        fail_if(!ldm_modalias_plugin_compile(source, NULL), "Failed to compile modalias file");
+
+        compiled_driver = ldm_modalias_plugin_new_from_filename(source);
+        fail_if(!compiled_driver, "Failed to construct driver from compiled modalias file");
+        ldm_modalias_plugin_add_modalias(LDM_MODALIAS_PLUGIN(compiled_driver),
+                                         ldm_modalias_new(GLX_MATCH, "nvidia", "replaced-driver"));
+
+        compiled_provider = ldm_plugin_get_provider(compiled_driver, nvidia_device);
+        fail_if(!compiled_provider, "Failed to find provider for NVIDIA device");
+        fail_if(!g_str_equal(ldm_provider_get_package(compiled_provider), "replaced-driver"),
+                "Replaced compiled rule should not be used");
+
+        unlink(compiled);
+        unlink(source);
+        rmdir(tmp_dir);
+}
+END_TEST
+
+/**
+ * Ensure the compiled form of a modaliases file is used and gives the same
+ * results, and is ignored once the source file changes.
+ */
+START_TEST(test_modalias_plugin_compile)
+{
+        g_autoptr(LdmPlugin) driver = NULL;
+        g_autoptr(LdmPlugin) stale_driver = NULL;
+        g_autoptr(LdmDevice) nvidia_device = NULL;
+        g_autoptr(LdmDevice) other_device = NULL;
+        g_autoptr(LdmProvider) provider = NULL;
+        g_autoptr(LdmProvider) stale_provider = NULL;
+        g_autofree gchar *tmp_dir = NULL;
+        g_autofree gchar *source = NULL;
+        g_autofree gchar *compiled = NULL;
+        g_autofree gchar *contents = NULL;
+        g_autofree gchar *appended = NULL;
+
+        tmp_dir = g_dir_make_tmp("ldm-modalias-XXXXXX", NULL);
+        fail_if(!tmp_dir, "Failed to create temporary directory");
+        source = g_build_filename(tmp_dir, "nvidia-glx-driver.modaliases", NULL);
+        compiled = g_strdup_printf("%s.bin", source);
+
+        fail_if(!g_file_get_contents(NV_MODALIAS_FILE, &contents, NULL, NULL),
+                "Failed to read modalias file");
+        fail_if(!g_file_set_contents(source, contents, -1, NULL), "Failed to copy modalias file");
+
+        fail_if(!ldm_modalias_plugin_compile(source, NULL), "Failed to compile modalias file");
+        fail_if(!g_file_test(compiled, G_FILE_TEST_EXISTS), "Compiled file is missing");
+
+        nvidia_device = create_fake_device("GTX 1060", "NVIDIA", NVIDIA_MODALIAS);
+        other_device = create_fake_device("Not a GPU", "NVIDIA", GLX_NO_MATCH);
+
+        driver = ldm_modalias_plugin_new_from_filename(source);
+        fail_if(!driver, "Failed to construct driver from compiled modalias file");
+        fail_if(!g_str_equal(ldm_plugin_get_name(driver), "nvidia-glx-driver"),
+                "Compiled driver has the wrong name");
+
+        provider = ldm_plugin_get_provider(driver, nvidia_device);
+        fail_if(!provider, "Failed to find provider for NVIDIA device");
+        fail_if(!g_str_equal(ldm_provider_get_package(provider), "nvidia-glx-driver"),
+                "Provider has the wrong package");
+        fail_if(ldm_plugin_get_provider(driver, other_device) != NULL,
+                "Unsupported device should not have a provider");
+
+        /* Changing the source must invalidate the compiled form */
+        appended = g_strdup_printf("%salias %s nvidia nvidia-glx-driver-stale\n",
+                                   contents,
+                                   GLX_NO_MATCH);
+        fail_if(!g_file_set_contents(source, appended, -1, NULL), "Failed to update modalias file");
+
+        stale_driver = ldm_modalias_plugin_new_from_filename(source);
+        fail_if(!stale_driver, "Failed to construct driver from updated modalias file");
+
+        stale_provider = ldm_plugin_get_provider(stale_driver, other_device);
+        fail_if(!stale_provider, "Stale compiled modalias file was used");
+        fail_if(!g_str_equal(ldm_provider_get_package(stale_provider), "nvidia-glx-driver-stale"),
+                "Provider has the wrong package");
+
+        unlink(compiled);
+        unlink(source);
+        rmdir(tmp_dir);
+}
+END_TEST
+
+/**
+ * Ensure the compiled form is still used once the source file loses the
+ * sub-second part of its modification time, as when it is packaged.
+ */
+START_TEST(test_modalias_plugin_compile_installed)
+{
+        g_autoptr(LdmPlugin) driver = NULL;
+        g_autoptr(LdmDevice) nvidia_device = NULL;
+        g_autoptr(LdmProvider) provider = NULL;
+        g_autofree gchar *tmp_dir = NULL;
+        g_autofree gchar *source = NULL;
+        g_autofree gchar *compiled = NULL;
+        g_autofree gchar *contents = NULL;
+        g_autofree gchar *database = NULL;
+        gsize database_length = 0;
+        struct stat st = { 0 };
+        struct timespec times[2] = { 0 };
+        gchar *package = NULL;
+
+        tmp_dir = g_dir_make_tmp("ldm-modalias-XXXXXX", NULL);
+        fail_if(!tmp_dir, "Failed to create temporary directory");
+        source = g_build_filename(tmp_dir, "nvidia-glx-driver.modaliases", NULL);
+        compiled = g_strdup_printf("%s.bin", source);
+
+        fail_if(!g_file_get_contents(NV_MODALIAS_FILE, &contents, NULL, NULL),
+                "Failed to read modalias file");
+        fail_if(!g_file_set_contents(source, contents, -1, NULL), "Failed to copy modalias file");
+        fail_if(!ldm_modalias_plugin_compile(source, NULL), "Failed to compile modalias file");
+
+        /* Rename the package within the compiled form, so we can tell it was used */
+        fail_if(!g_file_get_contents(compiled, &database, &database_length, NULL),
+                "Failed to read compiled modalias file");
+        package = memmem(database, database_length, "nvidia-glx-driver", 17);
+        fail_if(!package, "Compiled modalias file lacks the package");
+        memcpy(package, "nvidia-glx-DRIVER", 17);
+        fail_if(!g_file_set_contents(compiled, database, (gssize)database_length, NULL),
+                "Failed to update compiled modalias file");
+
+        /* Truncate the modification time of the source to whole seconds */
+        fail_if(stat(source, &st) != 0, "Failed to stat modalias file");
+        times[0] = st.st_atim;
+        times[1].tv_sec = st.st_mtim.tv_sec;
+        times[1].tv_nsec = 0;
+        fail_if(utimensat(AT_FDCWD, source, times, 0) != 0, "Failed to set modification time");
+
+        nvidia_device = create_fake_device("GTX 1060", "NVIDIA", NVIDIA_MODALIAS);
+
+        driver = ldm_modalias_plugin_new_from_filename(source);
+        fail_if(!driver, "Failed to construct driver from compiled modalias file");
+
+        provider = ldm_plugin_get_provider(driver, nvidia_device);
+        fail_if(!provider, "Failed to find provider for NVIDIA device");
+        fail_if(!g_str_equal(ldm_provider_get_package(provider), "nvidia-glx-DRIVER"),
+                "Compiled modalias file was not used");
+
+        unlink(compiled);
+        unlink(source);
+        rmdir(tmp_dir);
+}
+END_TEST
+
 /**
  * Standard helper for running a test suite
  */
@@ -132,6 +429,12 @@ static Suite *test_create(void)
         tcase_add_test(tc, test_modalias_simple);
         tcase_add_test(tc, test_modalias_device);
         tcase_add_test(tc, test_modalias_file);
+        tcase_add_test(tc, test_modalias_plugin_lookup);
+        tcase_add_test(tc, test_modalias_plugin_index);
+        tcase_add_test(tc, test_modalias_plugin_vendors);
+        tcase_add_test(tc, test_modalias_plugin_replace);
+        tcase_add_test(tc, test_modalias_plugin_compile);
+        tcase_add_test(tc, test_modalias_plugin_compile_installed);
 
         return s;
 }
@@ -15,6 +15,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <umockdev.h>
+#include <unistd.h>
 
 #include "ldm-private.h"
 #include "ldm.h"
@@ -32,6 +33,34 @@ DEF_AUTOFREE(UMockdevTestbed, g_object_unref)
 #define RAZER_MOCKDEV_FILE TEST_DATA_ROOT "/razer-ornata-chroma.umockdev"
 #define RAZER_MODALIAS TEST_DATA_ROOT "razer-drivers.modaliases"
 
+/*
+ * Plugin that provides for every device, standing in for those written in
+ * other languages
+ */
+typedef struct _LdmTestPlugin {
+        LdmPlugin parent;
+} LdmTestPlugin;
+
+typedef struct _LdmTestPluginClass {
+        LdmPluginClass parent_class;
+} LdmTestPluginClass;
+
+G_DEFINE_TYPE(LdmTestPlugin, ldm_test_plugin, LDM_TYPE_PLUGIN)
+
+static LdmProvider *ldm_test_plugin_get_provider(LdmPlugin *plugin, LdmDevice *device)
+{
+        return ldm_provider_new(plugin, device, "test-package");
+}
+
+static void ldm_test_plugin_class_init(LdmTestPluginClass *klazz)
+{
+        LDM_PLUGIN_CLASS(klazz)->get_provider = ldm_test_plugin_get_provider;
+}
+
+static void ldm_test_plugin_init(__ldm_unused__ LdmTestPlugin *self)
+{
+}
+
 static UMockdevTestbed *create_bed_from(const char *mockdevname)
 {
         UMockdevTestbed *bed = NULL;
@@ -189,6 +218,381 @@ START_TEST(test_plugins_razer)
 }
 END_TEST
 
+/**
+ * Ensure the manager keeps its merged index in sync when a plugin is
+ * replaced, or has new rules added to it after being added.
+ */
+START_TEST(test_plugins_replace)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(LdmGPUConfig) gpu = NULL;
+        g_autoptr(GPtrArray) providers = NULL;
+        LdmPlugin *replacement = NULL;
+        LdmDevice *device = NULL;
+        const gchar *plugin_id = NULL;
+
+        bed = create_bed_from(OPTIMUS_MOCKDEV_FILE);
+        manager = ldm_manager_new(0);
+
+        fail_if(!ldm_manager_add_modalias_plugin_for_path(manager, NV_340_MODALIAS),
+                "Failed to add 340 modalias file");
+        fail_if(!ldm_manager_add_modalias_plugin_for_path(manager, NV_MAIN_MODALIAS),
+                "Failed to add main modalias file");
+
+        gpu = ldm_gpu_config_new(manager);
+        fail_if(!gpu, "Failed to create GPUConfig");
+        device = ldm_gpu_config_get_detection_device(gpu);
+
+        providers = ldm_manager_get_providers(manager, device);
+        fail_if(providers->len != 2, "Expected 2 providers, got %u providers", providers->len);
+        g_clear_pointer(&providers, g_ptr_array_unref);
+
+        /* Replace the main driver with an empty plugin of the same name */
+        replacement = ldm_modalias_plugin_new("nvidia-glx-driver");
+        ldm_plugin_set_priority(replacement, 10);
+        ldm_manager_add_plugin(manager, replacement);
+
+        providers = ldm_manager_get_providers(manager, device);
+        fail_if(providers->len != 1, "Expected 1 provider, got %u providers", providers->len);
+        plugin_id = ldm_plugin_get_name(ldm_provider_get_plugin(providers->pdata[0]));
+        fail_if(!g_str_equal(plugin_id, "nvidia-340-glx-driver"),
+                "Remaining candidate should be nvidia-340-glx-driver, got %s",
+                plugin_id);
+        g_clear_pointer(&providers, g_ptr_array_unref);
+
+        /* Rules added to an existing plugin must also be picked up */
+        ldm_modalias_plugin_add_modalias(LDM_MODALIAS_PLUGIN(replacement),
+                                         ldm_modalias_new("pci:v000010DEd000011E2sv*sd*bc03sc*i*",
+                                                          "nvidia",
+                                                          "nvidia-glx-driver"));
+
+        providers = ldm_manager_get_providers(manager, device);
+        fail_if(providers->len != 2, "Expected 2 providers, got %u providers", providers->len);
+        plugin_id = ldm_plugin_get_name(ldm_provider_get_plugin(providers->pdata[0]));
+        fail_if(!g_str_equal(plugin_id, "nvidia-glx-driver"),
+                "First candidate should be nvidia-glx-driver, got %s",
+                plugin_id);
+}
+END_TEST
+
+/**
+ * Ensure repeated queries hand back the remembered providers, without
+ * sharing the array itself with the caller.
+ */
+START_TEST(test_plugins_cached)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(LdmGPUConfig) gpu = NULL;
+        g_autoptr(GPtrArray) first = NULL;
+        g_autoptr(GPtrArray) second = NULL;
+        LdmDevice *device = NULL;
+
+        bed = create_bed_from(OPTIMUS_MOCKDEV_FILE);
+        manager = ldm_manager_new(0);
+
+        fail_if(!ldm_manager_add_modalias_plugin_for_path(manager, NV_340_MODALIAS),
+                "Failed to add 340 modalias file");
+
+        gpu = ldm_gpu_config_new(manager);
+        fail_if(!gpu, "Failed to create GPUConfig");
+        device = ldm_gpu_config_get_detection_device(gpu);
+
+        first = ldm_manager_get_providers(manager, device);
+        second = ldm_manager_get_providers(manager, device);
+        fail_if(first == second, "Callers shouldn't share the cached array");
+        fail_if(first->len != 1, "Expected 1 provider, got %u providers", first->len);
+        fail_if(second->len != 1, "Expected 1 provider, got %u providers", second->len);
+        fail_if(first->pdata[0] != second->pdata[0], "Provider should have been cached");
+
+        /* Modifying our copy mustn't affect later queries */
+        g_ptr_array_set_size(first, 0);
+        g_clear_pointer(&second, g_ptr_array_unref);
+        second = ldm_manager_get_providers(manager, device);
+        fail_if(second->len != 1, "Expected 1 provider, got %u providers", second->len);
+        g_clear_pointer(&first, g_ptr_array_unref);
+        g_clear_pointer(&second, g_ptr_array_unref);
+
+        /* New plugins invalidate the cache */
+        fail_if(!ldm_manager_add_modalias_plugin_for_path(manager, NV_MAIN_MODALIAS),
+                "Failed to add main modalias file");
+        first = ldm_manager_get_providers(manager, device);
+        fail_if(first->len != 2, "Expected 2 providers, got %u providers", first->len);
+}
+END_TEST
+
+/**
+ * Ensure a plugin that isn't indexed is reordered when its priority
+ * changes after it was added.
+ */
+START_TEST(test_plugins_priority)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(LdmGPUConfig) gpu = NULL;
+        g_autoptr(GPtrArray) providers = NULL;
+        LdmPlugin *plugin = NULL;
+        LdmDevice *device = NULL;
+
+        bed = create_bed_from(OPTIMUS_MOCKDEV_FILE);
+        manager = ldm_manager_new(0);
+
+        fail_if(!ldm_manager_add_modalias_plugin_for_path(manager, NV_340_MODALIAS),
+                "Failed to add 340 modalias file");
+        plugin = g_object_new(ldm_test_plugin_get_type(), "name", "test", "priority", -1, NULL);
+        ldm_manager_add_plugin(manager, plugin);
+
+        gpu = ldm_gpu_config_new(manager);
+        fail_if(!gpu, "Failed to create GPUConfig");
+        device = ldm_gpu_config_get_detection_device(gpu);
+
+        providers = ldm_manager_get_providers(manager, device);
+        fail_if(providers->len != 2, "Expected 2 providers, got %u providers", providers->len);
+        fail_if(ldm_provider_get_plugin(providers->pdata[1]) != plugin,
+                "Test plugin should come last");
+        g_clear_pointer(&providers, g_ptr_array_unref);
+
+        ldm_plugin_set_priority(plugin, 10);
+        providers = ldm_manager_get_providers(manager, device);
+        fail_if(providers->len != 2, "Expected 2 providers, got %u providers", providers->len);
+        fail_if(ldm_provider_get_plugin(providers->pdata[0]) != plugin,
+                "Test plugin should come first");
+}
+END_TEST
+
+/**
+ * Ensure matching statistics are only gathered on request, and account for
+ * the rules that matched.
+ */
+START_TEST(test_plugins_match_stats)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(LdmGPUConfig) gpu = NULL;
+        g_autoptr(GPtrArray) providers = NULL;
+        g_autoptr(GPtrArray) stats = NULL;
+        LdmMatchStats *totals = NULL;
+        gboolean found_rule = FALSE;
+
+        bed = create_bed_from(OPTIMUS_MOCKDEV_FILE);
+
+        /* Disabled by default */
+        manager = ldm_manager_new(0);
+        fail_if(!ldm_manager_add_modalias_plugin_for_path(manager, NV_340_MODALIAS),
+                "Failed to add 340 modalias file");
+        stats = ldm_manager_get_match_stats(manager);
+        fail_if(stats->len != 0, "Statistics should be disabled by default");
+        g_clear_pointer(&stats, g_ptr_array_unref);
+        g_clear_object(&manager);
+
+        manager = ldm_manager_new(LDM_MANAGER_FLAGS_MATCH_STATS);
+        fail_if(!ldm_manager_add_modalias_plugin_for_path(manager, NV_340_MODALIAS),
+                "Failed to add 340 modalias file");
+
+        gpu = ldm_gpu_config_new(manager);
+        fail_if(!gpu, "Failed to create GPUConfig");
+        providers = ldm_manager_get_providers(manager, ldm_gpu_config_get_detection_device(gpu));
+        fail_if(providers->len != 1, "Expected 1 provider, got %u providers", providers->len);
+
+        stats = ldm_manager_get_match_stats(manager);
+        fail_if(stats->len < 2, "Expected plugin and rule statistics");
+
+        /* Plugin totals come first */
+        totals = stats->pdata[0];
+        fail_if(totals->match != NULL, "First statistics should be plugin totals");
+        fail_if(!g_str_equal(totals->plugin, "nvidia-340-glx-driver"),
+                "Unexpected plugin %s",
+                totals->plugin);
+        fail_if(totals->n_matches < 1, "Plugin should have matched");
+        fail_if(totals->n_candidates < totals->n_matches, "More matches than tests");
+
+        for (guint i = 1; i < stats->len; i++) {
+                LdmMatchStats *rule = stats->pdata[i];
+
+                fail_if(!rule->match, "Expected rule statistics");
+                fail_if(!g_str_equal(rule->plugin, totals->plugin), "Rule has the wrong plugin");
+                if (rule->n_matches > 0) {
+                        found_rule = TRUE;
+                }
+        }
+        fail_if(!found_rule, "Expected the matching rule in the statistics");
+}
+END_TEST
+
+static void plugins_changed_cb(__ldm_unused__ LdmManager *manager, gpointer v)
+{
+        gboolean *changed = v;
+
+        *changed = TRUE;
+}
+
+/**
+ * Run the main loop until the manager has reloaded its plugins, giving up
+ * after a couple of seconds
+ */
+static gboolean wait_for_plugins_changed(LdmManager *manager)
+{
+        gboolean changed = FALSE;
+        gint64 deadline = 0;
+        gulong id = 0;
+
+        id = g_signal_connect(manager,
+                              "plugins-changed",
+                              G_CALLBACK(plugins_changed_cb),
+                              &changed);
+
+        deadline = g_get_monotonic_time() + 2 * G_USEC_PER_SEC;
+        while (!changed && g_get_monotonic_time() < deadline) {
+                if (!g_main_context_iteration(NULL, FALSE)) {
+                        g_usleep(1000);
+                }
+        }
+
+        g_signal_handler_disconnect(manager, id);
+        return changed;
+}
+
+static void copy_file(const gchar *source, const gchar *target)
+{
+        g_autofree gchar *contents = NULL;
+        gsize length = 0;
+
+        fail_if(!g_file_get_contents(source, &contents, &length, NULL),
+                "Failed to read %s",
+                source);
+        fail_if(!g_file_set_contents(target, contents, (gssize)length, NULL),
+                "Failed to write %s",
+                target);
+}
+
+/**
+ * Ensure watched modalias directories pick up new and removed files
+ */
+START_TEST(test_plugins_watch)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(LdmGPUConfig) gpu = NULL;
+        g_autoptr(GPtrArray) providers = NULL;
+        g_autofree gchar *directory = NULL;
+        g_autofree gchar *nv_340 = NULL;
+        g_autofree gchar *nv_main = NULL;
+        LdmDevice *device = NULL;
+        const gchar *plugin_id = NULL;
+
+        bed = create_bed_from(OPTIMUS_MOCKDEV_FILE);
+
+        directory = g_dir_make_tmp("ldm-watch-XXXXXX", NULL);
+        fail_if(!directory, "Failed to create temporary directory");
+        nv_340 = g_build_filename(directory, "nvidia-340-glx-driver.modaliases", NULL);
+        nv_main = g_build_filename(directory, "nvidia-glx-driver.modaliases", NULL);
+        copy_file(NV_340_MODALIAS, nv_340);
+
+        manager = ldm_manager_new(LDM_MANAGER_FLAGS_NO_MONITOR |
+                                  LDM_MANAGER_FLAGS_WATCH_MODALIASES);
+        fail_if(!ldm_manager_add_modalias_plugins_for_directory(manager, directory),
+                "Failed to add watched modalias directory");
+
+        gpu = ldm_gpu_config_new(manager);
+        fail_if(!gpu, "Failed to create GPUConfig");
+        device = ldm_gpu_config_get_detection_device(gpu);
+
+        providers = ldm_manager_get_providers(manager, device);
+        fail_if(providers->len != 1, "Expected 1 provider, got %u providers", providers->len);
+        g_clear_pointer(&providers, g_ptr_array_unref);
+
+        /* New files are added as the newest plugin */
+        copy_file(NV_MAIN_MODALIAS, nv_main);
+        fail_if(!wait_for_plugins_changed(manager), "New modalias file wasn't loaded");
+
+        providers = ldm_manager_get_providers(manager, device);
+        fail_if(providers->len != 2, "Expected 2 providers, got %u providers", providers->len);
+        plugin_id = ldm_plugin_get_name(ldm_provider_get_plugin(providers->pdata[0]));
+        fail_if(!g_str_equal(plugin_id, "nvidia-glx-driver"),
+                "First candidate should be nvidia-glx-driver, got %s",
+                plugin_id);
+        g_clear_pointer(&providers, g_ptr_array_unref);
+
+        /* Removing the file removes its plugin */
+        unlink(nv_main);
+        fail_if(!wait_for_plugins_changed(manager), "Removed modalias file wasn't unloaded");
+
+        providers = ldm_manager_get_providers(manager, device);
+        fail_if(providers->len != 1, "Expected 1 provider, got %u providers", providers->len);
+        plugin_id = ldm_plugin_get_name(ldm_provider_get_plugin(providers->pdata[0]));
+        fail_if(!g_str_equal(plugin_id, "nvidia-340-glx-driver"),
+                "Remaining candidate should be nvidia-340-glx-driver, got %s",
+                plugin_id);
+
+        unlink(nv_340);
+        rmdir(directory);
+}
+END_TEST
+
+/**
+ * Ensure resolving every device at once gives the same providers, in the
+ * same order, as asking about each device in turn.
+ */
+START_TEST(test_plugins_all_providers)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(GPtrArray) devices = NULL;
+        g_autoptr(GHashTable) all_providers = NULL;
+        g_autoptr(GHashTable) usb_providers = NULL;
+        guint n_expected = 0;
+
+        bed = create_bed_from(OPTIMUS_MOCKDEV_FILE);
+        manager = ldm_manager_new(0);
+
+        fail_if(!ldm_manager_add_modalias_plugins_for_directory(manager, MODALIAS_DIR),
+                "Failed to add main modalias directory");
+
+        all_providers = ldm_manager_get_all_providers(manager, LDM_DEVICE_TYPE_ANY);
+        devices = ldm_manager_get_devices(manager, LDM_DEVICE_TYPE_ANY);
+
+        for (guint i = 0; i < devices->len; i++) {
+                g_autoptr(GPtrArray) expected = NULL;
+                GPtrArray *providers = NULL;
+
+                expected = ldm_manager_get_providers(manager, devices->pdata[i]);
+                providers = g_hash_table_lookup(all_providers, devices->pdata[i]);
+
+                if (expected->len < 1) {
+                        fail_if(providers != NULL, "Device without providers should be omitted");
+                        continue;
+                }
+                ++n_expected;
+
+                fail_if(!providers, "Missing providers for device");
+                fail_if(providers->len != expected->len,
+                        "Expected %u providers, got %u providers",
+                        expected->len,
+                        providers->len);
+
+                for (guint j = 0; j < providers->len; j++) {
+                        fail_if(ldm_provider_get_plugin(providers->pdata[j]) !=
+                                    ldm_provider_get_plugin(expected->pdata[j]),
+                                "Providers are in the wrong order");
+                        fail_if(!g_str_equal(ldm_provider_get_package(providers->pdata[j]),
+                                             ldm_provider_get_package(expected->pdata[j])),
+                                "Providers have different packages");
+                }
+        }
+
+        fail_if(n_expected < 1, "Expected at least one device with providers");
+        fail_if(g_hash_table_size(all_providers) != n_expected,
+                "Expected %u devices, got %u devices",
+                n_expected,
+                g_hash_table_size(all_providers));
+
+        /* The class mask must be respected */
+        usb_providers = ldm_manager_get_all_providers(manager, LDM_DEVICE_TYPE_USB);
+        fail_if(g_hash_table_size(usb_providers) != 0, "Expected no USB devices with providers");
+}
+END_TEST
+
 /**
  * Standard helper for running a test suite
  */
@@ -218,6 +622,12 @@ static Suite *test_create(void)
         tcase_add_test(tc, test_plugins_nvidia_multiple);
         tcase_add_test(tc, test_plugins_nvidia_multiple_glob);
         tcase_add_test(tc, test_plugins_razer);
+        tcase_add_test(tc, test_plugins_replace);
+        tcase_add_test(tc, test_plugins_cached);
+        tcase_add_test(tc, test_plugins_priority);
+        tcase_add_test(tc, test_plugins_match_stats);
+        tcase_add_test(tc, test_plugins_watch);
+        tcase_add_test(tc, test_plugins_all_providers);
 
         return s;
 }
@@ -98,6 +98,41 @@ START_TEST(test_manager_usb_noisy)
 }
 END_TEST
 
+/**
+ * Ensure a USB device matches by the modaliases of any of its interfaces,
+ * and not only its own.
+ */
+START_TEST(test_manager_usb_interfaces)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(GPtrArray) devices = NULL;
+        g_autoptr(LdmModalias) first = NULL;
+        g_autoptr(LdmModalias) last = NULL;
+        g_autoptr(LdmModalias) missing = NULL;
+        LdmDevice *device = NULL;
+
+        bed = umockdev_testbed_new();
+        fail_if(!umockdev_testbed_add_from_file(bed, YETI_UMOCKDEV_FILE, NULL),
+                "Failed to create Blue Yeti device");
+        manager = ldm_manager_new(LDM_MANAGER_FLAGS_NO_MONITOR);
+        fail_if(!manager, "Failed to get the LdmManager");
+
+        devices = ldm_manager_get_devices(manager, LDM_DEVICE_TYPE_USB | LDM_DEVICE_TYPE_AUDIO);
+        fail_if(!devices, "Failed to obtain devices");
+        fail_if(devices->len != 1, "Expected 1 device, got %u devices", devices->len);
+        device = devices->pdata[0];
+
+        first = ldm_modalias_new("usb:vB58Ep9E84d*ic01isc01*", "snd_usb_audio", "test-package");
+        last = ldm_modalias_new("usb:vB58Ep9E84d*ic03isc00*in03", "usbhid", "test-package");
+        missing = ldm_modalias_new("usb:vB58Ep9E84d*ic0E*", "uvcvideo", "test-package");
+
+        fail_if(!ldm_modalias_matches_device(first, device), "Failed to match first interface");
+        fail_if(!ldm_modalias_matches_device(last, device), "Failed to match last interface");
+        fail_if(ldm_modalias_matches_device(missing, device), "Matched a missing interface");
+}
+END_TEST
+
 /**
  * Standard helper for running a test suite
  */
@@ -125,6 +160,7 @@ static Suite *test_create(void)
 
         tcase_add_test(tc, test_manager_usb_simple);
         tcase_add_test(tc, test_manager_usb_noisy);
+        tcase_add_test(tc, test_manager_usb_interfaces);
 
         return s;
 }